@@ -6,6 +6,7 @@
 int B25Decoder::strip        = 1;
 int B25Decoder::emm_proc     = 0;
 int B25Decoder::multi2_round = 4;
+const char *B25Decoder::broker_path = nullptr;
 
 B25Decoder::B25Decoder() : _bcas(nullptr), _b25(nullptr), _data(nullptr)
 {
@@ -25,7 +26,10 @@ int B25Decoder::init()
 	if (_b25)
 		return -2;
 
-	_bcas = create_b_cas_card();
+	if (broker_path)
+		_bcas = create_b_cas_broker_card(broker_path);	// share the card of b25broker
+	else
+		_bcas = create_b_cas_card();
 	if (!_bcas)
 		return -3;
 
@@ -11,9 +11,11 @@
 	#include <windows.h>
 	#include "arib_std_b25.h"
 	#include "arib_std_b25_error_code.h"
+	#include "b_cas_broker.h"
 #else
 	#include <aribb25/arib_std_b25.h>
 	#include <aribb25/arib_std_b25_error_code.h>
+	#include <aribb25/b_cas_broker.h>
 	#include "typedef.h"
 #endif
 
@@ -42,6 +44,7 @@ public:
 	static int strip;
 	static int emm_proc;
 	static int multi2_round;
+	static const char *broker_path;	// b25broker socket, nullptr: open the card reader
 
 private:
 	std::mutex _mtx;
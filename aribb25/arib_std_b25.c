@@ -1,13 +1,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+#if defined(_WIN32)
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#if defined(SYS_memfd_create)
+		#define TS_MIRROR_MEMFD
+	#endif
+	#if defined(MADV_HUGEPAGE)
+		#define TS_HUGE_PAGE_MADVISE
+	#endif
+#endif
 
 #include "arib_std_b25.h"
 #include "arib_std_b25_error_code.h"
+#include "ecm_worker.h"
+#include "ecm_worker_error_code.h"
+#include "memory_allocator.h"
 #include "multi2.h"
 #include "ts_common_types.h"
 #include "ts_section_parser.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define TS_SYNC_SSE2
+#endif
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  inner structures
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -31,6 +54,14 @@ typedef struct {
 	uint8_t          *tail;
 	int32_t           max;
 
+	int32_t           kind;    /* TS_WORK_BUFFER_KIND */
+	int32_t           option;  /* ARIB_STD_B25_WORK_BUFFER_* */
+	intptr_t          limit;   /* max is not grown beyond, 0 - none */
+
+	uint8_t          *base;    /* allocated block the pool is aligned in, NULL - mapped */
+
+	const MEMORY_ALLOCATOR *mem;
+
 } TS_WORK_BUFFER;
 
 typedef struct {
@@ -60,10 +91,25 @@ typedef struct {
 	TS_SECTION_PARSER *ecm;
 
 	MULTI2            *m2;
+	int32_t            keyless;   /* m2 has no scramble key, decrypting fails */
 
 	int32_t            unpurchased;
 	int32_t            last_error;
 
+	int32_t            slot;  /* index in DECRYPTOR_LIST::slot */
+
+	uint32_t           tag;      /* names the decryptor to the ECM worker */
+	uint32_t           posted;   /* ECMs handed to the worker */
+	uint32_t           applied;  /* of them, results applied */
+	int32_t            parity;   /* scrambling control last decrypted */
+	int32_t            waiting;  /* packets held in KEY_WAIT */
+
+	uint8_t            key[16];   /* scramble keys applied, odd then even */
+	uint8_t            used[16];  /* keys the last period of each parity ran on */
+	int32_t            used_mask; /* parities in used, bit 0 - even, 1 - odd */
+	uint8_t            run[8];    /* key the current period runs on */
+	int32_t            run_set;   /* run taken since the parity switch */
+
 	void              *prev;
 	void              *next;
 
@@ -73,8 +119,27 @@ typedef struct {
 	DECRYPTOR_ELEM    *head;
 	DECRYPTOR_ELEM    *tail;
 	int32_t            count;
+	DECRYPTOR_ELEM   **slot;
+	int32_t            slot_max;
 } DECRYPTOR_LIST;
 
+/* per packet routing, derived from PID_MAP */
+typedef struct {
+	uint8_t            cls;   /* PID_CLASS */
+	uint8_t            reserved;
+	uint16_t           dec;   /* decryptor slot + 1 of an ES, 0 - none */
+} PID_ROUTE;
+
+/* per packet statistics, folded into PID_MAP by fold_pid_count() */
+typedef struct {
+	int32_t            normal_packet;
+	int32_t            undecrypted;
+} PID_COUNT;
+
+/* packets counted before a fold, far from where PID_COUNT wraps */
+#define PID_COUNT_FOLD (0x40000000)
+
+/* statistics here stop at the last fold_pid_count() */
 typedef struct {
 	uint32_t           ref;
 	uint32_t           type;
@@ -83,11 +148,124 @@ typedef struct {
 	void              *target;
 } PID_MAP;
 
+#define DECRYPT_BATCH_SIZE (64)
+
+#define SPARE_MULTI2_MAX     (8)
+#define SPARE_PMT_MAX       (16)
+#define SPARE_DECRYPTOR_MAX  (8)
+#define SPARE_STREAM_COUNT (128)
+#define SPARE_PROGRAM_COUNT (32)
+#define SPARE_SECTION_COUNT  (2)
+
+typedef struct {
+	MULTI2            *m2;
+	int32_t            count;
+	int32_t            type[DECRYPT_BATCH_SIZE];
+	uint8_t           *src[DECRYPT_BATCH_SIZE];
+	uint8_t           *dst[DECRYPT_BATCH_SIZE];
+	intptr_t           size[DECRYPT_BATCH_SIZE];
+} DECRYPT_BATCH;
+
+/**
+ low latency start: clear packets forwarded while PAT/PMT/ECM are searched.
+ the forwarded packets of a PID are always its first ones in sbuf, so a
+ count per PID tells proc_arib_std_b25() which ones not to output again.
+ allocated only while the search runs, freed once it goes idle
+ */
+typedef struct {
+	intptr_t           offset;          /* sbuf bytes walked from head, 0 - inactive */
+	uint32_t           count[0x2000];   /* leading packets forwarded */
+	uint32_t           seen[0x2000];    /* of them, passed in the current proc call */
+	uint8_t            held[0x2000/8];  /* PIDs with a packet held back */
+	uint8_t            listed[0x2000/8];
+	int32_t            touched_count;
+	uint16_t           touched[0x2000]; /* PIDs with a count or held, walked instead of all */
+} LEAD_STATE;
+
+/* pid values of next_lead_packet() other than PIDs */
+#define LEAD_SKIP (-1) /* bit error or stripped, never forwarded */
+#define LEAD_JUNK (-2) /* bytes before a resync point, output as they are */
+
+/* scrambled packet kept in dbuf until the ECM it waits for is applied */
+typedef struct {
+	DECRYPTOR_ELEM    *dec;      /* NULL - settled */
+	uint32_t           need;     /* dec->posted when held */
+	int32_t            type;     /* transport_scrambling_control */
+	int32_t            pid;
+	intptr_t           offset;   /* packet head from dbuf.head */
+	intptr_t           payload;  /* payload from the packet head */
+	intptr_t           size;
+} KEY_WAIT_ENTRY;
+
+/**
+ asynchronous ECM: the card runs in ECM_WORKER while packets go on.
+ dbuf is handed out by get() only up to the first held packet, so the
+ output order is kept while the held ones wait for their key
+ */
+typedef struct {
+	int32_t            max;    /* see set_async_ecm(), 0 - ECM in place */
+	int32_t            count;
+	KEY_WAIT_ENTRY    *entry;
+	uint32_t           tag;    /* last tag given to a decryptor */
+	ECM_WORKER        *worker;
+} KEY_WAIT;
+
+/* undecrypted packet kept in the delay line until its key is applied */
+typedef struct {
+	DECRYPTOR_ELEM    *dec;
+	int32_t            type;     /* transport_scrambling_control */
+	int32_t            pid;
+	intptr_t           offset;   /* packet head from dbuf.head */
+	intptr_t           payload;  /* payload from the packet head */
+	intptr_t           size;
+} DELAY_ENTRY;
+
+/* output of put() calls, released by age */
+typedef struct {
+	intptr_t           offset;   /* output tail from dbuf.head */
+	uint32_t           start;    /* msec clock of the first call merged */
+	uint32_t           time;     /* msec clock of the last call merged */
+} DELAY_MARK;
+
+#define DELAY_MARK_MAX (64)
+
+/**
+ delay line: get() keeps the tail of dbuf back for a while, so a key
+ that lands late still reaches the packets that went out undecrypted
+ */
+typedef struct {
+	int32_t            length;  /* see set_delay_line(), 0 - off */
+	int32_t            unit;    /* ARIB_STD_B25_DELAY_LINE_* */
+	int32_t            drain;   /* flush() called, the whole line goes */
+	int32_t            count;
+	int32_t            max;
+	DELAY_ENTRY       *entry;
+	int32_t            mark_count;
+	DELAY_MARK         mark[DELAY_MARK_MAX];
+} DELAY_LINE;
+
+/* released objects kept for reuse, see set_preallocation() */
+typedef struct {
+	int32_t            bitrate;  /* 0 - only one MULTI2 is kept */
+
+	MULTI2            *m2[SPARE_MULTI2_MAX];  /* keep their key schedule cache */
+	int32_t            m2_count;
+
+	TS_SECTION_PARSER *pmt[SPARE_PMT_MAX];
+	int32_t            pmt_count;
+
+	DECRYPTOR_LIST     decrypt;  /* ecm parsers kept */
+} SPARE_POOL;
+
 typedef struct {
 
 	int32_t            multi2_round;
 	int32_t            strip;
 	int32_t            emm_proc_on;
+	int32_t            zero_copy;
+	int32_t            low_latency;
+	int32_t            custom_mem;  /* allocator given to create_arib_std_b25_ex() */
+	intptr_t           memory_limit;  /* bytes held in sbuf and dbuf, 0 - none */
 
 	int32_t            unit_size;
 
@@ -99,10 +277,15 @@ typedef struct {
 	TS_STREAM_LIST     strm_pool;
 
 	int32_t            p_count;
+	int32_t            p_max;
 	TS_PROGRAM        *program;
 
 	DECRYPTOR_LIST     decrypt;
+	SPARE_POOL         spare;
 
+	PID_ROUTE          route[0x2000];
+	PID_COUNT          count[0x2000];
+	int32_t            count_run;  /* packets counted since the last fold */
 	PID_MAP            map[0x2000];
 
 	B_CAS_CARD        *bcas;
@@ -114,6 +297,17 @@ typedef struct {
 
 	TS_WORK_BUFFER     sbuf;
 	TS_WORK_BUFFER     dbuf;
+	TS_WORK_BUFFER     zbuf;  /* zero copy output left in the caller's buffer */
+
+	DECRYPT_BATCH      batch;
+
+	LEAD_STATE        *lead;  /* NULL - no low latency start running */
+
+	KEY_WAIT           wait;
+
+	DELAY_LINE         delay;
+
+	MEMORY_ALLOCATOR   mem;
 
 } ARIB_STD_B25_PRIVATE_DATA;
 
@@ -308,6 +502,30 @@ enum PID_MAP_TYPE {
 	PID_MAP_TYPE_OTHER                          = 0xff00,
 };
 
+enum TS_WORK_BUFFER_KIND {
+	TS_WORK_BUFFER_FLAT                         = 0,
+	TS_WORK_BUFFER_RING                         = 1, /* mirror not mapped yet */
+	TS_WORK_BUFFER_MIRROR                       = 2, /* pool is mapped twice back to back */
+};
+
+#define TS_MIRROR_UNIT (64*1024)
+#define TS_HUGE_PAGE_UNIT (2*1024*1024)
+#define TS_WORK_BUFFER_ALIGN (64)
+#define TS_MEMORY_LIMIT_MIN (1024*1024)
+
+/* packet routing in proc/flush, section classes must come last */
+enum PID_CLASS {
+	PID_CLASS_DEFAULT                           = 0x00,
+	PID_CLASS_ES                                = 0x01,
+	PID_CLASS_PASS                              = 0x02,
+	PID_CLASS_DROP                              = 0x03,
+	PID_CLASS_ECM                               = 0x04,
+	PID_CLASS_PMT                               = 0x05,
+	PID_CLASS_EMM                               = 0x06,
+	PID_CLASS_CAT                               = 0x07,
+	PID_CLASS_PAT                               = 0x08,
+};
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function prottypes (interface method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -324,26 +542,58 @@ static int get_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf);
 static int get_program_count_arib_std_b25(void *std_b25);
 static int get_program_info_arib_std_b25(void *std_b25, ARIB_STD_B25_PROGRAM_INFO *info, int32_t idx);
 static int withdraw_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf);
+static int set_zero_copy_arib_std_b25(void *std_b25, int32_t on);
+static int set_preallocation_arib_std_b25(void *std_b25, int32_t bitrate);
+static int set_work_buffer_option_arib_std_b25(void *std_b25, int32_t option);
+static int set_memory_limit_arib_std_b25(void *std_b25, int32_t size);
+static int set_low_latency_arib_std_b25(void *std_b25, int32_t on);
+static int set_async_ecm_arib_std_b25(void *std_b25, int32_t depth);
+static int set_delay_line_arib_std_b25(void *std_b25, int32_t length, int32_t unit);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 ARIB_STD_B25 *create_arib_std_b25(void)
+{
+	return create_arib_std_b25_ex(NULL);
+}
+
+ARIB_STD_B25 *create_arib_std_b25_ex(const ARIB_STD_B25_ALLOCATOR *mem)
 {
 	int n;
 
 	ARIB_STD_B25 *r;
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
+	MEMORY_ALLOCATOR m;
+
+	if(init_memory_allocator(&m, mem) != 0){
+		return NULL;
+	}
+
 	n  = sizeof(ARIB_STD_B25_PRIVATE_DATA);
 	n += sizeof(ARIB_STD_B25);
 
-	prv = (ARIB_STD_B25_PRIVATE_DATA *)calloc(1, n);
+	prv = (ARIB_STD_B25_PRIVATE_DATA *)mem_calloc(&m, 1, n);
 	if(prv == NULL){
 		return NULL;
 	}
 
+	prv->mem = m;
+	prv->sbuf.mem = &(prv->mem);
+	prv->dbuf.mem = &(prv->mem);
+	prv->zbuf.mem = &(prv->mem);
+
 	prv->multi2_round = 4;
+	if(mem == NULL){
+		prv->sbuf.kind = TS_WORK_BUFFER_RING;
+	}else{
+		/* the mirror is mapped by the OS, keep every buffer with the caller */
+		prv->sbuf.kind = TS_WORK_BUFFER_FLAT;
+		prv->custom_mem = 1;
+	}
+	prv->route[0x0000].cls = PID_CLASS_PAT;
+	prv->route[0x0001].cls = PID_CLASS_CAT;
 
 	r = (ARIB_STD_B25 *)(prv+1);
 	r->private_data = prv;
@@ -361,6 +611,13 @@ ARIB_STD_B25 *create_arib_std_b25(void)
 	r->get_program_count = get_program_count_arib_std_b25;
 	r->get_program_info = get_program_info_arib_std_b25;
 	r->withdraw = withdraw_arib_std_b25;
+	r->set_zero_copy = set_zero_copy_arib_std_b25;
+	r->set_preallocation = set_preallocation_arib_std_b25;
+	r->set_work_buffer_option = set_work_buffer_option_arib_std_b25;
+	r->set_memory_limit = set_memory_limit_arib_std_b25;
+	r->set_low_latency = set_low_latency_arib_std_b25;
+	r->set_async_ecm = set_async_ecm_arib_std_b25;
+	r->set_delay_line = set_delay_line_arib_std_b25;
 
 	return r;
 }
@@ -379,46 +636,122 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm);
 static int32_t find_ca_descriptor_pid(uint8_t *head, uint8_t *tail, int32_t ca_system_id);
 static int32_t add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *list, int32_t ecm_pid);
 static int check_ecm_complete(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int check_wait_exceeded(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t max);
 static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv);
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round);
+static int proc_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t defer);
 static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int put_input(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, intptr_t slen, intptr_t dlen);
+static int proc_in_place(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, intptr_t slen, intptr_t dlen);
+static uint8_t *find_in_place_start(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *head, uint8_t *tail, intptr_t slen);
+static int check_in_place_packet(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr);
+static void rollback_input(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t slen, intptr_t dlen);
+static void restore_input(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *keep, intptr_t slen, intptr_t dlen);
+static int settle_zero_copy(ARIB_STD_B25_PRIVATE_DATA *prv);
+
+static int forward_clear_packets(ARIB_STD_B25_PRIVATE_DATA *prv);
+static uint8_t *next_lead_packet(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr, uint8_t *tail, int32_t *pid);
+static void drop_lead(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *head);
+static void commit_lead(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr);
+static void strip_lead(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void reset_lead(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void touch_lead(LEAD_STATE *lead, int32_t pid);
+
+static int queue_decrypt(ARIB_STD_B25_PRIVATE_DATA *prv, MULTI2 *m2, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size);
+static int flush_decrypt(ARIB_STD_B25_PRIVATE_DATA *prv);
+
+static int transmit_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, B_CAS_ECM_RESULT *dst, uint8_t *src, uint32_t len);
+static int transmit_emm(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *src, int32_t len);
+static int apply_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t result, B_CAS_ECM_RESULT *res);
+static int post_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, uint8_t *src, uint32_t len);
+static int drain_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t block);
+static int stop_ecm_worker(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int need_key_wait(DECRYPTOR_ELEM *dec, int32_t crypt);
+static int hold_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t type, int32_t pid, uint8_t *curr, intptr_t payload, intptr_t size);
+static int settle_key_wait(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t drop);
+static void rollback_key_wait(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t dlen);
+
+static int check_late_key(DECRYPTOR_ELEM *dec, int32_t crypt);
+static void note_key_run(DECRYPTOR_ELEM *dec, int32_t type);
+static int is_stale_key(DECRYPTOR_ELEM *dec, int32_t type);
+static int keep_delay_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t type, int32_t pid, intptr_t offset, intptr_t payload, intptr_t size);
+static void open_delay_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DELAY_ENTRY *e);
+static void settle_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
+static void drop_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
+static intptr_t release_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t size);
+static void mark_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void rollback_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t dlen);
 
 static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv);
 static int proc_emm(ARIB_STD_B25_PRIVATE_DATA *prv);
 
 static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm);
 
+static int preallocate(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void release_spare(ARIB_STD_B25_PRIVATE_DATA *prv);
+static TS_SECTION_PARSER *take_pmt_parser(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void drop_pmt_parser(ARIB_STD_B25_PRIVATE_DATA *prv, TS_SECTION_PARSER *pmt);
+static DECRYPTOR_ELEM *take_spare_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int keep_spare_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
+static TS_SECTION_PARSER *create_reserved_parser(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t count);
+
+static void set_pid_type(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, int32_t type);
+static void set_pid_target(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, void *target);
+static void update_pid_route(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+static void reset_pid_route(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void fold_pid_count(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void reset_pid_count(ARIB_STD_B25_PRIVATE_DATA *prv);
+
 static void unref_stream(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
 
 static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
 static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
+static int claim_decryptor_slot(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_LIST *list, DECRYPTOR_ELEM *dec);
+static void release_decryptor_multi2(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
 static DECRYPTOR_ELEM *select_active_decryptor(DECRYPTOR_ELEM *a, DECRYPTOR_ELEM *b, int32_t pid);
 static void bind_stream_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, DECRYPTOR_ELEM *dec);
 static void unlock_all_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv);
 
 static TS_STREAM_ELEM *get_stream_list_head(TS_STREAM_LIST *list);
 static TS_STREAM_ELEM *find_stream_list_elem(TS_STREAM_LIST *list, int32_t pid);
-static TS_STREAM_ELEM *create_stream_elem(int32_t pid, int32_t type);
+static TS_STREAM_ELEM *create_stream_elem(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, int32_t type);
 static void put_stream_list_tail(TS_STREAM_LIST *list, TS_STREAM_ELEM *elem);
-static void clear_stream_list(TS_STREAM_LIST *list);
+static void clear_stream_list(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *list);
 
 static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size);
 static int append_work_buffer(TS_WORK_BUFFER *buf, uint8_t *data, int32_t size);
+static uint8_t *extend_work_buffer(TS_WORK_BUFFER *buf, int32_t size);
+static void consume_work_buffer(TS_WORK_BUFFER *buf, uint8_t *curr);
 static void reset_work_buffer(TS_WORK_BUFFER *buf);
 static void release_work_buffer(TS_WORK_BUFFER *buf);
 
+static void free_work_pool(TS_WORK_BUFFER *buf);
+
+static uint8_t *map_mirror(intptr_t size, int32_t huge);
+static void unmap_mirror(uint8_t *p, intptr_t size);
+static uint8_t *map_huge(intptr_t size);
+static void unmap_huge(uint8_t *p, intptr_t size);
+#if defined(__linux__)
+static uint8_t *reserve_aligned(intptr_t size, intptr_t align);
+#endif
+
 static void extract_ts_header(TS_HEADER *dst, uint8_t *src);
 static void extract_emm_fixed_part(EMM_FIXED_PART *dst, uint8_t *src);
 
+static uint32_t sync_mask32(uint8_t *p);
+static int first_bit32(uint32_t v);
+
 static uint8_t *resync(uint8_t *head, uint8_t *tail, int32_t unit);
 static uint8_t *resync_force(uint8_t *head, uint8_t *tail, int32_t unit);
 
+static uint32_t get_msec_clock(void);
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  interface method implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static void release_arib_std_b25(void *std_b25)
 {
 	ARIB_STD_B25_PRIVATE_DATA *prv;
+	MEMORY_ALLOCATOR mem;
 
 	prv = private_data(std_b25);
 	if(prv == NULL){
@@ -426,7 +759,23 @@ static void release_arib_std_b25(void *std_b25)
 	}
 
 	teardown(prv);
-	free(prv);
+
+	/* queued ECMs are dropped, the running one is waited for */
+	if(prv->wait.worker != NULL){
+		prv->wait.worker->release(prv->wait.worker);
+		prv->wait.worker = NULL;
+	}
+	if(prv->wait.entry != NULL){
+		mem_free(&(prv->mem), prv->wait.entry);
+		prv->wait.entry = NULL;
+	}
+	if(prv->delay.entry != NULL){
+		mem_free(&(prv->mem), prv->delay.entry);
+		prv->delay.entry = NULL;
+	}
+
+	mem = prv->mem;
+	mem_free(&mem, prv);
 }
 
 static int set_multi2_round_arib_std_b25(void *std_b25, int32_t round)
@@ -453,6 +802,7 @@ static int set_strip_arib_std_b25(void *std_b25, int32_t strip)
 	}
 
 	prv->strip = strip;
+	update_pid_route(prv, 0x1fff);
 
 	return 0;
 }
@@ -482,6 +832,12 @@ static int set_b_cas_card_arib_std_b25(void *std_b25, B_CAS_CARD *bcas)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	/* the worker transmits to the old card, finish with it first */
+	n = stop_ecm_worker(prv);
+	if(n < 0){
+		return n;
+	}
+
 	prv->bcas = bcas;
 	if(prv->bcas != NULL){
 		n = prv->bcas->get_init_status(bcas, &is);
@@ -509,6 +865,10 @@ static int reset_arib_std_b25(void *std_b25)
 
 	teardown(prv);
 
+	if(prv->spare.bitrate > 0){
+		return preallocate(prv);
+	}
+
 	return 0;
 }
 
@@ -520,14 +880,18 @@ static int flush_arib_std_b25(void *std_b25)
 	int32_t crypt;
 	int32_t unit;
 	int32_t pid;
+	int32_t cls;
 
 	uint8_t *p;
+	uint8_t *dst;
 	uint8_t *curr;
 	uint8_t *tail;
 
 	TS_HEADER hdr;
+	PID_ROUTE *rt;
 	DECRYPTOR_ELEM *dec;
 	TS_PROGRAM *pgrm;
+	MULTI2 *m2;
 
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
@@ -536,6 +900,13 @@ static int flush_arib_std_b25(void *std_b25)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	if(!settle_zero_copy(prv)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	/* get() hands out the delay line too until the next put() */
+	prv->delay.drain = 1;
+
 	if(prv->unit_size < 188){
 		r = select_unit_size(prv);
 		if(r < 0){
@@ -546,7 +917,21 @@ static int flush_arib_std_b25(void *std_b25)
 		}
 	}
 
-	r = proc_arib_std_b25(prv);
+	do{
+		/* replay whatever the low latency start already walked */
+		m = 0;
+		if(prv->lead != NULL){
+			m = prv->lead->offset;
+		}
+		r = proc_arib_std_b25(prv);
+		if(r < 0){
+			return r;
+		}
+	}while( (prv->lead != NULL) && (prv->lead->offset > 0) && (prv->lead->offset < m) );
+	strip_lead(prv);
+
+	/* every held packet gets its key before the tail is handled in place */
+	r = drain_ecm(prv, 1);
 	if(r < 0){
 		return r;
 	}
@@ -555,12 +940,17 @@ static int flush_arib_std_b25(void *std_b25)
 	curr = prv->sbuf.head;
 	tail = prv->sbuf.tail;
 
-	m = prv->dbuf.tail - prv->dbuf.head;
+	/* held packets may keep dbuf.head off the pool, appends count from pool */
+	m = prv->dbuf.tail - prv->dbuf.pool;
 	n = tail - curr;
 	if(!reserve_work_buffer(&(prv->dbuf), m+n)){
 		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
 
+	/* drop entries left behind by a rolled back call */
+	prv->batch.m2 = NULL;
+	prv->batch.count = 0;
+
 	r = 0;
 
 	while( (curr+188) <= tail ){
@@ -596,7 +986,9 @@ static int flush_arib_std_b25(void *std_b25)
 			goto NEXT;
 		}
 
-		if( (pid == 0x1fff) && (prv->strip) ){
+		rt = prv->route + pid;
+		cls = rt->cls;
+		if(cls == PID_CLASS_DROP){
 			goto NEXT;
 		}
 
@@ -613,11 +1005,15 @@ static int flush_arib_std_b25(void *std_b25)
 			n = 188 - 4;
 		}
 
+		m2 = NULL;
 		if(crypt != 0){
 			if(hdr.adaptation_field_control & 0x01){
 
-				if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
-					dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+				if(cls == PID_CLASS_ES){
+					dec = NULL;
+					if(rt->dec != 0){
+						dec = prv->decrypt.slot[rt->dec-1];
+					}
 				}else if( (prv->map[pid].type == 0) &&
 						  (prv->decrypt.count == 1) ){
 					dec = prv->decrypt.head;
@@ -626,40 +1022,63 @@ static int flush_arib_std_b25(void *std_b25)
 				}
 
 				if( (dec != NULL) && (dec->m2 != NULL) ){
-					m = dec->m2->decrypt(dec->m2, crypt, p, n);
-					if(m < 0){
-						r = ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
-						if((curr+unit) <= tail)
-							l = unit;
-						else
-							l = 188;
-						curr += l;
-						goto LAST;
-					}
-					curr[3] &= 0x3f;
-					prv->map[pid].normal_packet += 1;
+					m2 = dec->m2;
+					prv->count[pid].normal_packet += 1;
 				}else{
-					prv->map[pid].undecrypted += 1;
+					prv->count[pid].undecrypted += 1;
 				}
 
 			}else{
 				curr[3] &= 0x3f;
-				prv->map[pid].normal_packet += 1;
+				prv->count[pid].normal_packet += 1;
 			}
 		}else{
-			prv->map[pid].normal_packet += 1;
+			prv->count[pid].normal_packet += 1;
 		}
 
 		if((curr+unit) <= tail)
 			l = unit;
 		else
 			l = 188;
-		if(!append_work_buffer(&(prv->dbuf), curr, l)){
-			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		if(m2 != NULL){
+			/* the payload is decrypted straight from sbuf into dbuf */
+			dst = extend_work_buffer(&(prv->dbuf), l);
+			if(dst == NULL){
+				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				goto LAST;
+			}
+			memcpy(dst, curr, p-curr);
+			if(l > 188){
+				memcpy(dst+188, curr+188, l-188);
+			}
+			dst[3] &= 0x3f;
+			r = queue_decrypt(prv, m2, crypt, p, dst+(p-curr), n);
+			if(r < 0){
+				curr += l;
+				goto LAST;
+			}
+			p = dst + (p - curr);
+		}else{
+			if(!append_work_buffer(&(prv->dbuf), curr, l)){
+				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				goto LAST;
+			}
+		}
+
+		if(cls < PID_CLASS_ECM){
+			/* elementary stream or passthrough */
+			goto NEXT;
+		}
+
+		/* sections may update the keys or release the decryptor */
+		r = flush_decrypt(prv);
+		if(r < 0){
+			curr += l;
 			goto LAST;
 		}
 
-		if(prv->map[pid].type == PID_MAP_TYPE_ECM){
+		switch(cls){
+		case PID_CLASS_ECM:
 			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
 			if( (dec == NULL) || (dec->ecm == NULL) ){
 				/* this code will never execute */
@@ -694,7 +1113,7 @@ static int flush_arib_std_b25(void *std_b25)
 			if(m == 0){
 				goto NEXT;
 			}
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+			r = proc_ecm(prv, dec, 0);
 			if(r < 0){
 				if((curr+unit) <= tail)
 					l = unit;
@@ -703,7 +1122,8 @@ static int flush_arib_std_b25(void *std_b25)
 				curr += l;
 				goto LAST;
 			}
-		}else if(prv->map[pid].type == PID_MAP_TYPE_PMT){
+			break;
+		case PID_CLASS_PMT:
 			pgrm = (TS_PROGRAM *)(prv->map[pid].target);
 			if( (pgrm == NULL) || (pgrm->pmt == NULL) ){
 				/* this code will never execute */
@@ -747,12 +1167,13 @@ static int flush_arib_std_b25(void *std_b25)
 				curr += l;
 				goto LAST;
 			}
-		}else if(prv->map[pid].type == PID_MAP_TYPE_EMM){
+			break;
+		case PID_CLASS_EMM:
 			if( prv->emm_proc_on == 0){
 				goto NEXT;
 			}
 			if( prv->emm == NULL ){
-				prv->emm = create_ts_section_parser();
+				prv->emm = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->emm == NULL){
 					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 					goto LAST;
@@ -790,9 +1211,10 @@ static int flush_arib_std_b25(void *std_b25)
 				curr += l;
 				goto LAST;
 			}
-		}else if(pid == 0x0001){
+			break;
+		case PID_CLASS_CAT:
 			if( prv->cat == NULL ){
-				prv->cat = create_ts_section_parser();
+				prv->cat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->cat == NULL){
 					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 					goto LAST;
@@ -830,9 +1252,10 @@ static int flush_arib_std_b25(void *std_b25)
 				curr += l;
 				goto LAST;
 			}
-		}else if(pid == 0x0000){
+			break;
+		case PID_CLASS_PAT:
 			if( prv->pat == NULL ){
-				prv->pat = create_ts_section_parser();
+				prv->pat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->pat == NULL){
 					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 					goto LAST;
@@ -870,6 +1293,7 @@ static int flush_arib_std_b25(void *std_b25)
 				curr += l;
 				goto LAST;
 			}
+			break;
 		}
 
 	NEXT:
@@ -877,18 +1301,13 @@ static int flush_arib_std_b25(void *std_b25)
 	}
 
 LAST:
-	m = curr - prv->sbuf.pool;
-	n = tail - curr;
-	if( (n < 1024) || (m > (prv->sbuf.max/2) ) ){
-		p = prv->sbuf.pool;
-		if(n > 0)
-			memcpy(p, curr, n);
-		prv->sbuf.head = p;
-		prv->sbuf.tail = p+n;
-	}else{
-		prv->sbuf.head = curr;
+	l = flush_decrypt(prv);
+	if( (l < 0) && (r >= 0) ){
+		r = l;
 	}
 
+	consume_work_buffer(&(prv->sbuf), curr);
+
 	return r;
 }
 
@@ -896,6 +1315,7 @@ static int put_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 {
 	int r;
 	intptr_t slen,dlen;
+	ARIB_STD_B25_BUFFER in;
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
 	prv = private_data(std_b25);
@@ -903,96 +1323,89 @@ static int put_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	slen = prv->sbuf.tail - prv->sbuf.head;
-	dlen = prv->dbuf.tail - prv->dbuf.head;
-
-	if(!append_work_buffer(&(prv->sbuf), buf->data, buf->size)){
+	if(!settle_zero_copy(prv)){
 		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
 
-	if(prv->unit_size < 188){
-		r = select_unit_size(prv);
-		if(r < 0){
-			return r;
-		}
-		if(prv->unit_size < 188){
-			/* need more data */
-			return 0;
-		}
+	if(prv->dbuf.head != prv->dbuf.pool){
+		/* get() left packets waiting for a key, the rest is handed out */
+		consume_work_buffer(&(prv->dbuf), prv->dbuf.head);
 	}
 
-	if(prv->p_count < 1){
-		r = find_pat(prv);
-		if(r < 0){
-			return r;
-		}
-		if(prv->p_count < 1){
-			if(prv->sbuf_offset < (16*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_PAT_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_PAT_IN_HEAD_16M;
-			}
-		}
-		prv->sbuf_offset = 0;
-	}
+	prv->delay.drain = 0;
 
-	if(!check_pmt_complete(prv)){
-		r = find_pmt(prv);
-		if(r < 0){
-			return r;
-		}
-		if(!check_pmt_complete(prv)){
-			if(prv->sbuf_offset < (32*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_PMT_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_PMT_IN_HEAD_32M;
-			}
-		}
-		prv->sbuf_offset = 0;
-	}
+	slen = prv->sbuf.tail - prv->sbuf.head;
+	dlen = prv->dbuf.tail - prv->dbuf.head;
 
-	if(!check_ecm_complete(prv)){
-		r = find_ecm(prv);
-		if(r < 0){
-			return r;
+	in = *buf;
+	if( (prv->memory_limit > 0) && ((slen + dlen + (intptr_t)in.size) > prv->memory_limit) ){
+		/* take what fits, the caller drains dbuf by get() and puts the rest */
+		in.size = 0;
+		if( (slen + dlen) < prv->memory_limit ){
+			in.size = (uint32_t)(prv->memory_limit - (slen + dlen));
 		}
-		if(!check_ecm_complete(prv)){
-			if(prv->sbuf_offset < (32*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_ECM_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_ECM_IN_HEAD_32M;
-			}
+		if(in.size == 0){
+			buf->size = 0;
+			return ARIB_STD_B25_WARN_EXCEED_MEMORY_LIMIT;
 		}
-		prv->sbuf_offset = 0;
 	}
 
-	r = proc_arib_std_b25(prv);
-	if(r < 0){
-		/* rollback */
-		prv->sbuf.tail = prv->sbuf.head + slen;
-		prv->dbuf.tail = prv->dbuf.head + dlen;
+	r = put_input(prv, &in, slen, dlen);
+	mark_delay_line(prv);
+	if( (r >= 0) && (in.size < buf->size) ){
+		buf->size = in.size;
+		r = ARIB_STD_B25_WARN_EXCEED_MEMORY_LIMIT;
 	}
+
 	return r;
 }
 
+
 static int get_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 {
+	int r;
+	int32_t i;
+	intptr_t n;
+
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 	prv = private_data(std_b25);
 	if( (prv == NULL) || (buf == NULL) ){
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	if( (prv->dbuf.tail == prv->dbuf.head) && (prv->zbuf.tail != prv->zbuf.head) ){
+		/* zero copy - everything in dbuf precedes the caller's buffer */
+		buf->data = prv->zbuf.head;
+		buf->size = (uint32_t)(prv->zbuf.tail - prv->zbuf.head);	// cast
+		prv->zbuf.head = NULL;
+		prv->zbuf.tail = NULL;
+		return 0;
+	}
+
+	r = drain_ecm(prv, 0);
+	if(r < 0){
+		return r;
+	}
+
+	n = prv->dbuf.tail - prv->dbuf.head;
+	if(prv->wait.count > 0){
+		/* only up to the first packet still waiting for its key */
+		n = prv->wait.entry[0].offset;
+	}
+	n = release_delay_line(prv, n);
+
 	buf->data = prv->dbuf.head;
-	buf->size = (uint32_t)(prv->dbuf.tail - prv->dbuf.head);	// cast
+	buf->size = (uint32_t)n;	// cast
 
-	reset_work_buffer(&(prv->dbuf));
+	if(n == (prv->dbuf.tail - prv->dbuf.head)){
+		reset_work_buffer(&(prv->dbuf));
+		return 0;
+	}
+
+	prv->dbuf.head += n;
+	for(i=0;i<prv->wait.count;i++){
+		prv->wait.entry[i].offset -= n;
+	}
 
 	return 0;
 }
@@ -1027,6 +1440,8 @@ static int get_program_info_arib_std_b25(void *std_b25, ARIB_STD_B25_PROGRAM_INF
 
 	pgrm = prv->program + idx;
 
+	fold_pid_count(prv);
+
 	memset(info, 0, sizeof(ARIB_STD_B25_PROGRAM_INFO));
 
 	info->program_number = pgrm->program_number;
@@ -1068,6 +1483,9 @@ static int withdraw_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	/* packets forwarded by the low latency start are not handed back */
+	strip_lead(prv);
+
 	buf->data = prv->sbuf.head;
 	buf->size = (uint32_t)(prv->sbuf.tail - prv->sbuf.head);	// cast
 
@@ -1076,68 +1494,260 @@ static int withdraw_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 	return 0;
 }
 
-/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
- private method implementation
- ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-static ARIB_STD_B25_PRIVATE_DATA *private_data(void *std_b25)
+static int set_zero_copy_arib_std_b25(void *std_b25, int32_t on)
 {
-	ARIB_STD_B25 *p;
-	ARIB_STD_B25_PRIVATE_DATA *r;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	p = (ARIB_STD_B25 *)std_b25;
-	if(p == NULL){
-		return NULL;
+	prv = private_data(std_b25);
+	if(prv == NULL){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	r = (ARIB_STD_B25_PRIVATE_DATA *)p->private_data;
-	if( ((void *)(r+1)) != ((void *)p) ){
-		return NULL;
+	if(!settle_zero_copy(prv)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
 
-	return r;
+	prv->zero_copy = on;
+
+	return 0;
 }
 
-static void teardown(ARIB_STD_B25_PRIVATE_DATA *prv)
+static int set_preallocation_arib_std_b25(void *std_b25, int32_t bitrate)
 {
-	int i;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	prv->unit_size = 0;
-	prv->sbuf_offset = 0;
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (bitrate < 0) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
 
-	if(prv->pat != NULL){
-		prv->pat->release(prv->pat);
-		prv->pat = NULL;
+	prv->spare.bitrate = bitrate;
+	if(bitrate == 0){
+		release_spare(prv);
+		return 0;
 	}
-	if(prv->cat != NULL){
-		prv->cat->release(prv->cat);
-		prv->cat = NULL;
+
+	return preallocate(prv);
+}
+
+static int set_work_buffer_option_arib_std_b25(void *std_b25, int32_t option)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || ((option & ~(ARIB_STD_B25_WORK_BUFFER_ALIGNED|ARIB_STD_B25_WORK_BUFFER_HUGE_PAGE)) != 0) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	if(prv->program != NULL){
-		for(i=0;i<prv->p_count;i++){
-			release_program(prv, prv->program+i);
+	if(option & ARIB_STD_B25_WORK_BUFFER_HUGE_PAGE){
+		option |= ARIB_STD_B25_WORK_BUFFER_ALIGNED;
+		if(prv->custom_mem){
+			/* pages belong to the caller's allocator */
+			option &= ~ARIB_STD_B25_WORK_BUFFER_HUGE_PAGE;
 		}
-		free(prv->program);
-		prv->program = NULL;
 	}
-	prv->p_count = 0;
 
-	clear_stream_list(&(prv->strm_pool));
+	/* applied from the next allocation, reset() releases both buffers */
+	prv->sbuf.option = option;
+	prv->dbuf.option = option;
 
-	while(prv->decrypt.head != NULL){
-		remove_decryptor(prv, prv->decrypt.head);
-	}
+	return 0;
+}
 
-	memset(prv->map, 0, sizeof(prv->map));
+static int set_memory_limit_arib_std_b25(void *std_b25, int32_t size)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	prv->emm_pid = 0;
-	if(prv->emm != NULL){
-		prv->emm->release(prv->emm);
-		prv->emm = NULL;
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (size < 0) || ((size > 0) && (size < TS_MEMORY_LIMIT_MIN)) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	prv->memory_limit = size;
+	prv->sbuf.limit = size;
+	prv->dbuf.limit = size;
+
+	return 0;
+}
+
+static int set_low_latency_arib_std_b25(void *std_b25, int32_t on)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if(prv == NULL){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	if( on && (prv->lead == NULL) ){
+		prv->lead = (LEAD_STATE *)mem_calloc(&(prv->mem), 1, sizeof(LEAD_STATE));
+		if(prv->lead == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	/* packets already forwarded are still skipped after turning it off */
+	prv->low_latency = on;
+	if( (!on) && (prv->lead != NULL) && (prv->lead->offset == 0) ){
+		reset_lead(prv);
+	}
+
+	return 0;
+}
+
+static int set_async_ecm_arib_std_b25(void *std_b25, int32_t depth)
+{
+	int r;
+	KEY_WAIT_ENTRY *p;
+
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (depth < 0) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	/* whatever is held gets its key before the buffer is replaced */
+	r = stop_ecm_worker(prv);
+	if(r < 0){
+		return r;
+	}
+
+	if(depth == prv->wait.max){
+		return 0;
+	}
+
+	p = NULL;
+	if(depth > 0){
+		p = (KEY_WAIT_ENTRY *)mem_calloc(&(prv->mem), depth, sizeof(KEY_WAIT_ENTRY));
+		if(p == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	if(prv->wait.entry != NULL){
+		mem_free(&(prv->mem), prv->wait.entry);
+	}
+	prv->wait.entry = p;
+	prv->wait.max = depth;
+
+	return 0;
+}
+
+static int set_delay_line_arib_std_b25(void *std_b25, int32_t length, int32_t unit)
+{
+	DECRYPTOR_ELEM *dec;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (length < 0) ||
+	    ((unit != ARIB_STD_B25_DELAY_LINE_PACKETS) && (unit != ARIB_STD_B25_DELAY_LINE_MSEC)) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	if(!settle_zero_copy(prv)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	/* the output kept so far is released by the next get() if turned off */
+	if( (length == 0) || (unit != prv->delay.unit) ){
+		prv->delay.mark_count = 0;
+	}
+	if(length == 0){
+		dec = prv->decrypt.head;
+		while(dec != NULL){
+			drop_delay_line(prv, dec);
+			dec = (DECRYPTOR_ELEM *)(dec->next);
+		}
+	}
+
+	prv->delay.length = length;
+	prv->delay.unit = unit;
+
+	return 0;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ARIB_STD_B25_PRIVATE_DATA *private_data(void *std_b25)
+{
+	ARIB_STD_B25 *p;
+	ARIB_STD_B25_PRIVATE_DATA *r;
+
+	p = (ARIB_STD_B25 *)std_b25;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (ARIB_STD_B25_PRIVATE_DATA *)p->private_data;
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void teardown(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int i;
+
+	prv->unit_size = 0;
+	prv->sbuf_offset = 0;
+
+	reset_lead(prv);
+
+	if(prv->pat != NULL){
+		prv->pat->release(prv->pat);
+		prv->pat = NULL;
+	}
+	if(prv->cat != NULL){
+		prv->cat->release(prv->cat);
+		prv->cat = NULL;
+	}
+
+	if(prv->program != NULL){
+		for(i=0;i<prv->p_count;i++){
+			release_program(prv, prv->program+i);
+		}
+		mem_free(&(prv->mem), prv->program);
+		prv->program = NULL;
+	}
+	prv->p_count = 0;
+	prv->p_max = 0;
+
+	clear_stream_list(prv, &(prv->strm_pool));
+
+	while(prv->decrypt.head != NULL){
+		remove_decryptor(prv, prv->decrypt.head);
+	}
+	if(prv->decrypt.slot != NULL){
+		mem_free(&(prv->mem), prv->decrypt.slot);
+		prv->decrypt.slot = NULL;
+	}
+	prv->decrypt.slot_max = 0;
+
+	release_spare(prv);
+
+	memset(prv->map, 0, sizeof(prv->map));
+	reset_pid_route(prv);
+	reset_pid_count(prv);
+
+	prv->emm_pid = 0;
+	if(prv->emm != NULL){
+		prv->emm->release(prv->emm);
+		prv->emm = NULL;
 	}
 
 	release_work_buffer(&(prv->sbuf));
 	release_work_buffer(&(prv->dbuf));
+
+	prv->delay.count = 0;
+	prv->delay.mark_count = 0;
+	prv->delay.drain = 0;
+
+	prv->zbuf.head = NULL;
+	prv->zbuf.tail = NULL;
 }
 
 static int set_unit_size_arib_std_b25(void *std_b25, int size)
@@ -1159,10 +1769,12 @@ static int select_unit_size(ARIB_STD_B25_PRIVATE_DATA *prv)
 	int i;
 	intptr_t m,w;
 	int n;
+	int a,c,len;
+	uint32_t v,u;
 	int count[320-188];
+	uint32_t sync[(188*32)/32];
 
 	unsigned char *head;
-	unsigned char *buf;
 	unsigned char *tail;
 
 	head = prv->sbuf.head;
@@ -1176,27 +1788,51 @@ static int select_unit_size(ARIB_STD_B25_PRIVATE_DATA *prv)
 		tail = head + (188*32);
 	}
 
-	buf = head;
+	len = (int)(tail-head);
 	memset(count, 0, sizeof(count));
+	memset(sync, 0, sizeof(sync));
 
-	// 1st step, count up 0x47 interval
-	while( (buf+188) < tail ){
-		if(buf[0] != 0x47){
-			buf += 1;
-			continue;
-		}
-		m = 320;
-		if( buf+m > tail ){
-			m = tail-buf;
+	// 0th step, bitmap of 0x47 positions
+	for(i=0;(i+32)<=len;i+=32){
+		sync[i>>5] = sync_mask32(head+i);
+	}
+	for(;i<len;i++){
+		if(head[i] == 0x47){
+			sync[i>>5] |= ((uint32_t)1 << (i&31));
 		}
-		for(i=188;i<m;i++){
-			if(buf[i] == 0x47){
-				count[i-188] += 1;
+	}
+
+	// 1st step, count up 0x47 interval
+	for(i=0;(i*32)<len;i++){
+		v = sync[i];
+		while(v != 0){
+			a = i*32 + first_bit32(v);
+			v &= (v-1);
+			if( (a+188) >= len ){
+				goto STEP2;
+			}
+			m = a+320;
+			if( m > len ){
+				m = len;
+			}
+			c = a+188;
+			while(c < m){
+				u = sync[c>>5] >> (c&31);
+				if(u == 0){
+					c = (c|31)+1;
+					continue;
+				}
+				c += first_bit32(u);
+				if(c >= m){
+					break;
+				}
+				count[c-a-188] += 1;
+				c += 1;
 			}
 		}
-		buf += 1;
 	}
 
+STEP2:
 	// 2nd step, select maximum appeared interval
 	m = 0;
 	n = 0;
@@ -1261,7 +1897,7 @@ static int find_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 				size = 188 - 4;
 			}
 			if(prv->pat == NULL){
-				prv->pat = create_ts_section_parser();
+				prv->pat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->pat == NULL){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
@@ -1332,21 +1968,32 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 	len = (sect.tail - sect.data) - 4;
 
 	count = len / 4;
-	work = (TS_PROGRAM *)calloc(count, sizeof(TS_PROGRAM));
-	if(work == NULL){
-		r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
-		goto LAST;
+	if( (prv->program != NULL) && (count <= prv->p_max) ){
+		/* reuse the array, old programs are released below */
+		work = prv->program;
+	}else{
+		work = (TS_PROGRAM *)mem_calloc(&(prv->mem), count, sizeof(TS_PROGRAM));
+		if(work == NULL){
+			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			goto LAST;
+		}
+		prv->p_max = (int32_t)count;
 	}
 
 	if(prv->program != NULL){
 		for(i=0;i<prv->p_count;i++){
 			release_program(prv, prv->program+i);
 		}
-		free(prv->program);
+		if(prv->program != work){
+			mem_free(&(prv->mem), prv->program);
+		}
 		prv->program = NULL;
 	}
 	prv->p_count = 0;
+	memset(work, 0, sizeof(TS_PROGRAM)*count);
 	memset(&(prv->map), 0, sizeof(prv->map));
+	reset_pid_route(prv);
+	reset_pid_count(prv);
 
 	head = sect.data;
 	tail = sect.tail-4;
@@ -1358,13 +2005,13 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if(program_number != 0){
 			work[i].program_number = program_number;
 			work[i].pmt_pid = pid;
-			work[i].pmt = create_ts_section_parser();
+			work[i].pmt = take_pmt_parser(prv);
 			if(work[i].pmt == NULL){
 				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				break;
 			}
-			prv->map[pid].type = PID_MAP_TYPE_PMT;
-			prv->map[pid].target = work+i;
+			set_pid_type(prv, pid, PID_MAP_TYPE_PMT);
+			set_pid_target(prv, pid, work+i);
 			i += 1;
 		}
 		head += 4;
@@ -1374,8 +2021,8 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 	prv->p_count = i;
 
 	prv->map[0x0000].ref = 1;
-	prv->map[0x0000].type = PID_MAP_TYPE_PAT;
-	prv->map[0x0000].target = NULL;
+	set_pid_type(prv, 0x0000, PID_MAP_TYPE_PAT);
+	set_pid_target(prv, 0x0000, NULL);
 
 LAST:
 	if(sect.raw != NULL){
@@ -1460,7 +2107,7 @@ static int find_pmt(ARIB_STD_B25_PRIVATE_DATA *prv)
 				size = 188 - 4;
 			}
 			if(prv->pat == NULL){
-				prv->pat = create_ts_section_parser();
+				prv->pat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->pat == NULL){
 					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 					goto LAST;
@@ -1482,6 +2129,7 @@ static int find_pmt(ARIB_STD_B25_PRIVATE_DATA *prv)
 				goto NEXT;
 			}
 			r = proc_pat(prv);
+			drop_lead(prv, curr);
 			prv->sbuf.head = curr;
 			curr += unit;
 			goto LAST;
@@ -1671,7 +2319,7 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 
 		strm = get_stream_list_head(&(prv->strm_pool));
 		if( strm == NULL ){
-			strm = create_stream_elem(pid, type);
+			strm = create_stream_elem(prv, pid, type);
 			if(strm == NULL){
 				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				goto LAST;
@@ -1681,7 +2329,7 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 			strm->type = type;
 		}
 
-		prv->map[pid].type = PID_MAP_TYPE_OTHER;
+		set_pid_type(prv, pid, PID_MAP_TYPE_OTHER);
 		prv->map[pid].ref += 1;
 
 		dw = select_active_decryptor(dec[0], dec[1], ecm_pid);
@@ -1748,7 +2396,7 @@ static int add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *list,
 
 	strm = get_stream_list_head(&(prv->strm_pool));
 	if(strm == NULL){
-		strm = create_stream_elem(ecm_pid, PID_MAP_TYPE_ECM);
+		strm = create_stream_elem(prv, ecm_pid, PID_MAP_TYPE_ECM);
 		if(strm == NULL){
 			return 0;
 		}
@@ -1793,6 +2441,21 @@ static int check_ecm_complete(ARIB_STD_B25_PRIVATE_DATA *prv)
 	return 1;
 }
 
+static int check_wait_exceeded(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t max)
+{
+	if(prv->sbuf_offset >= max){
+		return 1;
+	}
+
+	/* sbuf can not take one more packet within the memory limit */
+	if( (prv->memory_limit > 0) &&
+	    (((prv->sbuf.tail - prv->sbuf.head) + prv->unit_size) > prv->memory_limit) ){
+		return 1;
+	}
+
+	return 0;
+}
+
 static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 {
 	int r;
@@ -1835,7 +2498,7 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 				size = 188 - 4;
 			}
 			if(prv->pat == NULL){
-				prv->pat = create_ts_section_parser();
+				prv->pat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->pat == NULL){
 					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 					goto LAST;
@@ -1857,6 +2520,7 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 				goto NEXT;
 			}
 			r = proc_pat(prv);
+			drop_lead(prv, curr);
 			prv->sbuf.head = curr;
 			curr += unit;
 			goto LAST;
@@ -1906,7 +2570,7 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 				goto NEXT;
 			}
 
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+			r = proc_ecm(prv, dec, 0);
 			if(r < 0){
 				curr += unit;
 				goto LAST;
@@ -1938,14 +2602,13 @@ LAST:
 	return r;
 }
 
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
+static int proc_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t defer)
 {
 	int r,n;
 	uint32_t len;
 
 	uint8_t *p;
 
-	B_CAS_INIT_STATUS is;
 	B_CAS_ECM_RESULT res;
 
 	TS_SECTION sect;
@@ -1953,7 +2616,7 @@ static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
 	r = 0;
 	memset(&sect, 0, sizeof(sect));
 
-	if(bcas == NULL){
+	if(prv->bcas == NULL){
 		r = ARIB_STD_B25_ERROR_EMPTY_B_CAS_CARD;
 		goto LAST;
 	}
@@ -1979,55 +2642,84 @@ static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
 	len = (uint32_t)(sect.tail - sect.data) - 4;	// cast
 	p = sect.data;
 
-	r = bcas->proc_ecm(bcas, &res, p, len);
-	if(r < 0){
+	if( defer && (prv->wait.max > 0) ){
+		/* the packets go on, the result is applied by drain_ecm() */
+		r = post_ecm(prv, dec, p, len);
+		goto LAST;
+	}
+
+	r = transmit_ecm(prv, &res, p, len);
+	r = apply_ecm(prv, dec, r, &res);
+
+LAST:
+	if(sect.raw != NULL){
+		n = dec->ecm->ret(dec->ecm, &sect);
+		if( (n < 0) && (r == 0) ){
+			r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
+		}
+	}
+
+	return r;
+}
+
+static int apply_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t result, B_CAS_ECM_RESULT *res)
+{
+	int r;
+
+	B_CAS_INIT_STATUS is;
+
+	if(result < 0){
 		if(dec->m2 != NULL){
 			dec->m2->clear_scramble_key(dec->m2);
+			dec->keyless = 1;
 		}
-		r = ARIB_STD_B25_ERROR_ECM_PROC_FAILURE;
-		goto LAST;
+		return ARIB_STD_B25_ERROR_ECM_PROC_FAILURE;
 	}
 
-	if( (res.return_code != 0x0800) &&
-	    (res.return_code != 0x0400) &&
-	    (res.return_code != 0x0200) ){
+	if( (res->return_code != 0x0800) &&
+	    (res->return_code != 0x0400) &&
+	    (res->return_code != 0x0200) ){
 		/* return_code is not equal "purchased" */
-		if(dec->m2 != NULL){
-			dec->m2->release(dec->m2);
-			dec->m2 = NULL;
-		}
+		release_decryptor_multi2(prv, dec);
 		dec->unpurchased += 1;
-		dec->last_error = res.return_code;
+		dec->last_error = res->return_code;
 		dec->locked += 1;
-		r = ARIB_STD_B25_WARN_UNPURCHASED_ECM;
-		goto LAST;
+		return ARIB_STD_B25_WARN_UNPURCHASED_ECM;
 	}
 
 	if(dec->m2 == NULL){
-		dec->m2 = create_multi2();
-		if(dec->m2 == NULL){
-			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		if(prv->spare.m2_count > 0){
+			/* reuse a released instance, schedules of recent keys survive */
+			prv->spare.m2_count -= 1;
+			dec->m2 = prv->spare.m2[prv->spare.m2_count];
+			prv->spare.m2[prv->spare.m2_count] = NULL;
+		}else{
+			dec->m2 = create_multi2_ex(&(prv->mem));
+			if(dec->m2 == NULL){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
 		}
-		r = bcas->get_init_status(bcas, &is);
+		r = prv->bcas->get_init_status(prv->bcas, &is);
 		if(r < 0){
 			return ARIB_STD_B25_ERROR_INVALID_B_CAS_STATUS;
 		}
 		dec->m2->set_system_key(dec->m2, is.system_key);
 		dec->m2->set_init_cbc(dec->m2, is.init_cbc);
-		dec->m2->set_round(dec->m2, multi2_round);
+		dec->m2->set_round(dec->m2, prv->multi2_round);
 	}
 
-	dec->m2->set_scramble_key(dec->m2, res.scramble_key);
-
-LAST:
-	if(sect.raw != NULL){
-		n = dec->ecm->ret(dec->ecm, &sect);
-		if( (n < 0) && (r == 0) ){
-			r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
-		}
+	dec->keyless = 1;
+	if(dec->m2->set_scramble_key(dec->m2, res->scramble_key) < 0){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
+	dec->keyless = 0;
 
-	return r;
+	memcpy(dec->key, res->scramble_key, sizeof(dec->key));
+
+	/* packets that went out before the key are still in the delay line */
+	settle_delay_line(prv, dec);
+
+	return 0;
 }
 
 static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
@@ -2038,25 +2730,58 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 	int32_t crypt;
 	int32_t unit;
 	int32_t pid;
+	int32_t cls;
+	int32_t quiet;
 
 	uint8_t *p;
+	uint8_t *src;
+	uint8_t *dst;
 	uint8_t *curr;
 	uint8_t *tail;
+	uint8_t *lead;
 
 	TS_HEADER hdr;
+	PID_ROUTE *rt;
 	DECRYPTOR_ELEM *dec;
+	DECRYPTOR_ELEM *hold;
+	DECRYPTOR_ELEM *late;
 	TS_PROGRAM *pgrm;
+	MULTI2 *m2;
 
 	unit = prv->unit_size;
 	curr = prv->sbuf.head;
 	tail = prv->sbuf.tail;
 
-	m = prv->dbuf.tail - prv->dbuf.head;
+	/* held packets may keep dbuf.head off the pool, appends count from pool */
+	m = prv->dbuf.tail - prv->dbuf.pool;
 	n = tail - curr;
 	if(!reserve_work_buffer(&(prv->dbuf), m+n)){
 		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
 
+	/* drop entries left behind by a rolled back call */
+	prv->batch.m2 = NULL;
+	prv->batch.count = 0;
+
+	prv->count_run += (int32_t)(n / unit);
+	if(prv->count_run >= PID_COUNT_FOLD){
+		fold_pid_count(prv);
+	}
+
+	/* keys landed since the last call release the packets held for them */
+	r = drain_ecm(prv, 0);
+	if(r < 0){
+		return r;
+	}
+
+	lead = NULL;
+	if( (prv->lead != NULL) && (prv->lead->offset > 0) ){
+		lead = curr + prv->lead->offset;
+		for(m=0;m<prv->lead->touched_count;m++){
+			prv->lead->seen[prv->lead->touched[m]] = 0;
+		}
+	}
+
 	r = 0;
 
 	while( (curr+unit) < tail ){
@@ -2066,7 +2791,7 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(p == NULL){
 				goto LAST;
 			}
-			if((p-curr) >= (unit-188)){
+			if( ((p-curr) >= (unit-188)) && ((lead == NULL) || (curr >= lead)) ){
 				if(!append_work_buffer(&(prv->dbuf), p-(unit-188), unit-188)){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
@@ -2086,7 +2811,9 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			goto NEXT;
 		}
 
-		if( (pid == 0x1fff) && (prv->strip) ){
+		rt = prv->route + pid;
+		cls = rt->cls;
+		if(cls == PID_CLASS_DROP){
 			/* strip null(padding) stream */
 			goto NEXT;
 		}
@@ -2104,11 +2831,24 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			n = 188 - 4;
 		}
 
+		quiet = 0;
+		if( (lead != NULL) && (curr < lead) && (prv->lead->seen[pid] < prv->lead->count[pid]) ){
+			/* output by forward_clear_packets() already, parse only */
+			prv->lead->seen[pid] += 1;
+			quiet = 1;
+		}
+
+		m2 = NULL;
+		hold = NULL;
+		late = NULL;
 		if(crypt != 0){
 			if(hdr.adaptation_field_control & 0x01){
 
-				if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
-					dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+				if(cls == PID_CLASS_ES){
+					dec = NULL;
+					if(rt->dec != 0){
+						dec = prv->decrypt.slot[rt->dec-1];
+					}
 				}else if( (prv->map[pid].type == 0) &&
 						  (prv->decrypt.count == 1) ){
 					dec = prv->decrypt.head;
@@ -2116,30 +2856,98 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 					dec = NULL;
 				}
 
-				if( (dec != NULL) && (dec->m2 != NULL) ){
-					m = dec->m2->decrypt(dec->m2, crypt, p, n);
-					if(m < 0){
-						return ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+				if( (dec != NULL) && need_key_wait(dec, crypt) && (prv->wait.count >= prv->wait.max) ){
+					/* reorder buffer is full, wait for the card */
+					r = drain_ecm(prv, 1);
+					if(r < 0){
+						return r;
 					}
-					curr[3] &= 0x3f;
-					prv->map[pid].normal_packet += 1;
+				}
+
+				if( (dec != NULL) && need_key_wait(dec, crypt) ){
+					hold = dec;
+				}else if( (dec != NULL) && (prv->delay.length > 0) && check_late_key(dec, crypt) ){
+					/* the key may still land while the packet is kept */
+					late = dec;
+					prv->count[pid].undecrypted += 1;
+				}else if( (dec != NULL) && (dec->m2 != NULL) ){
+					m2 = dec->m2;
+					dec->parity = crypt;
+					prv->count[pid].normal_packet += 1;
 				}else{
-					prv->map[pid].undecrypted += 1;
+					prv->count[pid].undecrypted += 1;
 				}
 
 			}else{
 				curr[3] &= 0x3f;
-				prv->map[pid].normal_packet += 1;
+				prv->count[pid].normal_packet += 1;
 			}
 		}else{
-			prv->map[pid].normal_packet += 1;
+			prv->count[pid].normal_packet += 1;
 		}
 
-		if(!append_work_buffer(&(prv->dbuf), curr, unit)){
-			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		if(m2 != NULL){
+			/* the payload is decrypted straight from sbuf into dbuf */
+			dst = extend_work_buffer(&(prv->dbuf), unit);
+			if(dst == NULL){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			if(prv->dbuf.pool == prv->sbuf.pool){
+				/**
+				 zero copy - output trails the input in the same buffer,
+				 decrypt in place as later packets may be moved over curr
+				 before the queue is flushed
+				 */
+				if(dst != curr){
+					memmove(dst, curr, unit);
+				}
+				src = dst + (p - curr);
+			}else{
+				memcpy(dst, curr, p-curr);
+				if(unit > 188){
+					memcpy(dst+188, curr+188, unit-188);
+				}
+				src = p;
+			}
+			dst[3] &= 0x3f;
+			r = queue_decrypt(prv, m2, crypt, src, dst+(p-curr), n);
+			if(r < 0){
+				return r;
+			}
+			p = dst + (p - curr);
+		}else if(hold != NULL){
+			r = hold_packet(prv, hold, crypt, pid, curr, p-curr, n);
+			if(r < 0){
+				return r;
+			}
+			p = prv->dbuf.tail - unit + (p - curr);
+		}else if(!quiet){
+			if(!append_work_buffer(&(prv->dbuf), curr, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			/* parse the copy, in zero copy mode the move may overlap curr */
+			p = prv->dbuf.tail - unit + (p - curr);
+			if(late != NULL){
+				r = keep_delay_packet(prv, late, crypt, pid, (prv->dbuf.tail - unit) - prv->dbuf.head, p - (prv->dbuf.tail - unit), n);
+				if(r < 0){
+					return r;
+				}
+			}
 		}
 
-		if(prv->map[pid].type == PID_MAP_TYPE_ECM){
+		if(cls < PID_CLASS_ECM){
+			/* elementary stream or passthrough */
+			goto NEXT;
+		}
+
+		/* sections may update the keys or release the decryptor */
+		r = flush_decrypt(prv);
+		if(r < 0){
+			return r;
+		}
+
+		switch(cls){
+		case PID_CLASS_ECM:
 			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
 			if( (dec == NULL) || (dec->ecm == NULL) ){
 				/* this code will never execute */
@@ -2156,11 +2964,12 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(m == 0){
 				goto NEXT;
 			}
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+			r = proc_ecm(prv, dec, 1);
 			if(r < 0){
 				return r;
 			}
-		}else if(prv->map[pid].type == PID_MAP_TYPE_PMT){
+			break;
+		case PID_CLASS_PMT:
 			pgrm = (TS_PROGRAM *)(prv->map[pid].target);
 			if( (pgrm == NULL) || (pgrm->pmt == NULL) ){
 				/* this code will never execute */
@@ -2181,12 +2990,13 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(r < 0){
 				return r;
 			}
-		}else if(prv->map[pid].type == PID_MAP_TYPE_EMM){
+			break;
+		case PID_CLASS_EMM:
 			if( prv->emm_proc_on == 0){
 				goto NEXT;
 			}
 			if( prv->emm == NULL ){
-				prv->emm = create_ts_section_parser();
+				prv->emm = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->emm == NULL){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
@@ -2206,9 +3016,10 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(r < 0){
 				return r;
 			}
-		}else if(pid == 0x0001){
+			break;
+		case PID_CLASS_CAT:
 			if( prv->cat == NULL ){
-				prv->cat = create_ts_section_parser();
+				prv->cat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->cat == NULL){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
@@ -2228,9 +3039,10 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(r < 0){
 				return r;
 			}
-		}else if(pid == 0x0000){
+			break;
+		case PID_CLASS_PAT:
 			if( prv->pat == NULL ){
-				prv->pat = create_ts_section_parser();
+				prv->pat = create_ts_section_parser_ex(&(prv->mem));
 				if(prv->pat == NULL){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
@@ -2259,21 +3071,1220 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 	}
 
 LAST:
-	m = curr - prv->sbuf.pool;
-	n = tail - curr;
-	if( (n < 1024) || (m > (prv->sbuf.max/2) ) ){
-		p = prv->sbuf.pool;
-		if(n > 0)
-			memcpy(p, curr, n);
-		prv->sbuf.head = p;
-		prv->sbuf.tail = p+n;
-	}else{
-		prv->sbuf.head = curr;
+	m = flush_decrypt(prv);
+	if(m < 0){
+		return (int)m;
 	}
 
+	if(lead != NULL){
+		commit_lead(prv, curr);
+	}
+
+	if(prv->sbuf.pool == prv->dbuf.pool){
+		/* zero copy - proc_in_place() carries the remainder over */
+		prv->sbuf.head = curr;
+		return r;
+	}
+
+	consume_work_buffer(&(prv->sbuf), curr);
+
+	return r;
+}
+
+static int put_input(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, intptr_t slen, intptr_t dlen)
+{
+	int r;
+
+	if( (prv->zero_copy) &&
+	    (prv->unit_size >= 188) &&
+	    ((prv->lead == NULL) || (prv->lead->offset == 0)) &&
+	    (prv->wait.max == 0) &&
+	    (prv->delay.length == 0) &&
+	    (prv->p_count > 0) &&
+	    check_pmt_complete(prv) &&
+	    check_ecm_complete(prv) ){
+		return proc_in_place(prv, buf, slen, dlen);
+	}
+
+	if(!append_work_buffer(&(prv->sbuf), buf->data, buf->size)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	if(prv->unit_size < 188){
+		r = select_unit_size(prv);
+		if(r < 0){
+			return r;
+		}
+		if(prv->unit_size < 188){
+			/* need more data */
+			return 0;
+		}
+	}
+
+	if(prv->p_count < 1){
+		r = find_pat(prv);
+		if(r < 0){
+			return r;
+		}
+		if(prv->p_count < 1){
+			if(!check_wait_exceeded(prv, 16*1024*1024)){
+				/* need more data */
+				r = forward_clear_packets(prv);
+				if(r < 0){
+					return r;
+				}
+				return ARIB_STD_B25_WARN_PAT_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_PAT_IN_HEAD_16M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	if(!check_pmt_complete(prv)){
+		r = find_pmt(prv);
+		if(r < 0){
+			return r;
+		}
+		if(!check_pmt_complete(prv)){
+			if(!check_wait_exceeded(prv, 32*1024*1024)){
+				/* need more data */
+				r = forward_clear_packets(prv);
+				if(r < 0){
+					return r;
+				}
+				return ARIB_STD_B25_WARN_PMT_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_PMT_IN_HEAD_32M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	if(!check_ecm_complete(prv)){
+		r = find_ecm(prv);
+		if(r < 0){
+			return r;
+		}
+		if(!check_ecm_complete(prv)){
+			if(!check_wait_exceeded(prv, 32*1024*1024)){
+				/* need more data */
+				r = forward_clear_packets(prv);
+				if(r < 0){
+					return r;
+				}
+				return ARIB_STD_B25_WARN_ECM_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_ECM_IN_HEAD_32M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	if( (prv->lead != NULL) && (prv->lead->offset == 0) ){
+		/* found without forwarding anything */
+		reset_lead(prv);
+	}
+
+	r = proc_arib_std_b25(prv);
+	if(r < 0){
+		rollback_input(prv, slen, dlen);
+	}
+	return r;
+}
+
+static int forward_clear_packets(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t pid;
+	int32_t unit;
+
+	uint8_t *p;
+	uint8_t *curr;
+	uint8_t *tail;
+
+	LEAD_STATE *lead;
+
+	unit = prv->unit_size;
+	if( (!prv->low_latency) || (unit < 188) ){
+		return 0;
+	}
+
+	if(prv->lead == NULL){
+		/* started again after reset() */
+		prv->lead = (LEAD_STATE *)mem_calloc(&(prv->mem), 1, sizeof(LEAD_STATE));
+		if(prv->lead == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	lead = prv->lead;
+	curr = prv->sbuf.head + lead->offset;
+	tail = prv->sbuf.tail;
+
+	while( (p = next_lead_packet(prv, curr, tail, &pid)) != NULL ){
+		if(pid == LEAD_JUNK){
+			if(!append_work_buffer(&(prv->dbuf), p, unit-188)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			curr = p + (unit-188);
+			continue;
+		}
+		if(pid >= 0){
+			touch_lead(lead, pid);
+			if( ((p[3] & 0xc0) == 0) && ((lead->held[pid>>3] & (1 << (pid & 7))) == 0) ){
+				if(!append_work_buffer(&(prv->dbuf), p, unit)){
+					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				}
+				lead->count[pid] += 1;
+			}else{
+				/* keep the order inside the PID, everything after waits too */
+				lead->held[pid>>3] |= (uint8_t)(1 << (pid & 7));
+			}
+		}
+		curr = p + unit;
+	}
+
+	lead->offset = curr - prv->sbuf.head;
+
+	return 0;
+}
+
+static uint8_t *next_lead_packet(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr, uint8_t *tail, int32_t *pid)
+{
+	int32_t n;
+	int32_t unit;
+
+	uint8_t *p;
+
+	TS_HEADER hdr;
+
+	/* same walk as proc_arib_std_b25(), so the replay meets the same packets */
+	unit = prv->unit_size;
+	while( (curr+unit) < tail ){
+		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
+			p = resync(curr, tail, unit);
+			if(p == NULL){
+				return NULL;
+			}
+			if( (unit > 188) && ((p-curr) >= (unit-188)) ){
+				*pid = LEAD_JUNK;
+				return p-(unit-188);
+			}
+			curr = p;
+		}
+
+		extract_ts_header(&hdr, curr);
+		if( (hdr.transport_error_indicator != 0) || (prv->route[hdr.pid].cls == PID_CLASS_DROP) ){
+			*pid = LEAD_SKIP;
+			return curr;
+		}
+
+		if(hdr.adaptation_field_control & 0x02){
+			n = 188 - (5 + curr[4]);
+			if( (n < 1) && ((n < 0) || (hdr.adaptation_field_control & 0x01)) ){
+				/* broken packet */
+				curr += 1;
+				continue;
+			}
+		}
+
+		*pid = hdr.pid;
+		return curr;
+	}
+
+	return NULL;
+}
+
+static void drop_lead(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *head)
+{
+	int32_t pid;
+
+	uint8_t *p;
+	uint8_t *curr;
+	uint8_t *last;
+
+	LEAD_STATE *lead;
+
+	lead = prv->lead;
+	if( (lead == NULL) || (lead->offset == 0) ){
+		return;
+	}
+
+	/* packets before the new head are skipped by the replay */
+	curr = prv->sbuf.head;
+	last = curr + lead->offset;
+	if(last > head){
+		last = head;
+	}
+
+	while( (p = next_lead_packet(prv, curr, prv->sbuf.tail, &pid)) != NULL ){
+		if(p >= last){
+			break;
+		}
+		if(pid == LEAD_JUNK){
+			curr = p + (prv->unit_size-188);
+			continue;
+		}
+		if( (pid >= 0) && (lead->count[pid] > 0) ){
+			lead->count[pid] -= 1;
+		}
+		curr = p + prv->unit_size;
+	}
+
+	lead->offset -= (head - prv->sbuf.head);
+	if(lead->offset <= 0){
+		reset_lead(prv);
+	}
+}
+
+static void commit_lead(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr)
+{
+	int i;
+	int32_t pid;
+
+	LEAD_STATE *lead;
+
+	lead = prv->lead;
+	for(i=0;i<lead->touched_count;i++){
+		pid = lead->touched[i];
+		lead->count[pid] -= lead->seen[pid];
+	}
+
+	lead->offset -= (curr - prv->sbuf.head);
+	if(lead->offset <= 0){
+		reset_lead(prv);
+	}
+}
+
+static void strip_lead(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t n;
+	int32_t pid;
+	int32_t unit;
+
+	uint8_t *p;
+	uint8_t *dst;
+	uint8_t *keep;
+	uint8_t *curr;
+	uint8_t *last;
+
+	LEAD_STATE *lead;
+
+	lead = prv->lead;
+	if( (lead == NULL) || (lead->offset == 0) ){
+		return;
+	}
+
+	unit = prv->unit_size;
+	curr = prv->sbuf.head;
+	last = curr + lead->offset;
+	dst = curr;
+	keep = curr;
+
+	while( (p = next_lead_packet(prv, curr, prv->sbuf.tail, &pid)) != NULL ){
+		if(p >= last){
+			break;
+		}
+		if(pid == LEAD_JUNK){
+			n = unit - 188;
+		}else if( (pid >= 0) && (lead->count[pid] > 0) ){
+			lead->count[pid] -= 1;
+			n = unit;
+		}else{
+			curr = p + unit;
+			continue;
+		}
+		memmove(dst, keep, p-keep);
+		dst += (p-keep);
+		keep = p + n;
+		curr = keep;
+	}
+
+	memmove(dst, keep, prv->sbuf.tail-keep);
+	prv->sbuf.tail = dst + (prv->sbuf.tail-keep);
+
+	reset_lead(prv);
+}
+
+static void reset_lead(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	/* nothing forwarded is left to skip, the next search starts afresh */
+	if(prv->lead != NULL){
+		mem_free(&(prv->mem), prv->lead);
+		prv->lead = NULL;
+	}
+}
+
+static void touch_lead(LEAD_STATE *lead, int32_t pid)
+{
+	if(lead->listed[pid>>3] & (1 << (pid & 7))){
+		return;
+	}
+
+	lead->listed[pid>>3] |= (uint8_t)(1 << (pid & 7));
+	lead->touched[lead->touched_count] = (uint16_t)pid;
+	lead->touched_count += 1;
+}
+
+static int proc_in_place(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, intptr_t slen, intptr_t dlen)
+{
+	int r,n;
+	intptr_t k;
+
+	uint8_t *head;
+	uint8_t *tail;
+	uint8_t *cut;
+
+	uint8_t keep[320];
+
+	TS_WORK_BUFFER sbuf;
+	TS_WORK_BUFFER dbuf;
+
+	/**
+	 the caller's buffer is written only by a run that can not fail,
+	 whatever may fail (sections, the packet carried over from the last
+	 call, packets needing the card) is copied and processed in sbuf
+	 first. the lead state is idle here, put_input() checked it
+	 */
+	head = buf->data;
+	tail = buf->data + buf->size;
+
+	cut = find_in_place_start(prv, head, tail, slen);
+	if( (cut != NULL) && (slen > 0) ){
+		memcpy(keep, prv->sbuf.head, slen);
+	}
+
+	r = 0;
+
+	if(cut != head){
+		k = buf->size;
+		if(cut != NULL){
+			/* the last copied packet needs the sync byte behind it */
+			k = (cut - head) + 1;
+		}
+		if(!append_work_buffer(&(prv->sbuf), head, (int32_t)k)){
+			rollback_input(prv, slen, dlen);
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		r = proc_arib_std_b25(prv);
+		if( (r < 0) || (cut == NULL) ){
+			if(r < 0){
+				rollback_input(prv, slen, dlen);
+			}
+			return r;
+		}
+		if( ((prv->sbuf.tail - prv->sbuf.head) != 1) ||
+		    (!check_pmt_complete(prv)) ||
+		    (!check_ecm_complete(prv)) ||
+		    (find_in_place_start(prv, cut, tail, 0) != cut) ){
+			/* off the packet grid or the sections changed the routes */
+			if(!append_work_buffer(&(prv->sbuf), head+k, (int32_t)(buf->size-k))){
+				restore_input(prv, keep, slen, dlen);
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			n = proc_arib_std_b25(prv);
+			if(n < 0){
+				restore_input(prv, keep, slen, dlen);
+				return n;
+			}
+			if(r == 0){
+				r = n;
+			}
+			return r;
+		}
+		head = cut;
+		reset_work_buffer(&(prv->sbuf));
+	}
+
+	/* the trailing partial packet is carried over without failing */
+	if(!reserve_work_buffer(&(prv->sbuf), prv->unit_size)){
+		restore_input(prv, keep, slen, dlen);
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	/* run proc_arib_std_b25() with sbuf and dbuf aliasing the caller's buffer */
+	sbuf = prv->sbuf;
+	dbuf = prv->dbuf;
+
+	prv->sbuf.pool = head;
+	prv->sbuf.head = head;
+	prv->sbuf.tail = tail;
+	prv->sbuf.max = tail - head;
+	prv->sbuf.kind = TS_WORK_BUFFER_FLAT;
+
+	prv->dbuf.pool = head;
+	prv->dbuf.head = head;
+	prv->dbuf.tail = head;
+	prv->dbuf.max = tail - head;
+
+	n = proc_arib_std_b25(prv);
+
+	head = prv->sbuf.head;
+	prv->zbuf.head = prv->dbuf.head;
+	prv->zbuf.tail = prv->dbuf.tail;
+
+	prv->sbuf = sbuf;
+	prv->dbuf = dbuf;
+
+	if(n < 0){
+		/* this code will never execute */
+		restore_input(prv, keep, slen, dlen);
+		return n;
+	}
+	if(n != 0){
+		r = n;
+	}
+
+	append_work_buffer(&(prv->sbuf), head, (int32_t)(tail-head));
+
+	return r;
+}
+
+static uint8_t *find_in_place_start(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *head, uint8_t *tail, intptr_t slen)
+{
+	int n;
+	int32_t unit;
+
+	uint8_t *curr;
+	uint8_t *cut;
+
+	/**
+	 returns where the in place run may start - behind the last packet
+	 proc_arib_std_b25() could fail on, NULL copies the whole buffer
+	 */
+	unit = prv->unit_size;
+
+	curr = head;
+	if(slen > 0){
+		if( (slen >= unit) || (prv->sbuf.head[0] != 0x47) ){
+			return NULL;
+		}
+		curr = head + (unit - slen);
+	}
+
+	cut = curr;
+	while( (curr+unit) < tail ){
+		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
+			return NULL;
+		}
+		n = check_in_place_packet(prv, curr);
+		if(n < 0){
+			return NULL;
+		}
+		curr += unit;
+		if(n == 0){
+			cut = curr;
+		}
+	}
+
+	if( (cut+unit) >= tail ){
+		/* no complete packet left to run in place */
+		return NULL;
+	}
+
+	return cut;
+}
+
+static int check_in_place_packet(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr)
+{
+	int32_t crypt;
+	int32_t pid;
+	int32_t cls;
+
+	intptr_t n;
+	uint8_t *p;
+
+	TS_HEADER hdr;
+	PID_ROUTE *rt;
+	DECRYPTOR_ELEM *dec;
+
+	/* 1 - safe, 0 - copy it, -1 - proc_arib_std_b25() leaves the unit grid */
+	extract_ts_header(&hdr, curr);
+	crypt = hdr.transport_scrambling_control;
+	pid = hdr.pid;
+
+	if(hdr.transport_error_indicator != 0){
+		return 1;
+	}
+
+	rt = prv->route + pid;
+	cls = rt->cls;
+	if(cls == PID_CLASS_DROP){
+		return 1;
+	}
+
+	if(hdr.adaptation_field_control & 0x02){
+		p = curr + 4;
+		p += (p[0]+1);
+		n = 188 - (p-curr);
+		if( (n < 1) && ((n < 0) || (hdr.adaptation_field_control & 0x01)) ){
+			/* broken packet */
+			return -1;
+		}
+	}
+
+	if( (cls >= PID_CLASS_ECM) && ((cls != PID_CLASS_EMM) || (prv->emm_proc_on != 0)) ){
+		/* sections may fail or call the card */
+		return 0;
+	}
+
+	if( (crypt == 0) || ((hdr.adaptation_field_control & 0x01) == 0) ){
+		return 1;
+	}
+
+	if(cls == PID_CLASS_ES){
+		dec = NULL;
+		if(rt->dec != 0){
+			dec = prv->decrypt.slot[rt->dec-1];
+		}
+	}else if( (prv->map[pid].type == 0) &&
+			  (prv->decrypt.count == 1) ){
+		dec = prv->decrypt.head;
+	}else{
+		dec = NULL;
+	}
+
+	if(dec == NULL){
+		return 1;
+	}
+
+	if(need_key_wait(dec, crypt)){
+		return 0;
+	}
+
+	if( (dec->m2 != NULL) && dec->keyless ){
+		/* decrypting fails until the next ECM */
+		return 0;
+	}
+
+	return 1;
+}
+
+static void rollback_input(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t slen, intptr_t dlen)
+{
+	prv->sbuf.tail = prv->sbuf.head + slen;
+	prv->dbuf.tail = prv->dbuf.head + dlen;
+	prv->batch.m2 = NULL;
+	prv->batch.count = 0;
+	rollback_key_wait(prv, dlen);
+	rollback_delay_line(prv, dlen);
+}
+
+static void restore_input(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *keep, intptr_t slen, intptr_t dlen)
+{
+	/* sbuf was consumed by a run that succeeded, put back what it held */
+	reset_work_buffer(&(prv->sbuf));
+	append_work_buffer(&(prv->sbuf), keep, (int32_t)slen);
+	rollback_input(prv, slen, dlen);
+
+	prv->zbuf.head = NULL;
+	prv->zbuf.tail = NULL;
+}
+
+static int settle_zero_copy(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t n;
+
+	/**
+	 output still in the caller's buffer goes behind dbuf before anything
+	 else is appended there, so get() keeps the stream order
+	 */
+	n = (int32_t)(prv->zbuf.tail - prv->zbuf.head);
+	if(n > 0){
+		if(!append_work_buffer(&(prv->dbuf), prv->zbuf.head, n)){
+			return 0;
+		}
+	}
+
+	prv->zbuf.head = NULL;
+	prv->zbuf.tail = NULL;
+
+	return 1;
+}
+
+static int queue_decrypt(ARIB_STD_B25_PRIVATE_DATA *prv, MULTI2 *m2, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size)
+{
+	int r;
+	DECRYPT_BATCH *batch;
+
+	batch = &(prv->batch);
+
+	if( (batch->m2 != m2) || (batch->count >= DECRYPT_BATCH_SIZE) ){
+		r = flush_decrypt(prv);
+		if(r < 0){
+			return r;
+		}
+	}
+
+	batch->m2 = m2;
+	batch->type[batch->count] = type;
+	batch->src[batch->count] = src;
+	batch->dst[batch->count] = dst;
+	batch->size[batch->count] = size;
+	batch->count += 1;
+
+	return 0;
+}
+
+static int flush_decrypt(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r;
+	DECRYPT_BATCH *batch;
+
+	batch = &(prv->batch);
+
+	r = 0;
+	if(batch->count > 0){
+		r = batch->m2->decrypt_batch_to(batch->m2, batch->type, batch->src, batch->dst, batch->size, batch->count);
+	}
+
+	batch->m2 = NULL;
+	batch->count = 0;
+
+	if(r < 0){
+		return ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+	}
+
+	return 0;
+}
+static int transmit_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, B_CAS_ECM_RESULT *dst, uint8_t *src, uint32_t len)
+{
+	if(prv->wait.worker != NULL){
+		/* serialized with the call the worker may be running */
+		return prv->wait.worker->proc_ecm(prv->wait.worker, dst, src, (int32_t)len);
+	}
+
+	return prv->bcas->proc_ecm(prv->bcas, dst, src, len);
+}
+
+static int transmit_emm(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *src, int32_t len)
+{
+	if(prv->wait.worker != NULL){
+		return prv->wait.worker->proc_emm(prv->wait.worker, src, len);
+	}
+
+	return prv->bcas->proc_emm(prv->bcas, src, len);
+}
+
+static int post_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, uint8_t *src, uint32_t len)
+{
+	int r,n;
+
+	ECM_WORKER *w;
+	B_CAS_ECM_RESULT res;
+
+	w = prv->wait.worker;
+	if(w == NULL){
+		w = create_ecm_worker(prv->bcas, &(prv->mem));
+		if(w == NULL){
+			/* no thread - process it in place as before */
+			r = prv->bcas->proc_ecm(prv->bcas, &res, src, len);
+			return apply_ecm(prv, dec, r, &res);
+		}
+		prv->wait.worker = w;
+	}
+
+	while( (n = w->post(w, (int32_t)dec->tag, src, (int32_t)len)) == ECM_WORKER_WARN_QUEUE_FULL ){
+		r = drain_ecm(prv, 1);
+		if(r < 0){
+			return r;
+		}
+	}
+	if(n < 0){
+		/* too long for the card, fails like a transmit error */
+		return apply_ecm(prv, dec, n, &res);
+	}
+
+	dec->posted += 1;
+
+	return 0;
+}
+
+static int drain_ecm(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t block)
+{
+	int r,n;
+
+	ECM_WORKER *w;
+	ECM_WORKER_RESULT res;
+	DECRYPTOR_ELEM *dec;
+
+	w = prv->wait.worker;
+	if(w == NULL){
+		return 0;
+	}
+
+	/* queued decrypts may use a MULTI2 that a result releases */
+	r = flush_decrypt(prv);
+	if(r < 0){
+		return r;
+	}
+
+	for(;;){
+		if(block){
+			n = w->wait(w, &res);
+		}else{
+			n = w->get(w, &res);
+		}
+		if(n < 1){
+			break;
+		}
+
+		dec = prv->decrypt.head;
+		while( (dec != NULL) && (dec->tag != (uint32_t)res.tag) ){
+			dec = (DECRYPTOR_ELEM *)(dec->next);
+		}
+		if(dec == NULL){
+			/* removed while the card was busy */
+			continue;
+		}
+
+		dec->applied += 1;
+		r = apply_ecm(prv, dec, res.result, &(res.ecm));
+		n = settle_key_wait(prv, dec, 0);
+		if(r < 0){
+			return r;
+		}
+		if(n < 0){
+			return n;
+		}
+	}
+
+	return 0;
+}
+
+static int stop_ecm_worker(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r,n;
+	DECRYPTOR_ELEM *dec;
+
+	if(prv->wait.worker == NULL){
+		return 0;
+	}
+
+	r = drain_ecm(prv, 1);
+
+	prv->wait.worker->release(prv->wait.worker);
+	prv->wait.worker = NULL;
+
+	/* results dropped on an error are not waited for any more */
+	dec = prv->decrypt.head;
+	while(dec != NULL){
+		dec->applied = dec->posted;
+		n = settle_key_wait(prv, dec, 0);
+		if( (n < 0) && (r >= 0) ){
+			r = n;
+		}
+		dec = (DECRYPTOR_ELEM *)(dec->next);
+	}
+
+	return r;
+}
+
+static int need_key_wait(DECRYPTOR_ELEM *dec, int32_t crypt)
+{
+	if(dec->waiting > 0){
+		/* keep the order inside the decryptor */
+		return 1;
+	}
+
+	if(dec->posted == dec->applied){
+		return 0;
+	}
+
+	/* the other parity may need the key of the ECM in flight */
+	return (dec->m2 == NULL) || (dec->parity != crypt);
+}
+
+static int hold_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t type, int32_t pid, uint8_t *curr, intptr_t payload, intptr_t size)
+{
+	KEY_WAIT_ENTRY *e;
+
+	if(prv->wait.count >= prv->wait.max){
+		/* this code will never execute */
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	if(!append_work_buffer(&(prv->dbuf), curr, prv->unit_size)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	e = prv->wait.entry + prv->wait.count;
+	e->dec = dec;
+	e->need = dec->posted;
+	e->type = type;
+	e->pid = pid;
+	e->offset = (prv->dbuf.tail - prv->unit_size) - prv->dbuf.head;
+	e->payload = payload;
+	e->size = size;
+
+	prv->wait.count += 1;
+	dec->waiting += 1;
+
+	return 0;
+}
+
+static int settle_key_wait(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t drop)
+{
+	int r;
+	int32_t i,n;
+
+	uint8_t *p;
+
+	KEY_WAIT_ENTRY *e;
+
+	r = 0;
+	n = 0;
+
+	for(i=0;i<prv->wait.count;i++){
+		e = prv->wait.entry + i;
+		if( (e->dec == dec) && (drop || (e->need <= dec->applied)) ){
+			p = prv->dbuf.head + e->offset;
+			if(drop){
+				prv->count[e->pid].undecrypted += 1;
+			}else if( (prv->delay.length > 0) && check_late_key(dec, e->type) ){
+				/* the result had no key of this period, the delay line waits on */
+				prv->count[e->pid].undecrypted += 1;
+				if(keep_delay_packet(prv, dec, e->type, e->pid, e->offset, e->payload, e->size) < 0){
+					r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				}
+			}else if(dec->m2 != NULL){
+				if(dec->m2->decrypt(dec->m2, e->type, p+e->payload, e->size) < 0){
+					r = ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+				}
+				p[3] &= 0x3f;
+				dec->parity = e->type;
+				prv->count[e->pid].normal_packet += 1;
+			}else{
+				prv->count[e->pid].undecrypted += 1;
+			}
+			dec->waiting -= 1;
+			e->dec = NULL;
+		}
+		if(e->dec != NULL){
+			if(n != i){
+				prv->wait.entry[n] = *e;
+			}
+			n += 1;
+		}
+	}
+
+	prv->wait.count = n;
+
 	return r;
 }
 
+static void rollback_key_wait(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t dlen)
+{
+	KEY_WAIT_ENTRY *e;
+
+	while(prv->wait.count > 0){
+		e = prv->wait.entry + (prv->wait.count - 1);
+		if(e->offset < dlen){
+			break;
+		}
+		if(e->dec != NULL){
+			e->dec->waiting -= 1;
+		}
+		prv->wait.count -= 1;
+	}
+}
+
+static int check_late_key(DECRYPTOR_ELEM *dec, int32_t crypt)
+{
+	int32_t b;
+
+	if(dec->m2 == NULL){
+		return 1;
+	}
+
+	if(dec->parity != crypt){
+		/* the period of the other parity is over, its key must change */
+		if(dec->run_set){
+			b = dec->parity & 1;
+			memcpy(dec->used+(1-b)*8, dec->run, 8);
+			dec->used_mask |= 1 << b;
+		}
+		dec->parity = crypt;
+		dec->run_set = 0;
+	}
+
+	if(dec->run_set){
+		return 0;
+	}
+
+	if(is_stale_key(dec, crypt)){
+		/* the ECM of this period has not been applied yet */
+		return 1;
+	}
+
+	b = crypt & 1;
+	memcpy(dec->run, dec->key+(1-b)*8, 8);
+	dec->run_set = 1;
+
+	return 0;
+}
+
+static void note_key_run(DECRYPTOR_ELEM *dec, int32_t type)
+{
+	int32_t b;
+
+	/* a period that went by waiting has run on the key it got at last */
+	b = type & 1;
+	if(type != dec->parity){
+		memcpy(dec->used+(1-b)*8, dec->key+(1-b)*8, 8);
+		dec->used_mask |= 1 << b;
+	}else if(!dec->run_set){
+		memcpy(dec->run, dec->key+(1-b)*8, 8);
+		dec->run_set = 1;
+	}
+}
+
+static int is_stale_key(DECRYPTOR_ELEM *dec, int32_t type)
+{
+	int32_t b;
+
+	/* key halves are odd then even, used_mask bit 0 is even */
+	b = type & 1;
+	if( (dec->used_mask & (1 << b)) == 0 ){
+		return 0;
+	}
+
+	return (memcmp(dec->key+(1-b)*8, dec->used+(1-b)*8, 8) == 0);
+}
+
+static int keep_delay_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t type, int32_t pid, intptr_t offset, intptr_t payload, intptr_t size)
+{
+	int32_t n;
+
+	DELAY_ENTRY *p;
+	DELAY_ENTRY *e;
+
+	if(prv->delay.count >= prv->delay.max){
+		n = prv->delay.max * 2;
+		if(n < 64){
+			n = 64;
+		}
+		p = (DELAY_ENTRY *)mem_realloc(&(prv->mem), prv->delay.entry, sizeof(DELAY_ENTRY)*n);
+		if(p == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->delay.entry = p;
+		prv->delay.max = n;
+	}
+
+	e = prv->delay.entry + prv->delay.count;
+	e->dec = dec;
+	e->type = type;
+	e->pid = pid;
+	e->offset = offset;
+	e->payload = payload;
+	e->size = size;
+
+	prv->delay.count += 1;
+
+	return 0;
+}
+
+static void open_delay_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DELAY_ENTRY *e)
+{
+	uint8_t *p;
+
+	/* without a key set the packet stays scrambled and counted so */
+	if(e->dec->m2 == NULL){
+		return;
+	}
+
+	p = prv->dbuf.head + e->offset;
+	if(e->dec->m2->decrypt(e->dec->m2, e->type, p+e->payload, e->size) < 0){
+		return;
+	}
+	p[3] &= 0x3f;
+
+	prv->count[e->pid].undecrypted -= 1;
+	prv->count[e->pid].normal_packet += 1;
+}
+
+static void settle_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
+{
+	int32_t i,n;
+
+	DELAY_ENTRY *e;
+
+	n = 0;
+	for(i=0;i<prv->delay.count;i++){
+		e = prv->delay.entry + i;
+		if( (e->dec == dec) && !is_stale_key(dec, e->type) ){
+			open_delay_packet(prv, e);
+			note_key_run(dec, e->type);
+			continue;
+		}
+		if(n != i){
+			prv->delay.entry[n] = *e;
+		}
+		n += 1;
+	}
+
+	prv->delay.count = n;
+}
+
+static void drop_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
+{
+	int32_t i,n;
+
+	DELAY_ENTRY *e;
+
+	/* the key never changed, go on with the one at hand as before */
+	n = 0;
+	for(i=0;i<prv->delay.count;i++){
+		e = prv->delay.entry + i;
+		if(e->dec == dec){
+			open_delay_packet(prv, e);
+			continue;
+		}
+		if(n != i){
+			prv->delay.entry[n] = *e;
+		}
+		n += 1;
+	}
+
+	prv->delay.count = n;
+}
+
+static intptr_t release_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t size)
+{
+	int32_t i,n;
+	intptr_t m,keep;
+	uint32_t now;
+
+	DELAY_LINE *d;
+
+	d = &(prv->delay);
+
+	if( (d->length > 0) && (d->drain == 0) ){
+		m = prv->dbuf.tail - prv->dbuf.head;
+		if(d->unit == ARIB_STD_B25_DELAY_LINE_MSEC){
+			/* up to the last put() output old enough */
+			now = get_msec_clock();
+			keep = m;
+			for(i=0;i<d->mark_count;i++){
+				if( (now - d->mark[i].time) < (uint32_t)d->length ){
+					break;
+				}
+				keep = m - d->mark[i].offset;
+			}
+		}else{
+			n = prv->unit_size;
+			if(n < 188){
+				n = 188;
+			}
+			keep = (intptr_t)d->length * n;
+		}
+		if( (prv->memory_limit > 0) && (keep > (prv->memory_limit/2)) ){
+			/* put() needs room for the input */
+			keep = prv->memory_limit / 2;
+		}
+		if(size > (m - keep)){
+			size = m - keep;
+		}
+		if(size < 0){
+			size = 0;
+		}
+	}
+
+	n = 0;
+	for(i=0;i<d->count;i++){
+		if(d->entry[i].offset < size){
+			/* no key came in time, as if there were no delay line */
+			open_delay_packet(prv, d->entry+i);
+			continue;
+		}
+		d->entry[i].offset -= size;
+		if(n != i){
+			d->entry[n] = d->entry[i];
+		}
+		n += 1;
+	}
+	d->count = n;
+
+	n = 0;
+	for(i=0;i<d->mark_count;i++){
+		d->mark[i].offset -= size;
+		if(d->mark[i].offset <= 0){
+			continue;
+		}
+		if(n != i){
+			d->mark[n] = d->mark[i];
+		}
+		n += 1;
+	}
+	d->mark_count = n;
+
+	return size;
+}
+
+static void mark_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	intptr_t m;
+	uint32_t now;
+
+	DELAY_LINE *d;
+	DELAY_MARK *k;
+
+	d = &(prv->delay);
+	if( (d->length < 1) || (d->unit != ARIB_STD_B25_DELAY_LINE_MSEC) ){
+		return;
+	}
+
+	m = prv->dbuf.tail - prv->dbuf.head;
+	now = get_msec_clock();
+
+	if(d->mark_count > 0){
+		k = d->mark + (d->mark_count-1);
+		if(k->offset >= m){
+			return;
+		}
+		/**
+		 calls close together share a mark, released with the last of
+		 them - a little late rather than early
+		 */
+		if( ((now - k->start) < (uint32_t)(d->length/(DELAY_MARK_MAX/2))) ||
+		    (d->mark_count >= DELAY_MARK_MAX) ){
+			k->offset = m;
+			k->time = now;
+			return;
+		}
+	}
+
+	k = d->mark + d->mark_count;
+	k->offset = m;
+	k->start = now;
+	k->time = now;
+	d->mark_count += 1;
+}
+
+static void rollback_delay_line(ARIB_STD_B25_PRIVATE_DATA *prv, intptr_t dlen)
+{
+	int32_t i,n;
+
+	/* entries taken over from KEY_WAIT may come out of order */
+	n = 0;
+	for(i=0;i<prv->delay.count;i++){
+		if(prv->delay.entry[i].offset >= dlen){
+			continue;
+		}
+		if(n != i){
+			prv->delay.entry[n] = prv->delay.entry[i];
+		}
+		n += 1;
+	}
+
+	prv->delay.count = n;
+}
+
+
 static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv)
 {
 	int r;
@@ -2309,13 +4320,13 @@ static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv)
 		}
 		prv->emm_pid = emm_pid;
 		prv->map[emm_pid].ref = 1;
-		prv->map[emm_pid].type = PID_MAP_TYPE_EMM;
-		prv->map[emm_pid].target = NULL;
+		set_pid_type(prv, emm_pid, PID_MAP_TYPE_EMM);
+		set_pid_target(prv, emm_pid, NULL);
 	}
 
 	prv->map[0x0001].ref = 1;
-	prv->map[0x0001].type = PID_MAP_TYPE_CAT;
-	prv->map[0x0001].target = NULL;
+	set_pid_type(prv, 0x0001, PID_MAP_TYPE_CAT);
+	set_pid_target(prv, 0x0001, NULL);
 
 LAST:
 	if(sect.raw != NULL){
@@ -2379,7 +4390,7 @@ static int proc_emm(ARIB_STD_B25_PRIVATE_DATA *prv)
 
 			for(j=0;j<prv->casid.count;j++){
 				if(prv->casid.data[j] == emm_hdr.card_id){
-					n = prv->bcas->proc_emm(prv->bcas, head, len);
+					n = transmit_emm(prv, head, len);
 					if(n < 0){
 						r = ARIB_STD_B25_ERROR_EMM_PROC_FAILURE;
 						goto LAST;
@@ -2402,44 +4413,344 @@ static int proc_emm(ARIB_STD_B25_PRIVATE_DATA *prv)
 		}
 	}
 
-LAST:
-	if(sect.raw != NULL){
-		n = prv->emm->ret(prv->emm, &sect);
-		if( (n < 0) && (r == 0) ){
-			r = ARIB_STD_B25_ERROR_EMM_PARSE_FAILURE;
-		}
+LAST:
+	if(sect.raw != NULL){
+		n = prv->emm->ret(prv->emm, &sect);
+		if( (n < 0) && (r == 0) ){
+			r = ARIB_STD_B25_ERROR_EMM_PARSE_FAILURE;
+		}
+	}
+
+	return r;
+}
+
+static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
+{
+	int32_t pid;
+	TS_STREAM_ELEM *strm;
+
+	pid = pgrm->pmt_pid;
+
+	if(pgrm->pmt != NULL){
+		drop_pmt_parser(prv, pgrm->pmt);
+		pgrm->pmt = NULL;
+	}
+
+	while( (strm = get_stream_list_head(&(pgrm->old_strm))) != NULL ){
+		unref_stream(prv, strm->pid);
+		memset(strm, 0, sizeof(TS_STREAM_ELEM));
+		put_stream_list_tail(&(prv->strm_pool), strm);
+	}
+
+	while( (strm = get_stream_list_head(&(pgrm->streams))) != NULL ){
+		unref_stream(prv, strm->pid);
+		memset(strm, 0, sizeof(TS_STREAM_ELEM));
+		put_stream_list_tail(&(prv->strm_pool), strm);
+	}
+
+	set_pid_type(prv, pid, PID_MAP_TYPE_UNKNOWN);
+	prv->map[pid].ref = 0;
+	set_pid_target(prv, pid, NULL);
+}
+
+static int preallocate(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	intptr_t n;
+
+	TS_STREAM_ELEM *strm;
+	DECRYPTOR_ELEM *dec;
+	DECRYPTOR_ELEM **slot;
+	TS_SECTION_PARSER *pmt;
+	MULTI2 *m2;
+
+	/* half a second of stream on each side */
+	n = prv->spare.bitrate / 16;
+	if(n < (256*1024)){
+		n = 256*1024;
+	}
+	if(!reserve_work_buffer(&(prv->sbuf), n)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+	if(!reserve_work_buffer(&(prv->dbuf), n)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	if(prv->pat == NULL){
+		prv->pat = create_reserved_parser(prv, SPARE_SECTION_COUNT);
+		if(prv->pat == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+	if(prv->cat == NULL){
+		prv->cat = create_reserved_parser(prv, SPARE_SECTION_COUNT);
+		if(prv->cat == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+	if(prv->emm == NULL){
+		prv->emm = create_reserved_parser(prv, SPARE_SECTION_COUNT);
+		if(prv->emm == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	if(prv->program == NULL){
+		prv->program = (TS_PROGRAM *)mem_calloc(&(prv->mem), SPARE_PROGRAM_COUNT, sizeof(TS_PROGRAM));
+		if(prv->program == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->p_max = SPARE_PROGRAM_COUNT;
+		prv->p_count = 0;
+	}
+
+	while(prv->strm_pool.count < SPARE_STREAM_COUNT){
+		strm = create_stream_elem(prv, 0, 0);
+		if(strm == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		put_stream_list_tail(&(prv->strm_pool), strm);
+	}
+
+	while(prv->spare.pmt_count < SPARE_PMT_MAX){
+		pmt = create_reserved_parser(prv, SPARE_SECTION_COUNT);
+		if(pmt == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->spare.pmt[prv->spare.pmt_count] = pmt;
+		prv->spare.pmt_count += 1;
+	}
+
+	while(prv->spare.decrypt.count < SPARE_DECRYPTOR_MAX){
+		dec = (DECRYPTOR_ELEM *)mem_calloc(&(prv->mem), 1, sizeof(DECRYPTOR_ELEM));
+		if(dec == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		dec->ecm = create_reserved_parser(prv, SPARE_SECTION_COUNT);
+		if( (dec->ecm == NULL) || !keep_spare_decryptor(prv, dec) ){
+			if(dec->ecm != NULL){
+				dec->ecm->release(dec->ecm);
+			}
+			mem_free(&(prv->mem), dec);
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	while(prv->spare.m2_count < SPARE_MULTI2_MAX){
+		m2 = create_multi2_ex(&(prv->mem));
+		if(m2 == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->spare.m2[prv->spare.m2_count] = m2;
+		prv->spare.m2_count += 1;
+	}
+
+	if(prv->decrypt.slot_max < (SPARE_DECRYPTOR_MAX*2)){
+		slot = (DECRYPTOR_ELEM **)mem_realloc(&(prv->mem), prv->decrypt.slot, sizeof(DECRYPTOR_ELEM *)*(SPARE_DECRYPTOR_MAX*2));
+		if(slot == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		memset(slot+prv->decrypt.slot_max, 0, sizeof(DECRYPTOR_ELEM *)*((SPARE_DECRYPTOR_MAX*2)-prv->decrypt.slot_max));
+		prv->decrypt.slot = slot;
+		prv->decrypt.slot_max = SPARE_DECRYPTOR_MAX*2;
+	}
+
+	return 0;
+}
+
+static void release_spare(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	DECRYPTOR_ELEM *dec;
+
+	while(prv->spare.m2_count > 0){
+		prv->spare.m2_count -= 1;
+		prv->spare.m2[prv->spare.m2_count]->release(prv->spare.m2[prv->spare.m2_count]);
+		prv->spare.m2[prv->spare.m2_count] = NULL;
+	}
+
+	while(prv->spare.pmt_count > 0){
+		prv->spare.pmt_count -= 1;
+		prv->spare.pmt[prv->spare.pmt_count]->release(prv->spare.pmt[prv->spare.pmt_count]);
+		prv->spare.pmt[prv->spare.pmt_count] = NULL;
+	}
+
+	while( (dec = take_spare_decryptor(prv)) != NULL ){
+		dec->ecm->release(dec->ecm);
+		mem_free(&(prv->mem), dec);
+	}
+}
+
+static TS_SECTION_PARSER *take_pmt_parser(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	TS_SECTION_PARSER *r;
+
+	if(prv->spare.pmt_count < 1){
+		return create_ts_section_parser_ex(&(prv->mem));
+	}
+
+	prv->spare.pmt_count -= 1;
+	r = prv->spare.pmt[prv->spare.pmt_count];
+	prv->spare.pmt[prv->spare.pmt_count] = NULL;
+
+	return r;
+}
+
+static void drop_pmt_parser(ARIB_STD_B25_PRIVATE_DATA *prv, TS_SECTION_PARSER *pmt)
+{
+	if( (prv->spare.bitrate < 1) || (prv->spare.pmt_count >= SPARE_PMT_MAX) ){
+		pmt->release(pmt);
+		return;
+	}
+
+	pmt->reset(pmt);
+	prv->spare.pmt[prv->spare.pmt_count] = pmt;
+	prv->spare.pmt_count += 1;
+}
+
+static DECRYPTOR_ELEM *take_spare_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	DECRYPTOR_ELEM *r;
+
+	r = prv->spare.decrypt.head;
+	if(r == NULL){
+		return NULL;
+	}
+
+	prv->spare.decrypt.head = (DECRYPTOR_ELEM *)(r->next);
+	if(prv->spare.decrypt.head != NULL){
+		prv->spare.decrypt.head->prev = NULL;
+	}else{
+		prv->spare.decrypt.tail = NULL;
+	}
+	prv->spare.decrypt.count -= 1;
+
+	r->next = NULL;
+
+	return r;
+}
+
+static int keep_spare_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
+{
+	TS_SECTION_PARSER *ecm;
+
+	if( (prv->spare.bitrate < 1) ||
+	    (prv->spare.decrypt.count >= SPARE_DECRYPTOR_MAX) ||
+	    (dec->ecm == NULL) || (dec->m2 != NULL) ){
+		return 0;
+	}
+
+	ecm = dec->ecm;
+	ecm->reset(ecm);
+	memset(dec, 0, sizeof(DECRYPTOR_ELEM));
+	dec->ecm = ecm;
+
+	if(prv->spare.decrypt.tail != NULL){
+		dec->prev = prv->spare.decrypt.tail;
+		prv->spare.decrypt.tail->next = dec;
+		prv->spare.decrypt.tail = dec;
+	}else{
+		prv->spare.decrypt.head = dec;
+		prv->spare.decrypt.tail = dec;
+	}
+	prv->spare.decrypt.count += 1;
+
+	return 1;
+}
+
+static TS_SECTION_PARSER *create_reserved_parser(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t count)
+{
+	TS_SECTION_PARSER *r;
+
+	r = create_ts_section_parser_ex(&(prv->mem));
+	if(r == NULL){
+		return NULL;
+	}
+
+	if(r->reserve(r, count) < 0){
+		r->release(r);
+		return NULL;
 	}
 
 	return r;
 }
 
-static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
+static void set_pid_type(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, int32_t type)
 {
-	int32_t pid;
-	TS_STREAM_ELEM *strm;
+	prv->map[pid].type = type;
+	update_pid_route(prv, pid);
+}
 
-	pid = pgrm->pmt_pid;
+static void set_pid_target(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, void *target)
+{
+	prv->map[pid].target = target;
+	update_pid_route(prv, pid);
+}
 
-	if(pgrm->pmt != NULL){
-		pgrm->pmt->release(pgrm->pmt);
-		pgrm->pmt = NULL;
+static void update_pid_route(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	int32_t cls;
+	DECRYPTOR_ELEM *dec;
+
+	if( (pid == 0x1fff) && (prv->strip) ){
+		cls = PID_CLASS_DROP;
+	}else if(prv->map[pid].type == PID_MAP_TYPE_ECM){
+		cls = PID_CLASS_ECM;
+	}else if(prv->map[pid].type == PID_MAP_TYPE_PMT){
+		cls = PID_CLASS_PMT;
+	}else if(prv->map[pid].type == PID_MAP_TYPE_EMM){
+		cls = PID_CLASS_EMM;
+	}else if(pid == 0x0001){
+		cls = PID_CLASS_CAT;
+	}else if(pid == 0x0000){
+		cls = PID_CLASS_PAT;
+	}else if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
+		cls = PID_CLASS_ES;
+	}else if(prv->map[pid].type == PID_MAP_TYPE_UNKNOWN){
+		cls = PID_CLASS_DEFAULT;
+	}else{
+		cls = PID_CLASS_PASS;
 	}
 
-	while( (strm = get_stream_list_head(&(pgrm->old_strm))) != NULL ){
-		unref_stream(prv, strm->pid);
-		memset(strm, 0, sizeof(TS_STREAM_ELEM));
-		put_stream_list_tail(&(prv->strm_pool), strm);
+	prv->route[pid].cls = (uint8_t)cls;
+
+	dec = NULL;
+	if(cls == PID_CLASS_ES){
+		dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
 	}
+	if(dec != NULL){
+		prv->route[pid].dec = (uint16_t)(dec->slot + 1);
+	}else{
+		prv->route[pid].dec = 0;
+	}
+}
 
-	while( (strm = get_stream_list_head(&(pgrm->streams))) != NULL ){
-		unref_stream(prv, strm->pid);
-		memset(strm, 0, sizeof(TS_STREAM_ELEM));
-		put_stream_list_tail(&(prv->strm_pool), strm);
+static void reset_pid_route(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t pid;
+
+	for(pid=0;pid<0x2000;pid++){
+		update_pid_route(prv, pid);
+	}
+}
+
+static void fold_pid_count(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t pid;
+	PID_COUNT *c;
+
+	/* a settled delay line packet may leave undecrypted below zero */
+	for(pid=0;pid<0x2000;pid++){
+		c = prv->count + pid;
+		prv->map[pid].normal_packet += c->normal_packet;
+		prv->map[pid].undecrypted += c->undecrypted;
 	}
 
-	prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
-	prv->map[pid].ref = 0;
-	prv->map[pid].target = NULL;
+	reset_pid_count(prv);
+}
+
+static void reset_pid_count(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	memset(prv->count, 0, sizeof(prv->count));
+	prv->count_run = 0;
 }
 
 static void unref_stream(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
@@ -2456,9 +4767,9 @@ static void unref_stream(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
 				remove_decryptor(prv, dec);
 			}
 		}
-		prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
+		set_pid_type(prv, pid, PID_MAP_TYPE_UNKNOWN);
 		prv->map[pid].ref = 0;
-		prv->map[pid].target = NULL;
+		set_pid_target(prv, pid, NULL);
 	}
 }
 
@@ -2473,14 +4784,24 @@ static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid
 			return r;
 		}
 	}
-	r = (DECRYPTOR_ELEM *)calloc(1, sizeof(DECRYPTOR_ELEM));
+	r = take_spare_decryptor(prv);
 	if(r == NULL){
-		return NULL;
+		r = (DECRYPTOR_ELEM *)mem_calloc(&(prv->mem), 1, sizeof(DECRYPTOR_ELEM));
+		if(r == NULL){
+			return NULL;
+		}
+		r->ecm = create_ts_section_parser_ex(&(prv->mem));
+		if(r->ecm == NULL){
+			mem_free(&(prv->mem), r);
+			return NULL;
+		}
 	}
 	r->ecm_pid = pid;
-	r->ecm = create_ts_section_parser();
-	if(r->ecm == NULL){
-		free(r);
+	prv->wait.tag += 1;
+	r->tag = prv->wait.tag;
+	if(!claim_decryptor_slot(prv, &(prv->decrypt), r)){
+		r->ecm->release(r->ecm);
+		mem_free(&(prv->mem), r);
 		return NULL;
 	}
 
@@ -2508,8 +4829,8 @@ static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid
 		}
 	}
 
-	prv->map[pid].type = PID_MAP_TYPE_ECM;
-	prv->map[pid].target = r;
+	set_pid_type(prv, pid, PID_MAP_TYPE_ECM);
+	set_pid_target(prv, pid, r);
 
 	return r;
 }
@@ -2524,8 +4845,8 @@ static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec
 	pid = dec->ecm_pid;
 	if( (prv->map[pid].type == PID_MAP_TYPE_ECM) &&
 	    (prv->map[pid].target == ((void *)dec)) ){
-		prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
-		prv->map[pid].target = NULL;
+		set_pid_type(prv, pid, PID_MAP_TYPE_UNKNOWN);
+		set_pid_target(prv, pid, NULL);
 	}
 
 	prev = (DECRYPTOR_ELEM *)(dec->prev);
@@ -2541,18 +4862,81 @@ static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec
 		prv->decrypt.tail = prev;
 	}
 	prv->decrypt.count -= 1;
+	prv->decrypt.slot[dec->slot] = NULL;
+
+	/* held packets go out as they are, later results find no tag */
+	settle_key_wait(prv, dec, 1);
+	drop_delay_line(prv, dec);
+
+	release_decryptor_multi2(prv, dec);
+
+	if(keep_spare_decryptor(prv, dec)){
+		return;
+	}
 
 	if(dec->ecm != NULL){
 		dec->ecm->release(dec->ecm);
 		dec->ecm = NULL;
 	}
 
-	if(dec->m2 != NULL){
-		dec->m2->release(dec->m2);
-		dec->m2 = NULL;
+	mem_free(&(prv->mem), dec);
+}
+
+static int claim_decryptor_slot(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_LIST *list, DECRYPTOR_ELEM *dec)
+{
+	int32_t i,n;
+	DECRYPTOR_ELEM **p;
+
+	for(i=0;i<list->slot_max;i++){
+		if(list->slot[i] == NULL){
+			goto LAST;
+		}
+	}
+
+	n = list->slot_max * 2;
+	if(n < 16){
+		n = 16;
+	}
+	if(n > 0xffff){
+		/* PID_ROUTE::dec is 16 bit */
+		return 0;
+	}
+	p = (DECRYPTOR_ELEM **)mem_realloc(&(prv->mem), list->slot, sizeof(DECRYPTOR_ELEM *)*n);
+	if(p == NULL){
+		return 0;
+	}
+	memset(p+list->slot_max, 0, sizeof(DECRYPTOR_ELEM *)*(n-list->slot_max));
+	list->slot = p;
+	list->slot_max = n;
+
+LAST:
+	list->slot[i] = dec;
+	dec->slot = i;
+
+	return 1;
+}
+
+static void release_decryptor_multi2(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
+{
+	int32_t n;
+
+	if(dec->m2 == NULL){
+		return;
+	}
+
+	n = 1;
+	if(prv->spare.bitrate > 0){
+		n = SPARE_MULTI2_MAX;
 	}
 
-	free(dec);
+	if(prv->spare.m2_count < n){
+		dec->m2->clear_scramble_key(dec->m2);
+		prv->spare.m2[prv->spare.m2_count] = dec->m2;
+		prv->spare.m2_count += 1;
+	}else{
+		dec->m2->release(dec->m2);
+	}
+	dec->m2 = NULL;
 }
 
 static DECRYPTOR_ELEM *select_active_decryptor(DECRYPTOR_ELEM *a, DECRYPTOR_ELEM *b, int32_t pid)
@@ -2581,11 +4965,11 @@ static void bind_stream_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, D
 		if(old->ref == 0){
 			remove_decryptor(prv, old);
 		}
-		prv->map[pid].target = NULL;
+		set_pid_target(prv, pid, NULL);
 	}
 
 	if(dec != NULL){
-		prv->map[pid].target = dec;
+		set_pid_target(prv, pid, dec);
 		dec->ref += 1;
 	}
 }
@@ -2640,11 +5024,11 @@ static TS_STREAM_ELEM *find_stream_list_elem(TS_STREAM_LIST *list, int32_t pid)
 	return r;
 }
 
-static TS_STREAM_ELEM *create_stream_elem(int32_t pid, int32_t type)
+static TS_STREAM_ELEM *create_stream_elem(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, int32_t type)
 {
 	TS_STREAM_ELEM *r;
 
-	r = (TS_STREAM_ELEM *)calloc(1, sizeof(TS_STREAM_ELEM));
+	r = (TS_STREAM_ELEM *)mem_calloc(&(prv->mem), 1, sizeof(TS_STREAM_ELEM));
 	if(r == NULL){
 		return NULL;
 	}
@@ -2672,14 +5056,14 @@ static void put_stream_list_tail(TS_STREAM_LIST *list, TS_STREAM_ELEM *elem)
 	}
 }
 
-static void clear_stream_list(TS_STREAM_LIST *list)
+static void clear_stream_list(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *list)
 {
 	TS_STREAM_ELEM *p,*n;
 
 	p = list->head;
 	while(p != NULL){
 		n = (TS_STREAM_ELEM *)(p->next);
-		free(p);
+		mem_free(&(prv->mem), p);
 		p = n;
 	}
 
@@ -2692,7 +5076,11 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 {
 	intptr_t m;
 	int n;
+	int a;
+	int32_t huge;
+	int32_t kind;
 	uint8_t *p;
+	uint8_t *b;
 
 	if(buf->max >= size){
 		return 1;
@@ -2708,9 +5096,41 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 		n += n;
 	}
 
-	p = (uint8_t *)malloc(n);
+	if( (buf->limit > 0) && (n > buf->limit) && (size <= buf->limit) ){
+		/* doubling would overshoot the memory limit */
+		n = (int)buf->limit;
+	}
+
+	huge = buf->option & ARIB_STD_B25_WORK_BUFFER_HUGE_PAGE;
+
+	p = NULL;
+	b = NULL;
+	kind = buf->kind;
+	if(kind != TS_WORK_BUFFER_FLAT){
+		a = huge ? TS_HUGE_PAGE_UNIT : TS_MIRROR_UNIT;
+		n = (n + (a-1)) & ~(a-1);
+		p = map_mirror(n, huge);
+		if(p != NULL){
+			kind = TS_WORK_BUFFER_MIRROR;
+		}else{
+			/* not supported or out of address space - stay flat */
+			kind = TS_WORK_BUFFER_FLAT;
+		}
+	}
+	if( (p == NULL) && huge ){
+		n = (n + (TS_HUGE_PAGE_UNIT-1)) & ~(TS_HUGE_PAGE_UNIT-1);
+		p = map_huge(n);
+	}
 	if(p == NULL){
-		return 0;
+		a = 0;
+		if(buf->option & ARIB_STD_B25_WORK_BUFFER_ALIGNED){
+			a = TS_WORK_BUFFER_ALIGN-1;
+		}
+		b = (uint8_t *)mem_malloc(buf->mem, n+a);
+		if(b == NULL){
+			return 0;
+		}
+		p = (uint8_t *)(((uintptr_t)b + a) & ~((uintptr_t)a));
 	}
 
 	m = 0;
@@ -2719,10 +5139,11 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 		if(m > 0){
 			memcpy(p, buf->head, m);
 		}
-		free(buf->pool);
-		buf->pool = NULL;
+		free_work_pool(buf);
 	}
 
+	buf->kind = kind;
+	buf->base = b;
 	buf->pool = p;
 	buf->head = p;
 	buf->tail = p+m;
@@ -2733,25 +5154,78 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 
 static int append_work_buffer(TS_WORK_BUFFER *buf, uint8_t *data, int32_t size)
 {
-	intptr_t m;
+	uint8_t *p;
 
 	if(size < 1){
 		/* ignore - do nothing */
 		return 1;
 	}
 
-	m = buf->tail - buf->pool;
+	p = extend_work_buffer(buf, size);
+	if(p == NULL){
+		return 0;
+	}
+
+	if(p != data){
+		/* zero copy output may trail its own input */
+		memmove(p, data, size);
+	}
+
+	return 1;
+}
+
+static uint8_t *extend_work_buffer(TS_WORK_BUFFER *buf, int32_t size)
+{
+	intptr_t m;
+	uint8_t *r;
+
+	if(buf->kind == TS_WORK_BUFFER_MIRROR){
+		/* free space is the max bytes behind head, wrapping included */
+		if( buf->head >= (buf->pool + buf->max) ){
+			buf->head -= buf->max;
+			buf->tail -= buf->max;
+		}
+		m = buf->tail - buf->head;
+	}else{
+		m = buf->tail - buf->pool;
+	}
 
 	if( (m+size) > buf->max ){
 		if(!reserve_work_buffer(buf, m+size)){
-			return 0;
+			return NULL;
 		}
 	}
 
-	memcpy(buf->tail, data, size);
+	r = buf->tail;
 	buf->tail += size;
 
-	return 1;
+	return r;
+}
+
+static void consume_work_buffer(TS_WORK_BUFFER *buf, uint8_t *curr)
+{
+	intptr_t m,n;
+
+	if(buf->kind == TS_WORK_BUFFER_MIRROR){
+		/* the second mapping shows the same bytes, only rewind pointers */
+		buf->head = curr;
+		if( buf->head >= (buf->pool + buf->max) ){
+			buf->head -= buf->max;
+			buf->tail -= buf->max;
+		}
+		return;
+	}
+
+	m = curr - buf->pool;
+	n = buf->tail - curr;
+	if( (n < 1024) || (m > (buf->max/2) ) ){
+		if(n > 0)
+			memmove(buf->pool, curr, n);
+		buf->head = buf->pool;
+		buf->tail = buf->pool+n;
+	}else{
+		buf->head = curr;
+	}
 }
 
 static void reset_work_buffer(TS_WORK_BUFFER *buf)
@@ -2763,7 +5237,10 @@ static void reset_work_buffer(TS_WORK_BUFFER *buf)
 static void release_work_buffer(TS_WORK_BUFFER *buf)
 {
 	if(buf->pool != NULL){
-		free(buf->pool);
+		free_work_pool(buf);
+		if(buf->kind == TS_WORK_BUFFER_MIRROR){
+			buf->kind = TS_WORK_BUFFER_RING;
+		}
 	}
 	buf->pool = NULL;
 	buf->head = NULL;
@@ -2771,6 +5248,163 @@ static void release_work_buffer(TS_WORK_BUFFER *buf)
 	buf->max = 0;
 }
 
+static void free_work_pool(TS_WORK_BUFFER *buf)
+{
+	if(buf->kind == TS_WORK_BUFFER_MIRROR){
+		unmap_mirror(buf->pool, buf->max);
+	}else if(buf->base != NULL){
+		mem_free(buf->mem, buf->base);
+	}else{
+		unmap_huge(buf->pool, buf->max);
+	}
+	buf->pool = NULL;
+	buf->base = NULL;
+}
+
+static uint8_t *map_mirror(intptr_t size, int32_t huge)
+{
+#if defined(_WIN32)
+	int i;
+	HANDLE h;
+	uint8_t *p;
+
+	h = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, NULL);
+	if(h == NULL){
+		return NULL;
+	}
+
+	/* the reserved range may be taken by another thread before it is mapped */
+	for(i=0;i<8;i++){
+		p = (uint8_t *)VirtualAlloc(NULL, size*2, MEM_RESERVE, PAGE_NOACCESS);
+		if(p == NULL){
+			break;
+		}
+		VirtualFree(p, 0, MEM_RELEASE);
+		if(MapViewOfFileEx(h, FILE_MAP_ALL_ACCESS, 0, 0, size, p) != p){
+			continue;
+		}
+		if(MapViewOfFileEx(h, FILE_MAP_ALL_ACCESS, 0, 0, size, p+size) != (p+size)){
+			UnmapViewOfFile(p);
+			continue;
+		}
+		CloseHandle(h);
+		return p;
+	}
+
+	CloseHandle(h);
+	return NULL;
+#elif defined(TS_MIRROR_MEMFD)
+	int fd;
+	uint8_t *p;
+
+	fd = (int)syscall(SYS_memfd_create, "aribb25", 1 /* MFD_CLOEXEC */);
+	if(fd < 0){
+		return NULL;
+	}
+	if(ftruncate(fd, size) != 0){
+		close(fd);
+		return NULL;
+	}
+
+	p = reserve_aligned(size*2, huge ? TS_HUGE_PAGE_UNIT : 0);
+	if(p == NULL){
+		close(fd);
+		return NULL;
+	}
+	if( (mmap(p, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) ||
+	    (mmap(p+size, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) ){
+		munmap(p, size*2);
+		close(fd);
+		return NULL;
+	}
+
+	close(fd);
+
+	#if defined(TS_HUGE_PAGE_MADVISE)
+	if(huge){
+		/* only honoured when shmem transparent huge pages are enabled */
+		madvise(p, size*2, MADV_HUGEPAGE);
+	}
+	#endif
+
+	return p;
+#else
+	return NULL;
+#endif
+}
+
+static void unmap_mirror(uint8_t *p, intptr_t size)
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(p);
+	UnmapViewOfFile(p+size);
+#elif defined(TS_MIRROR_MEMFD)
+	munmap(p, size*2);
+#endif
+}
+
+static uint8_t *map_huge(intptr_t size)
+{
+#if defined(TS_HUGE_PAGE_MADVISE)
+	uint8_t *p;
+
+	p = reserve_aligned(size, TS_HUGE_PAGE_UNIT);
+	if(p == NULL){
+		return NULL;
+	}
+	if(mmap(p, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED){
+		munmap(p, size);
+		return NULL;
+	}
+
+	madvise(p, size, MADV_HUGEPAGE);
+
+	return p;
+#else
+	/* large pages need a privilege on Windows, fall back to aligned heap */
+	return NULL;
+#endif
+}
+
+static void unmap_huge(uint8_t *p, intptr_t size)
+{
+#if defined(TS_HUGE_PAGE_MADVISE)
+	munmap(p, size);
+#endif
+}
+
+#if defined(__linux__)
+static uint8_t *reserve_aligned(intptr_t size, intptr_t align)
+{
+	uint8_t *p;
+	uint8_t *q;
+
+	if(align == 0){
+		p = (uint8_t *)mmap(NULL, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED){
+			return NULL;
+		}
+		return p;
+	}
+
+	/* over-reserve and trim so that the range starts on an align boundary */
+	p = (uint8_t *)mmap(NULL, size+align, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		return NULL;
+	}
+
+	q = (uint8_t *)(((uintptr_t)p + (align-1)) & ~((uintptr_t)(align-1)));
+	if(q > p){
+		munmap(p, q-p);
+	}
+	if( (p+align) > q ){
+		munmap(q+size, (p+align)-q);
+	}
+
+	return q;
+}
+#endif
+
 static void extract_ts_header(TS_HEADER *dst, uint8_t *src)
 {
 	dst->sync                         =  src[0];
@@ -2799,13 +5433,73 @@ static void extract_emm_fixed_part(EMM_FIXED_PART *dst, uint8_t *src)
 	dst->expiration_date               = (src[11]<<8)|src[12];
 }
 
+static uint32_t sync_mask32(uint8_t *p)
+{
+#if defined(TS_SYNC_SSE2)
+	__m128i s,a,b;
+
+	s = _mm_set1_epi8(0x47);
+	a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), s);
+	b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+16)), s);
+
+	return ((uint32_t)_mm_movemask_epi8(a)) | (((uint32_t)_mm_movemask_epi8(b)) << 16);
+#else
+	int i;
+	uint32_t r;
+
+	r = 0;
+	for(i=0;i<32;i++){
+		if(p[i] == 0x47){
+			r |= ((uint32_t)1 << i);
+		}
+	}
+
+	return r;
+#endif
+}
+
+static int first_bit32(uint32_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(v);
+#elif defined(_MSC_VER)
+	unsigned long r;
+	_BitScanForward(&r, v);
+	return (int)r;
+#else
+	int r;
+
+	r = 0;
+	while( (v & 1) == 0 ){
+		v >>= 1;
+		r += 1;
+	}
+
+	return r;
+#endif
+}
+
 static uint8_t *resync(uint8_t *head, uint8_t *tail, int32_t unit_size)
 {
 	int i;
+	uint32_t mask;
 	unsigned char *buf;
 
 	buf = head;
 	tail -= unit_size * 8;
+
+	/* 32 candidates at once, a bit survives if all 8 strides hit 0x47 */
+	while( (buf+31) <= tail ){
+		mask = sync_mask32(buf);
+		for(i=1;(i<8) && (mask != 0);i++){
+			mask &= sync_mask32(buf+unit_size*i);
+		}
+		if(mask != 0){
+			return buf + first_bit32(mask);
+		}
+		buf += 32;
+	}
+
 	while( buf <= tail ){
 		if(buf[0] == 0x47){
 			for(i=1;i<8;i++){
@@ -2826,10 +5520,39 @@ static uint8_t *resync(uint8_t *head, uint8_t *tail, int32_t unit_size)
 static uint8_t *resync_force(uint8_t *head, uint8_t *tail, int32_t unit_size)
 {
 	int i;
-	intptr_t n;
+	intptr_t n,o,rest;
+	uint32_t mask;
 	unsigned char *buf;
 
 	buf = head;
+
+	/**
+	 32 candidates at once, candidate buf+i has to hit 0x47 on every
+	 stride k with (buf+i+(k+1)*unit_size) <= tail
+	 */
+	while( (buf+31) <= (tail-188) ){
+		rest = tail - buf;
+		mask = sync_mask32(buf);
+		for(o=unit_size;mask != 0;o+=unit_size){
+			if( (o+unit_size) > rest ){
+				break;
+			}
+			if( (o+unit_size+31) <= rest ){
+				mask &= sync_mask32(buf+o);
+				continue;
+			}
+			for(i=0;i<32;i++){
+				if( ((o+unit_size+i) <= rest) && (buf[o+i] != 0x47) ){
+					mask &= ~((uint32_t)1 << i);
+				}
+			}
+		}
+		if(mask != 0){
+			return buf + first_bit32(mask);
+		}
+		buf += 32;
+	}
+
 	while( buf <= (tail-188) ){
 		if(buf[0] == 0x47){
 			n = (tail - buf) / unit_size;
@@ -2850,3 +5573,16 @@ static uint8_t *resync_force(uint8_t *head, uint8_t *tail, int32_t unit_size)
 
 	return NULL;
 }
+
+static uint32_t get_msec_clock(void)
+{
+#if defined(_WIN32)
+	return (uint32_t)GetTickCount();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint32_t)ts.tv_sec)*1000 + (uint32_t)(ts.tv_nsec/1000000);
+#endif
+}
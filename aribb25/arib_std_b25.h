@@ -1,9 +1,37 @@
 #ifndef ARIB_STD_B25_H
 #define ARIB_STD_B25_H
 
+#include <stddef.h>
+
 #include "portable.h"
 #include "b_cas_card.h"
 
+/**
+ reaches the work buffers, section parsers, MULTI2 instances and the
+ program/decryptor structures. callbacks behave as malloc()/realloc()/
+ free() - reallocate() with a NULL pointer allocates, deallocate() is
+ never called with NULL. private_data is passed back as is, the
+ allocator is copied by create_arib_std_b25_ex() but private_data must
+ outlive the instance
+ */
+typedef struct {
+
+	void *private_data;
+
+	void *(* allocate)(void *private_data, size_t size);
+	void *(* reallocate)(void *private_data, void *ptr, size_t size);
+	void  (* deallocate)(void *private_data, void *ptr);
+
+} ARIB_STD_B25_ALLOCATOR;
+
+/* set_work_buffer_option() flags */
+#define ARIB_STD_B25_WORK_BUFFER_ALIGNED    (0x0001)
+#define ARIB_STD_B25_WORK_BUFFER_HUGE_PAGE  (0x0002)
+
+/* set_delay_line() units */
+#define ARIB_STD_B25_DELAY_LINE_PACKETS     (0)
+#define ARIB_STD_B25_DELAY_LINE_MSEC        (1)
+
 typedef struct {
 	uint8_t *data;
 	uint32_t  size;
@@ -48,6 +76,65 @@ typedef struct {
 
 	int (*withdraw)(void *std_b25, ARIB_STD_B25_BUFFER *buf);
 
+	/**
+	 zero copy: once PAT/PMT/ECM are known, put() decrypts in the caller's
+	 buffer and get() returns spans of it - call get() until it returns an
+	 empty buffer, the caller's buffer must stay untouched until then.
+	 a failed put() leaves the caller's buffer as it was
+	 */
+	int (* set_zero_copy)(void *std_b25, int32_t on);
+
+	/**
+	 preallocation: bitrate (bit/s) sizes the work buffers, spare programs,
+	 decryptors, section parsers and MULTI2 instances are created up front
+	 and recycled, so put()/get() stop calling malloc() once warmed up.
+	 reset() keeps the setting, 0 releases the spares
+	 */
+	int (* set_preallocation)(void *std_b25, int32_t bitrate);
+
+	/**
+	 work buffer option: ALIGNED starts the input/output buffers on 64 byte
+	 boundaries, HUGE_PAGE (implies ALIGNED) also maps them in 2MB units
+	 with MADV_HUGEPAGE where available, ignored with a custom allocator.
+	 used from the next allocation, reset() releases the buffers
+	 */
+	int (* set_work_buffer_option)(void *std_b25, int32_t option);
+
+	/**
+	 memory limit: size (bytes, 0 - none, else 1MB or more) caps the data
+	 held in the work buffers. put() then takes only the leading bytes that
+	 fit, shrinks buf->size to them and returns WARN_EXCEED_MEMORY_LIMIT -
+	 call get() and put the rest again. waiting for PAT/PMT/ECM fails with
+	 the NO_*_IN_HEAD errors once the input reaches the limit
+	 */
+	int (* set_memory_limit)(void *std_b25, int32_t size);
+
+	/**
+	 low latency start: on (0 - off) outputs clear packets right away while
+	 PAT/PMT/ECM are still searched. a scrambled packet holds back itself
+	 and every later packet of its PID until the keys are ready, so the
+	 order is kept inside each PID but not across PIDs
+	 */
+	int (* set_low_latency)(void *std_b25, int32_t on);
+
+	/**
+	 asynchronous ECM: ECMs are sent to the card from a worker thread
+	 while the packets go on. depth (0 - off) bounds the scrambled packets
+	 that wait for a key after a parity switch, put() blocks on the card
+	 once it is reached. get() returns the output only up to the first
+	 waiting packet, so the order is kept. zero copy is not used meanwhile
+	 */
+	int (* set_async_ecm)(void *std_b25, int32_t depth);
+
+	/**
+	 delay line: get() keeps back the last length (0 - off) packets, or
+	 the output of the last length milliseconds of put() calls. scrambled
+	 packets left undecrypted for want of a key are decrypted in place
+	 if the key lands while they are still kept. flush() releases the
+	 whole line, zero copy is not used meanwhile
+	 */
+	int (* set_delay_line)(void *std_b25, int32_t length, int32_t unit);
+
 } ARIB_STD_B25;
 
 #ifdef __cplusplus
@@ -55,6 +142,7 @@ extern "C" {
 #endif
 
 extern ARIB_STD_B25 *create_arib_std_b25(void);
+extern ARIB_STD_B25 *create_arib_std_b25_ex(const ARIB_STD_B25_ALLOCATOR *mem);
 
 #ifdef __cplusplus
 }
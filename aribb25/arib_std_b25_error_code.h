@@ -24,5 +24,6 @@
 #define ARIB_STD_B25_WARN_PAT_NOT_COMPLETE         4
 #define ARIB_STD_B25_WARN_PMT_NOT_COMPLETE         5
 #define ARIB_STD_B25_WARN_ECM_NOT_COMPLETE         6
+#define ARIB_STD_B25_WARN_EXCEED_MEMORY_LIMIT      7
 
 #endif /* ARIB_STD_B25_ERROR_CODE_H */
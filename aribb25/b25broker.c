@@ -0,0 +1,960 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "b_cas_card.h"
+#include "b_cas_card_error_code.h"
+#include "b_cas_broker.h"
+#include "ecm_cache.h"
+
+#if !defined(MSG_NOSIGNAL)
+	#define MSG_NOSIGNAL 0
+#endif
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define BROKER_CLIENT_MAX   (64)
+#define BROKER_QUEUE_MAX    (8)  /* requests read but not answered, per client */
+#define BROKER_RECENT_MAX   (32)
+#define BROKER_RECENT_SEC   (10) /* a card answer stands in for repeats this long */
+#define BROKER_WORKER_MAX   (8)  /* card calls at once, one per pool reader */
+
+#define JOB_QUEUED   (1)
+#define JOB_RUNNING  (2)
+#define JOB_DONE     (3)
+
+typedef struct {
+	const char *path;
+	const char *cache;
+	int32_t     expire;
+	int32_t     pool;
+	int32_t     verbose;
+} OPTION;
+
+typedef struct {
+	uint32_t    id;
+	int32_t     type;
+	int32_t     len;
+	uint8_t     data[B_CAS_BROKER_DATA_MAX];
+} REQUEST;
+
+typedef struct {
+	int         fd;
+	uint32_t    serial;  /* tells a new client in the same slot apart */
+	int32_t     in_len;
+	uint8_t     in[B_CAS_BROKER_REQUEST_HEAD_SIZE+B_CAS_BROKER_DATA_MAX];
+	int32_t     count;
+	REQUEST     req[BROKER_QUEUE_MAX];
+} CLIENT;
+
+typedef struct {
+	int32_t     type;    /* 0 - unused */
+	int32_t     len;
+	uint8_t     data[B_CAS_BROKER_DATA_MAX];
+	time_t      stamp;
+	int32_t     code;
+	int32_t     size;
+	uint8_t     res[20];
+} RECENT;
+
+typedef struct {
+	int32_t     used;    /* 0 - free, poll loop only */
+	int32_t     state;   /* JOB_XXX, under BROKER::lock */
+	int32_t     client;
+	uint32_t    serial;
+	REQUEST     req;
+	int32_t     code;
+	int32_t     size;
+	uint8_t     res[20];
+} JOB;
+
+typedef struct {
+
+	B_CAS_CARD *bcas;
+
+	uint8_t     stat[B_CAS_BROKER_INIT_STATUS_SIZE];
+	uint8_t    *id;
+	int32_t     id_size;
+	uint8_t    *pwc;
+	int32_t     pwc_size;
+
+	int         listen_fd;
+	CLIENT     *client[BROKER_CLIENT_MAX];
+	int32_t     turn;    /* the client served last */
+
+	RECENT      recent[BROKER_RECENT_MAX];
+	int32_t     recent_next;
+
+	uint32_t    serial;
+
+	/* card calls run on the workers, the poll loop never waits for one */
+	JOB         job[BROKER_WORKER_MAX];
+	pthread_t   thread[BROKER_WORKER_MAX];
+	int32_t     workers; /* jobs in use, one per thread */
+	int32_t     threads; /* started */
+	int32_t     stop;
+	int         notify[2]; /* a finished job wakes poll() */
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+
+	int64_t     card_calls;
+	int64_t     coalesced;
+
+} BROKER;
+
+static volatile sig_atomic_t quit;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void show_usage();
+static int parse_arg(OPTION *dst, int argc, char **argv);
+static void on_signal(int sig);
+
+static int setup_card(BROKER *b, OPTION *opt);
+static int setup_socket(BROKER *b, OPTION *opt);
+static int setup_workers(BROKER *b, OPTION *opt);
+static void run_broker(BROKER *b, OPTION *opt);
+static void teardown_broker(BROKER *b, OPTION *opt);
+
+static void accept_client(BROKER *b);
+static void read_client(BROKER *b, int idx);
+static void drop_client(BROKER *b, int idx);
+static int next_client(BROKER *b);
+static void dispatch_request(BROKER *b, int idx);
+static void finish_jobs(BROKER *b);
+static void answer(BROKER *b, int idx, uint32_t id, int32_t code, uint8_t *data, int size);
+static void answer_queued(BROKER *b, REQUEST *req, int32_t code, uint8_t *data, int size);
+static RECENT *find_recent(BROKER *b, REQUEST *req);
+static void add_recent(BROKER *b, REQUEST *req, int32_t code, uint8_t *data, int size);
+static int is_running(BROKER *b, REQUEST *req);
+
+static void *run_worker(void *arg);
+static void call_card(BROKER *b, JOB *job);
+
+static uint32_t load_be_uint32(uint8_t *p);
+static void store_be_uint32(uint8_t *p, uint32_t v);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ main
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+int main(int argc, char **argv)
+{
+	int n;
+	OPTION opt;
+	BROKER b;
+
+	struct sigaction sa;
+
+	n = parse_arg(&opt, argc, argv);
+	if(n != argc){
+		show_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.listen_fd = -1;
+	b.notify[0] = -1;
+	b.notify[1] = -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if( setup_card(&b, &opt) && setup_socket(&b, &opt) && setup_workers(&b, &opt) ){
+		run_broker(&b, &opt);
+	}
+
+	teardown_broker(&b, &opt);
+
+	return quit ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void show_usage()
+{
+	fprintf(stderr, "b25broker - B-CAS card broker for b25 / libaribb25\n");
+	fprintf(stderr, "usage: b25broker [options]\n");
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -s socket path (default=%s)\n", B_CAS_BROKER_DEFAULT_PATH);
+	fprintf(stderr, "  -c ECM cache file (default=none)\n");
+	fprintf(stderr, "  -e ECM cache expire in seconds (default=0, never)\n");
+	fprintf(stderr, "  -p reader\n");
+	fprintf(stderr, "     0: first card found (default)\n");
+	fprintf(stderr, "     1: every card sharing its system key, one call per reader at once\n");
+	fprintf(stderr, "  -v verbose\n");
+	fprintf(stderr, "     0: silent\n");
+	fprintf(stderr, "     1: show card calls on exit (default)\n");
+	fprintf(stderr, "\n");
+}
+
+static int parse_arg(OPTION *dst, int argc, char **argv)
+{
+	int i;
+	char c,*v;
+
+	dst->path = B_CAS_BROKER_DEFAULT_PATH;
+	dst->cache = NULL;
+	dst->expire = 0;
+	dst->pool = 0;
+	dst->verbose = 1;
+
+	for(i=1;i<argc;i++){
+		if(argv[i][0] != '-'){
+			break;
+		}
+		c = argv[i][1];
+		if(argv[i][2]){
+			v = argv[i]+2;
+		}else if(i+1 < argc){
+			v = argv[i+1];
+			i += 1;
+		}else{
+			return -1;
+		}
+		switch(c){
+		case 'c':
+			dst->cache = v;
+			break;
+		case 'e':
+			dst->expire = atoi(v);
+			break;
+		case 'p':
+			dst->pool = atoi(v);
+			break;
+		case 's':
+			dst->path = v;
+			break;
+		case 'v':
+			dst->verbose = atoi(v);
+			break;
+		default:
+			fprintf(stderr, "error - unknown option '-%c'\n", c);
+			return -1;
+		}
+	}
+
+	return i;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	quit = 1;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ broker
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static int setup_card(BROKER *b, OPTION *opt)
+{
+	int code,i;
+	uint8_t *p;
+
+	B_CAS_CARD *card;
+	B_CAS_INIT_STATUS is;
+	B_CAS_ID id;
+	B_CAS_PWR_ON_CTRL_INFO pwc;
+	B_CAS_PWR_ON_CTRL *w;
+
+	if(opt->pool){
+		card = create_b_cas_card_pool();
+	}else{
+		card = create_b_cas_card();
+	}
+	if(card == NULL){
+		fprintf(stderr, "error - failed on create_b_cas_card()\n");
+		return 0;
+	}
+
+	if(opt->cache != NULL){
+		b->bcas = create_ecm_cache(card, opt->cache, opt->expire, 0);
+		if(b->bcas == NULL){
+			fprintf(stderr, "error - failed on create_ecm_cache()\n");
+			card->release(card);
+			return 0;
+		}
+	}else{
+		b->bcas = card;
+	}
+
+	code = b->bcas->init(b->bcas);
+	if(code < 0){
+		fprintf(stderr, "error - failed on B_CAS_CARD::init() : code=%d\n", code);
+		return 0;
+	}
+
+	/* these do not change while the card stays in, answered from here */
+	code = b->bcas->get_init_status(b->bcas, &is);
+	if(code < 0){
+		fprintf(stderr, "error - failed on B_CAS_CARD::get_init_status() : code=%d\n", code);
+		return 0;
+	}
+	memcpy(b->stat, is.system_key, 32);
+	memcpy(b->stat+32, is.init_cbc, 8);
+	store_be_uint32(b->stat+40, (uint32_t)((uint64_t)is.bcas_card_id >> 32));
+	store_be_uint32(b->stat+44, (uint32_t)is.bcas_card_id);
+	store_be_uint32(b->stat+48, (uint32_t)is.card_status);
+	store_be_uint32(b->stat+52, (uint32_t)is.ca_system_id);
+
+	code = b->bcas->get_id(b->bcas, &id);
+	if( (code < 0) || (id.count > B_CAS_BROKER_DATA_MAX/8) ){
+		fprintf(stderr, "error - failed on B_CAS_CARD::get_id() : code=%d\n", code);
+		return 0;
+	}
+	b->id = (uint8_t *)malloc(8*id.count + 1);
+	if(b->id == NULL){
+		return 0;
+	}
+	for(i=0;i<id.count;i++){
+		store_be_uint32(b->id+8*i, (uint32_t)((uint64_t)id.data[i] >> 32));
+		store_be_uint32(b->id+8*i+4, (uint32_t)id.data[i]);
+	}
+	b->id_size = 8*id.count;
+
+	code = b->bcas->get_pwr_on_ctrl(b->bcas, &pwc);
+	if( (code < 0) || (pwc.count > B_CAS_BROKER_DATA_MAX/B_CAS_BROKER_PWR_ON_CTRL_SIZE) ){
+		fprintf(stderr, "error - failed on B_CAS_CARD::get_pwr_on_ctrl() : code=%d\n", code);
+		return 0;
+	}
+	b->pwc = (uint8_t *)malloc(B_CAS_BROKER_PWR_ON_CTRL_SIZE*pwc.count + 1);
+	if(b->pwc == NULL){
+		return 0;
+	}
+	p = b->pwc;
+	for(i=0;i<pwc.count;i++){
+		w = pwc.data + i;
+		store_be_uint32(p+ 0, (uint32_t)w->s_yy);
+		store_be_uint32(p+ 4, (uint32_t)w->s_mm);
+		store_be_uint32(p+ 8, (uint32_t)w->s_dd);
+		store_be_uint32(p+12, (uint32_t)w->l_yy);
+		store_be_uint32(p+16, (uint32_t)w->l_mm);
+		store_be_uint32(p+20, (uint32_t)w->l_dd);
+		store_be_uint32(p+24, (uint32_t)w->hold_time);
+		store_be_uint32(p+28, (uint32_t)w->broadcaster_group_id);
+		store_be_uint32(p+32, (uint32_t)w->network_id);
+		store_be_uint32(p+36, (uint32_t)w->transport_id);
+		p += B_CAS_BROKER_PWR_ON_CTRL_SIZE;
+	}
+	b->pwc_size = B_CAS_BROKER_PWR_ON_CTRL_SIZE*pwc.count;
+
+	return 1;
+}
+
+static int setup_socket(BROKER *b, OPTION *opt)
+{
+	int fd,n;
+	mode_t mask;
+	struct sockaddr_un addr;
+
+	if(strlen(opt->path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "error - socket path too long [%s]\n", opt->path);
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, opt->path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0){
+		fprintf(stderr, "error - failed on socket()\n");
+		return 0;
+	}
+
+	/* a socket nobody answers on is left over from a broker that died */
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0){
+		fprintf(stderr, "error - another broker is listening on %s\n", opt->path);
+		close(fd);
+		return 0;
+	}
+	unlink(opt->path);
+
+	/* 0660 from the start, only the owner and its group reach the card */
+	mask = umask(S_IXUSR|S_IRWXO|S_IXGRP);
+	n = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if( (n != 0) || (listen(fd, 16) != 0) ){
+		fprintf(stderr, "error - failed on bind(%s)\n", opt->path);
+		close(fd);
+		return 0;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	b->listen_fd = fd;
+
+	return 1;
+}
+
+static int setup_workers(BROKER *b, OPTION *opt)
+{
+	int i,n;
+
+	/* a single card takes one call at a time, a pool one per reader;
+	   every pool card has an id, extra workers just wait in the pool */
+	n = 1;
+	if(opt->pool){
+		n = b->id_size / 8;
+		if(n > BROKER_WORKER_MAX){
+			n = BROKER_WORKER_MAX;
+		}
+		if(n < 1){
+			n = 1;
+		}
+	}
+
+	if(pipe(b->notify) != 0){
+		fprintf(stderr, "error - failed on pipe()\n");
+		b->notify[0] = -1;
+		b->notify[1] = -1;
+		return 0;
+	}
+	fcntl(b->notify[0], F_SETFL, fcntl(b->notify[0], F_GETFL) | O_NONBLOCK);
+	fcntl(b->notify[1], F_SETFL, fcntl(b->notify[1], F_GETFL) | O_NONBLOCK);
+
+	pthread_mutex_init(&(b->lock), NULL);
+	pthread_cond_init(&(b->wake), NULL);
+
+	b->workers = n;
+	for(i=0;i<n;i++){
+		if(pthread_create(b->thread+i, NULL, run_worker, b) != 0){
+			fprintf(stderr, "error - failed on pthread_create()\n");
+			return 0;
+		}
+		b->threads += 1;
+	}
+
+	return 1;
+}
+
+static void run_broker(BROKER *b, OPTION *opt)
+{
+	int i,k,n,m;
+	int idx[BROKER_CLIENT_MAX];
+
+	struct pollfd pfd[BROKER_CLIENT_MAX+2];
+
+	while(!quit){
+		pfd[0].fd = b->listen_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = b->notify[0];
+		pfd[1].events = POLLIN;
+		n = 2;
+		for(i=0;i<BROKER_CLIENT_MAX;i++){
+			if( (b->client[i] == NULL) || (b->client[i]->count >= BROKER_QUEUE_MAX) ){
+				continue;
+			}
+			pfd[n].fd = b->client[i]->fd;
+			pfd[n].events = POLLIN;
+			idx[n-2] = i;
+			n += 1;
+		}
+
+		/* with work to hand out only pick up what is already there */
+		m = poll(pfd, n, (next_client(b) >= 0) ? 0 : -1);
+		if(m < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "error - failed on poll()\n");
+			break;
+		}
+
+		if(pfd[1].revents & POLLIN){
+			finish_jobs(b);
+		}
+		for(i=2;i<n;i++){
+			if(pfd[i].revents){
+				read_client(b, idx[i-2]);
+			}
+		}
+		if(pfd[0].revents & POLLIN){
+			accept_client(b);
+		}
+
+		/* one request per round, the sockets are read in between */
+		k = next_client(b);
+		if(k >= 0){
+			dispatch_request(b, k);
+		}
+	}
+
+	if(opt->verbose){
+		fprintf(stderr, "card calls %"PRId64", coalesced %"PRId64"\n", b->card_calls, b->coalesced);
+	}
+}
+
+static void teardown_broker(BROKER *b, OPTION *opt)
+{
+	int i;
+
+	if(b->notify[0] >= 0){
+		/* a worker inside the card finishes that call first */
+		pthread_mutex_lock(&(b->lock));
+		b->stop = 1;
+		pthread_cond_broadcast(&(b->wake));
+		pthread_mutex_unlock(&(b->lock));
+		for(i=0;i<b->threads;i++){
+			pthread_join(b->thread[i], NULL);
+		}
+		pthread_cond_destroy(&(b->wake));
+		pthread_mutex_destroy(&(b->lock));
+		close(b->notify[0]);
+		close(b->notify[1]);
+		b->notify[0] = -1;
+		b->notify[1] = -1;
+	}
+
+	for(i=0;i<BROKER_CLIENT_MAX;i++){
+		if(b->client[i] != NULL){
+			drop_client(b, i);
+		}
+	}
+
+	if(b->listen_fd >= 0){
+		close(b->listen_fd);
+		unlink(opt->path);
+		b->listen_fd = -1;
+	}
+
+	if(b->bcas != NULL){
+		b->bcas->release(b->bcas);
+		b->bcas = NULL;
+	}
+
+	free(b->pwc);
+	free(b->id);
+}
+
+static void accept_client(BROKER *b)
+{
+	int i,fd;
+
+	while(1){
+		fd = accept(b->listen_fd, NULL, NULL);
+		if(fd < 0){
+			return;
+		}
+
+		for(i=0;i<BROKER_CLIENT_MAX;i++){
+			if(b->client[i] == NULL){
+				break;
+			}
+		}
+		if(i == BROKER_CLIENT_MAX){
+			close(fd);
+			continue;
+		}
+
+		b->client[i] = (CLIENT *)calloc(1, sizeof(CLIENT));
+		if(b->client[i] == NULL){
+			close(fd);
+			continue;
+		}
+
+		/* a client that stops reading is dropped, never waited for */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		b->client[i]->fd = fd;
+		b->serial += 1;
+		b->client[i]->serial = b->serial;
+	}
+}
+
+static void read_client(BROKER *b, int idx)
+{
+	int n,len;
+	ssize_t r;
+
+	CLIENT *c;
+	REQUEST *req;
+
+	c = b->client[idx];
+
+	while(c->count < BROKER_QUEUE_MAX){
+		if(c->in_len < B_CAS_BROKER_REQUEST_HEAD_SIZE){
+			n = B_CAS_BROKER_REQUEST_HEAD_SIZE - c->in_len;
+		}else{
+			len = (c->in[5] << 8) | c->in[6];
+			if(len > B_CAS_BROKER_DATA_MAX){
+				drop_client(b, idx);
+				return;
+			}
+			n = B_CAS_BROKER_REQUEST_HEAD_SIZE + len - c->in_len;
+		}
+
+		if(n > 0){
+			r = recv(c->fd, c->in+c->in_len, n, 0);
+			if(r < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				if( (errno != EAGAIN) && (errno != EWOULDBLOCK) ){
+					drop_client(b, idx);
+				}
+				return;
+			}
+			if(r == 0){
+				drop_client(b, idx);
+				return;
+			}
+			c->in_len += (int32_t)r;
+			continue;
+		}
+
+		len = c->in_len - B_CAS_BROKER_REQUEST_HEAD_SIZE;
+		req = c->req + c->count;
+		req->id = load_be_uint32(c->in);
+		req->type = c->in[4];
+		req->len = len;
+		memcpy(req->data, c->in+B_CAS_BROKER_REQUEST_HEAD_SIZE, len);
+
+		c->count += 1;
+		c->in_len = 0;
+	}
+}
+
+static void drop_client(BROKER *b, int idx)
+{
+	close(b->client[idx]->fd);
+	free(b->client[idx]);
+	b->client[idx] = NULL;
+}
+
+static int next_client(BROKER *b)
+{
+	int i,k;
+
+	for(i=0;i<b->workers;i++){
+		if(!b->job[i].used){
+			break;
+		}
+	}
+	if(i == b->workers){
+		/* every worker is out, the rest waits for one to return */
+		return -1;
+	}
+
+	/* round robin, the client after the one served last goes first;
+	   one whose section is already at the card waits for that answer */
+	for(i=1;i<=BROKER_CLIENT_MAX;i++){
+		k = (b->turn + i) % BROKER_CLIENT_MAX;
+		if( (b->client[k] != NULL) &&
+		    (b->client[k]->count > 0) &&
+		    !is_running(b, b->client[k]->req) ){
+			return k;
+		}
+	}
+
+	return -1;
+}
+
+static void dispatch_request(BROKER *b, int idx)
+{
+	int i;
+
+	CLIENT *c;
+	REQUEST req;
+	RECENT *hit;
+	JOB *job;
+
+	b->turn = idx;
+
+	c = b->client[idx];
+	memcpy(&req, c->req, sizeof(REQUEST));
+	c->count -= 1;
+	memmove(c->req, c->req+1, sizeof(REQUEST)*c->count);
+
+	switch(req.type){
+	case B_CAS_BROKER_GET_INIT_STATUS:
+		answer(b, idx, req.id, 0, b->stat, B_CAS_BROKER_INIT_STATUS_SIZE);
+		return;
+	case B_CAS_BROKER_GET_ID:
+		answer(b, idx, req.id, 0, b->id, b->id_size);
+		return;
+	case B_CAS_BROKER_GET_PWR_ON_CTRL:
+		answer(b, idx, req.id, 0, b->pwc, b->pwc_size);
+		return;
+	case B_CAS_BROKER_PROC_ECM:
+	case B_CAS_BROKER_PROC_EMM:
+		break;
+	default:
+		answer(b, idx, req.id, B_CAS_CARD_ERROR_INVALID_PARAMETER, NULL, 0);
+		return;
+	}
+
+	if(req.len < 1){
+		answer(b, idx, req.id, B_CAS_CARD_ERROR_INVALID_PARAMETER, NULL, 0);
+		return;
+	}
+
+	hit = find_recent(b, &req);
+	if(hit != NULL){
+		b->coalesced += 1;
+		answer(b, idx, req.id, hit->code, hit->res, hit->size);
+		answer_queued(b, &req, hit->code, hit->res, hit->size);
+		return;
+	}
+
+	/* next_client() made sure one is free */
+	for(i=0;i<b->workers;i++){
+		if(!b->job[i].used){
+			break;
+		}
+	}
+	job = b->job + i;
+
+	b->card_calls += 1;
+	job->used = 1;
+	job->client = idx;
+	job->serial = c->serial;
+	memcpy(&(job->req), &req, sizeof(REQUEST));
+
+	pthread_mutex_lock(&(b->lock));
+	job->state = JOB_QUEUED;
+	pthread_cond_signal(&(b->wake));
+	pthread_mutex_unlock(&(b->lock));
+}
+
+static void finish_jobs(BROKER *b)
+{
+	int i,n;
+	int32_t done[BROKER_WORKER_MAX];
+	uint8_t drain[64];
+
+	CLIENT *c;
+	JOB *job;
+
+	while(read(b->notify[0], drain, sizeof(drain)) > 0){
+		/* only a wake-up, the job states tell the rest */
+	}
+
+	pthread_mutex_lock(&(b->lock));
+	for(i=0,n=0;i<b->workers;i++){
+		if(b->job[i].used && (b->job[i].state == JOB_DONE)){
+			done[n++] = i;
+		}
+	}
+	pthread_mutex_unlock(&(b->lock));
+
+	/* a done job is not touched by its worker any more */
+	for(i=0;i<n;i++){
+		job = b->job + done[i];
+		if(job->code >= 0){
+			add_recent(b, &(job->req), job->code, job->res, job->size);
+		}
+		c = b->client[job->client];
+		if( (c != NULL) && (c->serial == job->serial) ){
+			answer(b, job->client, job->req.id, job->code, job->res, job->size);
+		}
+		/* the same section queued by others rides on this answer */
+		answer_queued(b, &(job->req), job->code, job->res, job->size);
+		job->used = 0;
+	}
+
+	pthread_mutex_lock(&(b->lock));
+	for(i=0;i<n;i++){
+		b->job[done[i]].state = 0;
+	}
+	pthread_mutex_unlock(&(b->lock));
+}
+
+static void answer(BROKER *b, int idx, uint32_t id, int32_t code, uint8_t *data, int size)
+{
+	ssize_t r;
+	uint8_t buf[B_CAS_BROKER_RESPONSE_HEAD_SIZE+B_CAS_BROKER_DATA_MAX];
+
+	store_be_uint32(buf, id);
+	store_be_uint32(buf+4, (uint32_t)code);
+	buf[8] = (uint8_t)(size >> 8);
+	buf[9] = (uint8_t)(size & 0xff);
+	if(size > 0){
+		memcpy(buf+B_CAS_BROKER_RESPONSE_HEAD_SIZE, data, size);
+	}
+
+	/* far below the socket buffer, a short write means a stuck client */
+	do{
+		r = send(b->client[idx]->fd, buf, B_CAS_BROKER_RESPONSE_HEAD_SIZE+size, MSG_NOSIGNAL);
+	}while( (r < 0) && (errno == EINTR) );
+
+	if(r != B_CAS_BROKER_RESPONSE_HEAD_SIZE+size){
+		drop_client(b, idx);
+	}
+}
+
+static void answer_queued(BROKER *b, REQUEST *req, int32_t code, uint8_t *data, int size)
+{
+	int i,j;
+
+	CLIENT *c;
+
+	for(i=0;i<BROKER_CLIENT_MAX;i++){
+		c = b->client[i];
+		if(c == NULL){
+			continue;
+		}
+		for(j=0;j<c->count;){
+			if( (c->req[j].type != req->type) ||
+			    (c->req[j].len != req->len) ||
+			    (memcmp(c->req[j].data, req->data, req->len) != 0) ){
+				j += 1;
+				continue;
+			}
+			b->coalesced += 1;
+			answer(b, i, c->req[j].id, code, data, size);
+			if(b->client[i] == NULL){
+				break;
+			}
+			c->count -= 1;
+			memmove(c->req+j, c->req+j+1, sizeof(REQUEST)*(c->count-j));
+		}
+	}
+}
+
+static RECENT *find_recent(BROKER *b, REQUEST *req)
+{
+	int i;
+	time_t now;
+
+	RECENT *r;
+
+	now = time(NULL);
+
+	for(i=0;i<BROKER_RECENT_MAX;i++){
+		r = b->recent + i;
+		if( (r->type == req->type) &&
+		    (r->len == req->len) &&
+		    (now >= r->stamp) &&
+		    ((now - r->stamp) < BROKER_RECENT_SEC) &&
+		    (memcmp(r->data, req->data, req->len) == 0) ){
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+static void add_recent(BROKER *b, REQUEST *req, int32_t code, uint8_t *data, int size)
+{
+	RECENT *r;
+
+	r = b->recent + b->recent_next;
+	b->recent_next = (b->recent_next + 1) % BROKER_RECENT_MAX;
+
+	r->type = req->type;
+	r->len = req->len;
+	memcpy(r->data, req->data, req->len);
+	r->stamp = time(NULL);
+	r->code = code;
+	r->size = size;
+	memcpy(r->res, data, size);
+}
+
+static int is_running(BROKER *b, REQUEST *req)
+{
+	int i;
+
+	JOB *job;
+
+	for(i=0;i<b->workers;i++){
+		job = b->job + i;
+		if( job->used &&
+		    (job->req.type == req->type) &&
+		    (job->req.len == req->len) &&
+		    (memcmp(job->req.data, req->data, req->len) == 0) ){
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ worker
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void *run_worker(void *arg)
+{
+	int i;
+	ssize_t r;
+	uint8_t one;
+
+	BROKER *b;
+	JOB *job;
+
+	b = (BROKER *)arg;
+	one = 1;
+
+	pthread_mutex_lock(&(b->lock));
+
+	while(!b->stop){
+		for(i=0;i<b->workers;i++){
+			if(b->job[i].state == JOB_QUEUED){
+				break;
+			}
+		}
+		if(i == b->workers){
+			pthread_cond_wait(&(b->wake), &(b->lock));
+			continue;
+		}
+
+		job = b->job + i;
+		job->state = JOB_RUNNING;
+		pthread_mutex_unlock(&(b->lock));
+
+		call_card(b, job);
+
+		pthread_mutex_lock(&(b->lock));
+		job->state = JOB_DONE;
+		do{
+			r = write(b->notify[1], &one, 1);
+		}while( (r < 0) && (errno == EINTR) );
+	}
+
+	pthread_mutex_unlock(&(b->lock));
+
+	return NULL;
+}
+
+static void call_card(BROKER *b, JOB *job)
+{
+	B_CAS_ECM_RESULT ecm;
+
+	if(job->req.type == B_CAS_BROKER_PROC_ECM){
+		job->code = b->bcas->proc_ecm(b->bcas, &ecm, job->req.data, job->req.len);
+		memcpy(job->res, ecm.scramble_key, 16);
+		store_be_uint32(job->res+16, ecm.return_code);
+		job->size = (job->code < 0) ? 0 : 20;
+	}else{
+		job->code = b->bcas->proc_emm(b->bcas, job->req.data, job->req.len);
+		job->size = 0;
+	}
+}
+
+static uint32_t load_be_uint32(uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be_uint32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >>  8);
+	p[3] = (uint8_t)(v      );
+}
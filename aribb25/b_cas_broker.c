@@ -0,0 +1,519 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "b_cas_broker.h"
+#include "b_cas_card_error_code.h"
+
+#if defined(_WIN32)
+
+B_CAS_CARD *create_b_cas_broker_card(const char *path)
+{
+	(void)path;
+	return NULL;
+}
+
+#else
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#if !defined(MSG_NOSIGNAL)
+	#define MSG_NOSIGNAL 0
+#endif
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+typedef struct {
+
+	char              *path;
+	int                fd;     /* -1 - not connected */
+
+	uint32_t           next_id;
+
+	B_CAS_INIT_STATUS  stat;
+	int32_t            has_stat;
+
+	B_CAS_ID           id;
+	int64_t            id_data[B_CAS_BROKER_DATA_MAX/8];
+
+	B_CAS_PWR_ON_CTRL_INFO pwc;
+	B_CAS_PWR_ON_CTRL  pwc_data[B_CAS_BROKER_DATA_MAX/B_CAS_BROKER_PWR_ON_CTRL_SIZE];
+
+	uint8_t            buf[B_CAS_BROKER_RESPONSE_HEAD_SIZE+B_CAS_BROKER_DATA_MAX];
+
+} B_CAS_BROKER_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_broker(void *bcas);
+static int init_b_cas_broker(void *bcas);
+static int get_init_status_b_cas_broker(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_b_cas_broker(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_b_cas_broker(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_b_cas_broker(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_b_cas_broker(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+B_CAS_CARD *create_b_cas_broker_card(const char *path)
+{
+	int n;
+
+	B_CAS_CARD *r;
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	if(path == NULL){
+		path = B_CAS_BROKER_DEFAULT_PATH;
+	}
+
+	if(strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path)){
+		return NULL;
+	}
+
+	n = sizeof(B_CAS_BROKER_PRIVATE_DATA) + sizeof(B_CAS_CARD) + (int)strlen(path) + 1;
+	prv = (B_CAS_BROKER_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD *)(prv+1);
+
+	prv->path = (char *)(r+1);
+	strcpy(prv->path, path);
+	prv->fd = -1;
+
+	prv->id.data = prv->id_data;
+	prv->pwc.data = prv->pwc_data;
+
+	r->private_data = prv;
+
+	r->release = release_b_cas_broker;
+	r->init = init_b_cas_broker;
+	r->get_init_status = get_init_status_b_cas_broker;
+	r->get_id = get_id_b_cas_broker;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_b_cas_broker;
+	r->proc_ecm = proc_ecm_b_cas_broker;
+	r->proc_emm = proc_emm_b_cas_broker;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_BROKER_PRIVATE_DATA *private_data(void *bcas);
+static void teardown(B_CAS_BROKER_PRIVATE_DATA *prv);
+static int connect_broker(B_CAS_BROKER_PRIVATE_DATA *prv);
+static int transact(B_CAS_BROKER_PRIVATE_DATA *prv, int type, uint8_t *src, int len, uint8_t **data, int *size);
+static int exchange(B_CAS_BROKER_PRIVATE_DATA *prv, uint32_t id, int type, uint8_t *src, int len, int *code, int *size);
+static int send_all(int fd, uint8_t *src, int len);
+static int recv_all(int fd, uint8_t *dst, int len);
+static uint32_t load_be_uint32(uint8_t *p);
+static void store_be_uint32(uint8_t *p, uint32_t v);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_broker(void *bcas)
+{
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	teardown(prv);
+	free(prv);
+}
+
+static int init_b_cas_broker(void *bcas)
+{
+	int r,n;
+	uint8_t *p;
+
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	teardown(prv);
+
+	if(!connect_broker(prv)){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	r = transact(prv, B_CAS_BROKER_GET_INIT_STATUS, NULL, 0, &p, &n);
+	if(r < 0){
+		return r;
+	}
+	if(n < B_CAS_BROKER_INIT_STATUS_SIZE){
+		return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+
+	memcpy(prv->stat.system_key, p, 32);
+	memcpy(prv->stat.init_cbc, p+32, 8);
+	prv->stat.bcas_card_id = ((int64_t)load_be_uint32(p+40) << 32) | load_be_uint32(p+44);
+	prv->stat.card_status = (int32_t)load_be_uint32(p+48);
+	prv->stat.ca_system_id = (int32_t)load_be_uint32(p+52);
+	prv->has_stat = 1;
+
+	return r;
+}
+
+static int get_init_status_b_cas_broker(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (stat == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(!prv->has_stat){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	memcpy(stat, &(prv->stat), sizeof(B_CAS_INIT_STATUS));
+
+	return 0;
+}
+
+static int get_id_b_cas_broker(void *bcas, B_CAS_ID *dst)
+{
+	int r,i,n;
+	uint8_t *p;
+
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(!prv->has_stat){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	r = transact(prv, B_CAS_BROKER_GET_ID, NULL, 0, &p, &n);
+	if(r < 0){
+		return r;
+	}
+
+	prv->id.count = n / 8;
+	for(i=0;i<prv->id.count;i++){
+		prv->id.data[i] = ((int64_t)load_be_uint32(p+8*i) << 32) | load_be_uint32(p+8*i+4);
+	}
+
+	memcpy(dst, &(prv->id), sizeof(B_CAS_ID));
+
+	return r;
+}
+
+static int get_pwr_on_ctrl_b_cas_broker(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	int r,i,n;
+	uint8_t *p;
+
+	B_CAS_PWR_ON_CTRL *w;
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(!prv->has_stat){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	r = transact(prv, B_CAS_BROKER_GET_PWR_ON_CTRL, NULL, 0, &p, &n);
+	if(r < 0){
+		return r;
+	}
+
+	prv->pwc.count = n / B_CAS_BROKER_PWR_ON_CTRL_SIZE;
+	for(i=0;i<prv->pwc.count;i++){
+		w = prv->pwc.data + i;
+		w->s_yy = (int32_t)load_be_uint32(p+ 0);
+		w->s_mm = (int32_t)load_be_uint32(p+ 4);
+		w->s_dd = (int32_t)load_be_uint32(p+ 8);
+		w->l_yy = (int32_t)load_be_uint32(p+12);
+		w->l_mm = (int32_t)load_be_uint32(p+16);
+		w->l_dd = (int32_t)load_be_uint32(p+20);
+		w->hold_time = (int32_t)load_be_uint32(p+24);
+		w->broadcaster_group_id = (int32_t)load_be_uint32(p+28);
+		w->network_id = (int32_t)load_be_uint32(p+32);
+		w->transport_id = (int32_t)load_be_uint32(p+36);
+		p += B_CAS_BROKER_PWR_ON_CTRL_SIZE;
+	}
+
+	memcpy(dst, &(prv->pwc), sizeof(B_CAS_PWR_ON_CTRL_INFO));
+
+	return r;
+}
+
+static int proc_ecm_b_cas_broker(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	int r,n;
+	uint8_t *p;
+
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+	    (dst == NULL) ||
+	    (src == NULL) ||
+	    (len < 1) ||
+	    (len > B_CAS_BROKER_DATA_MAX) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(!prv->has_stat){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	r = transact(prv, B_CAS_BROKER_PROC_ECM, src, len, &p, &n);
+	if(r < 0){
+		return r;
+	}
+	if(n < 20){
+		return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+
+	memcpy(dst->scramble_key, p, 16);
+	dst->return_code = load_be_uint32(p+16);
+
+	return r;
+}
+
+static int proc_emm_b_cas_broker(void *bcas, uint8_t *src, int len)
+{
+	int n;
+	uint8_t *p;
+
+	B_CAS_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+	    (src == NULL) ||
+	    (len < 1) ||
+	    (len > B_CAS_BROKER_DATA_MAX) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(!prv->has_stat){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	return transact(prv, B_CAS_BROKER_PROC_EMM, src, len, &p, &n);
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_BROKER_PRIVATE_DATA *private_data(void *bcas)
+{
+	B_CAS_BROKER_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_BROKER_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void teardown(B_CAS_BROKER_PRIVATE_DATA *prv)
+{
+	if(prv->fd >= 0){
+		close(prv->fd);
+		prv->fd = -1;
+	}
+
+	prv->has_stat = 0;
+}
+
+static int connect_broker(B_CAS_BROKER_PRIVATE_DATA *prv)
+{
+	int fd;
+	struct sockaddr_un addr;
+	struct timeval tv;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0){
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, prv->path);
+
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		close(fd);
+		return 0;
+	}
+
+	/* the decoder's packet loop waits on these calls, bound the wait */
+	tv.tv_sec = B_CAS_BROKER_TIMEOUT_MSEC / 1000;
+	tv.tv_usec = (B_CAS_BROKER_TIMEOUT_MSEC % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	prv->fd = fd;
+
+	return 1;
+}
+
+static int transact(B_CAS_BROKER_PRIVATE_DATA *prv, int type, uint8_t *src, int len, uint8_t **data, int *size)
+{
+	int n,r,retry_count;
+	uint32_t id;
+
+	id = prv->next_id++;
+
+	retry_count = 0;
+	while(1){
+		if( (prv->fd >= 0) || connect_broker(prv) ){
+			n = exchange(prv, id, type, src, len, &r, size);
+			if(n > 0){
+				break;
+			}
+			/* the broker went away, an answer on the old socket is lost */
+			close(prv->fd);
+			prv->fd = -1;
+			if(n < 0){
+				/* alive but not answering, do not wait for it twice */
+				return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+			}
+		}
+		if(retry_count > 0){
+			return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+		}
+		retry_count += 1;
+	}
+
+	*data = prv->buf + B_CAS_BROKER_RESPONSE_HEAD_SIZE;
+
+	return r;
+}
+
+static int exchange(B_CAS_BROKER_PRIVATE_DATA *prv, uint32_t id, int type, uint8_t *src, int len, int *code, int *size)
+{
+	int m,n;
+	uint8_t head[B_CAS_BROKER_REQUEST_HEAD_SIZE];
+
+	store_be_uint32(head, id);
+	head[4] = (uint8_t)type;
+	head[5] = (uint8_t)(len >> 8);
+	head[6] = (uint8_t)(len & 0xff);
+
+	if( ((m = send_all(prv->fd, head, sizeof(head))) <= 0) ||
+	    ((m = send_all(prv->fd, src, len)) <= 0) ){
+		return m;
+	}
+
+	while(1){
+		m = recv_all(prv->fd, prv->buf, B_CAS_BROKER_RESPONSE_HEAD_SIZE);
+		if(m <= 0){
+			return m;
+		}
+		n = (prv->buf[8] << 8) | prv->buf[9];
+		if(n > B_CAS_BROKER_DATA_MAX){
+			return 0;
+		}
+		m = recv_all(prv->fd, prv->buf+B_CAS_BROKER_RESPONSE_HEAD_SIZE, n);
+		if(m <= 0){
+			return m;
+		}
+		if(load_be_uint32(prv->buf) == id){
+			break;
+		}
+		/* left over from a call that gave up, skip it */
+	}
+
+	*code = (int32_t)load_be_uint32(prv->buf+4);
+	*size = n;
+
+	return 1;
+}
+
+static int send_all(int fd, uint8_t *src, int len)
+{
+	ssize_t n;
+
+	while(len > 0){
+		n = send(fd, src, len, MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ){
+				/* B_CAS_BROKER_TIMEOUT_MSEC passed */
+				return -1;
+			}
+			return 0;
+		}
+		src += n;
+		len -= (int)n;
+	}
+
+	return 1;
+}
+
+static int recv_all(int fd, uint8_t *dst, int len)
+{
+	ssize_t n;
+
+	while(len > 0){
+		n = recv(fd, dst, len, 0);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ){
+				/* B_CAS_BROKER_TIMEOUT_MSEC passed */
+				return -1;
+			}
+			return 0;
+		}
+		if(n == 0){
+			return 0;
+		}
+		dst += n;
+		len -= (int)n;
+	}
+
+	return 1;
+}
+
+static uint32_t load_be_uint32(uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be_uint32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >>  8);
+	p[3] = (uint8_t)(v      );
+}
+
+#endif /* !defined(_WIN32) */
@@ -0,0 +1,55 @@
+#ifndef B_CAS_BROKER_H
+#define B_CAS_BROKER_H
+
+#include "portable.h"
+#include "b_cas_card.h"
+
+#define B_CAS_BROKER_DEFAULT_PATH "/tmp/b25broker.sock"
+#define B_CAS_BROKER_TIMEOUT_MSEC (5000) /* per send/receive, a hung broker fails the call */
+
+/**
+ wire format between b25broker and create_b_cas_broker_card(), all
+ integers big endian like the card itself.
+
+ request  : id(4) type(1) length(2) data(length)
+ response : id(4) code(4) length(2) data(length)
+
+ code is the return value of the B_CAS_CARD method the broker called
+ (or answered from what it read at start up), responses may come back
+ in another order than the requests were sent, id tells them apart
+ */
+#define B_CAS_BROKER_REQUEST_HEAD_SIZE   (7)
+#define B_CAS_BROKER_RESPONSE_HEAD_SIZE  (10)
+#define B_CAS_BROKER_DATA_MAX            (4096)
+
+#define B_CAS_BROKER_GET_INIT_STATUS     (1)  /* -> B_CAS_BROKER_INIT_STATUS_SIZE */
+#define B_CAS_BROKER_GET_ID              (2)  /* -> 8 x count */
+#define B_CAS_BROKER_GET_PWR_ON_CTRL     (3)  /* -> B_CAS_BROKER_PWR_ON_CTRL_SIZE x count */
+#define B_CAS_BROKER_PROC_ECM            (4)  /* ECM -> scramble key(16) return code(4) */
+#define B_CAS_BROKER_PROC_EMM            (5)  /* EMM -> none */
+
+/* system key(32) init cbc(8) card id(8) card status(4) ca system id(4) */
+#define B_CAS_BROKER_INIT_STATUS_SIZE    (56)
+/* the ten int32_t of B_CAS_PWR_ON_CTRL in their order */
+#define B_CAS_BROKER_PWR_ON_CTRL_SIZE    (40)
+
+/**
+ a B_CAS_CARD that hands every call to the b25broker listening on path
+ (NULL - B_CAS_BROKER_DEFAULT_PATH) instead of a reader of its own.
+ init() connects, a call that finds the broker gone reconnects once,
+ one that gets no answer within B_CAS_BROKER_TIMEOUT_MSEC fails with
+ B_CAS_CARD_ERROR_TRANSMIT_FAILED and the next call reconnects.
+ not available on Win32, returns NULL there
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern B_CAS_CARD *create_b_cas_broker_card(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* B_CAS_BROKER_H */
@@ -11,8 +11,11 @@
 	#include <windows.h>
 	#include <tchar.h>
 #else
+	#include <pthread.h>
+	#include <time.h>
 	#define TCHAR char
 	#define _tcslen strlen
+	#define _tcscmp strcmp
 #endif
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -39,6 +42,49 @@ typedef struct {
 
 } B_CAS_CARD_PRIVATE_DATA;
 
+#if defined(_WIN32)
+typedef CRITICAL_SECTION   POOL_LOCK;
+typedef CONDITION_VARIABLE POOL_COND;
+#else
+typedef pthread_mutex_t    POOL_LOCK;
+typedef pthread_cond_t     POOL_COND;
+#endif
+
+#define B_CAS_CARD_POOL_MAX (32)
+
+typedef struct {
+
+	B_CAS_CARD        *card;
+	LPCTSTR            name;
+
+	int64_t            card_id;   /* card found at init, another one is refused */
+	int32_t            id_first;  /* its ids in the pool id list, for EMM */
+	int32_t            id_count;
+
+	int32_t            busy;
+	int32_t            fail;      /* failed calls in a row */
+	uint32_t           retry;     /* msec clock a failed reader is tried again */
+	int32_t            latency;   /* moving average, 1/16 msec */
+	uint32_t           calls;
+
+} B_CAS_POOL_READER;
+
+typedef struct {
+
+	SCARDCONTEXT       mng;
+	LPTSTR             names;
+
+	B_CAS_POOL_READER  reader[B_CAS_CARD_POOL_MAX];
+	int32_t            count;
+
+	B_CAS_INIT_STATUS  stat;      /* shared by every card in the pool */
+	B_CAS_ID           id;        /* of every card in the pool */
+
+	POOL_LOCK          lock;      /* busy, fail, retry, latency, calls */
+	POOL_COND          idle;
+
+} B_CAS_CARD_POOL_PRIVATE_DATA;
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  constant values
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -75,6 +121,47 @@ static int get_pwr_on_ctrl_b_cas_card(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
 static int proc_ecm_b_cas_card(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
 static int proc_emm_b_cas_card(void *bcas, uint8_t *src, int len);
 
+static void release_b_cas_card_pool(void *bcas);
+static int init_b_cas_card_pool(void *bcas);
+static int get_init_status_b_cas_card_pool(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_b_cas_card_pool(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_b_cas_card_pool(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_b_cas_card_pool(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_b_cas_card_pool(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_PRIVATE_DATA *private_data(void *bcas);
+static void teardown(B_CAS_CARD_PRIVATE_DATA *prv);
+static int change_id_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
+static int change_pwc_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
+static int open_reader(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR name);
+static int connect_card(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR reader_name);
+static void extract_power_on_ctrl_response(B_CAS_PWR_ON_CTRL *dst, uint8_t *src);
+static void extract_mjd(int *yy, int *mm, int *dd, int mjd);
+static int setup_ecm_receive_command(uint8_t *dst, uint8_t *src, int len);
+static int setup_emm_receive_command(uint8_t *dst, uint8_t *src, int len);
+static int32_t load_be_uint16(uint8_t *p);
+static int64_t load_be_uint48(uint8_t *p);
+
+static B_CAS_CARD_POOL_PRIVATE_DATA *pool_private_data(void *bcas);
+static void teardown_pool(B_CAS_CARD_POOL_PRIVATE_DATA *prv);
+static int add_pool_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, LPCTSTR name);
+static int acquire_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int which, uint32_t tried);
+static int reopen_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int idx);
+static void release_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int idx, int ok, uint32_t start);
+static uint32_t get_msec_clock(void);
+
+static void init_lock(POOL_LOCK *lock);
+static void destroy_lock(POOL_LOCK *lock);
+static void enter_lock(POOL_LOCK *lock);
+static void leave_lock(POOL_LOCK *lock);
+static void init_cond(POOL_COND *cond);
+static void destroy_cond(POOL_COND *cond);
+static void wait_cond(POOL_COND *cond, POOL_LOCK *lock);
+static void broadcast_cond(POOL_COND *cond);
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -106,20 +193,36 @@ B_CAS_CARD *create_b_cas_card(void)
 	return r;
 }
 
-/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
- function prottypes (private method)
- ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-static B_CAS_CARD_PRIVATE_DATA *private_data(void *bcas);
-static void teardown(B_CAS_CARD_PRIVATE_DATA *prv);
-static int change_id_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
-static int change_pwc_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
-static int connect_card(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR reader_name);
-static void extract_power_on_ctrl_response(B_CAS_PWR_ON_CTRL *dst, uint8_t *src);
-static void extract_mjd(int *yy, int *mm, int *dd, int mjd);
-static int setup_ecm_receive_command(uint8_t *dst, uint8_t *src, int len);
-static int setup_emm_receive_command(uint8_t *dst, uint8_t *src, int len);
-static int32_t load_be_uint16(uint8_t *p);
-static int64_t load_be_uint48(uint8_t *p);
+B_CAS_CARD *create_b_cas_card_pool(void)
+{
+	int n;
+
+	B_CAS_CARD *r;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	n = sizeof(B_CAS_CARD) + sizeof(B_CAS_CARD_POOL_PRIVATE_DATA);
+	prv = (B_CAS_CARD_POOL_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	init_lock(&(prv->lock));
+	init_cond(&(prv->idle));
+
+	r = (B_CAS_CARD *)(prv+1);
+
+	r->private_data = prv;
+
+	r->release = release_b_cas_card_pool;
+	r->init = init_b_cas_card_pool;
+	r->get_init_status = get_init_status_b_cas_card_pool;
+	r->get_id = get_id_b_cas_card_pool;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_b_cas_card_pool;
+	r->proc_ecm = proc_ecm_b_cas_card_pool;
+	r->proc_emm = proc_emm_b_cas_card_pool;
+
+	return r;
+}
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  interface method implementation
@@ -140,10 +243,6 @@ static void release_b_cas_card(void *bcas)
 
 static int init_b_cas_card(void *bcas)
 {
-	int m;
-	long ret;
-	unsigned long len;
-
 	B_CAS_CARD_PRIVATE_DATA *prv;
 
 	prv = private_data(bcas);
@@ -151,50 +250,7 @@ static int init_b_cas_card(void *bcas)
 		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
 	}
 
-	teardown(prv);
-
-	ret = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &(prv->mng));
-	if(ret != SCARD_S_SUCCESS){
-		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
-	}
-
-	ret = SCardListReaders(prv->mng, NULL, NULL, &len);
-	if(ret != SCARD_S_SUCCESS){
-		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
-	}
-	len += 256;
-
-	m = (sizeof(TCHAR)*len) + (2*B_CAS_BUFFER_MAX) + (sizeof(int64_t)*16) + (sizeof(B_CAS_PWR_ON_CTRL)*16);
-	prv->pool = (uint8_t *)malloc(m);
-	if(prv->pool == NULL){
-		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
-	}
-
-	prv->reader = (LPTSTR)(prv->pool);
-	prv->sbuf = (uint8_t *)(prv->reader + len);
-	prv->rbuf = prv->sbuf + B_CAS_BUFFER_MAX;
-	prv->id.data = (int64_t *)(prv->rbuf + B_CAS_BUFFER_MAX);
-	prv->id_max = 16;
-	prv->pwc.data = (B_CAS_PWR_ON_CTRL *)(prv->id.data + prv->id_max);
-	prv->pwc_max = 16;
-
-	ret = SCardListReaders(prv->mng, NULL, prv->reader, &len);
-	if(ret != SCARD_S_SUCCESS){
-		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
-	}
-
-	while( prv->reader[0] != 0 ){
-		if(connect_card(prv, prv->reader)){
-			break;
-		}
-		prv->reader += (_tcslen(prv->reader) + 1);
-	}
-
-	if(prv->card == 0){
-		return B_CAS_CARD_ERROR_ALL_READERS_CONNECTION_FAILED;
-	}
-
-	return 0;
+	return open_reader(prv, NULL);
 }
 
 static int get_init_status_b_cas_card(void *bcas, B_CAS_INIT_STATUS *stat)
@@ -437,6 +493,242 @@ static int proc_emm_b_cas_card(void *bcas, uint8_t *src, int len)
 	return 0;
 }
 
+static void release_b_cas_card_pool(void *bcas)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	teardown_pool(prv);
+
+	destroy_cond(&(prv->idle));
+	destroy_lock(&(prv->lock));
+
+	free(prv);
+}
+
+static int init_b_cas_card_pool(void *bcas)
+{
+	long ret;
+	unsigned long len;
+
+	LPTSTR name;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	teardown_pool(prv);
+
+	ret = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &(prv->mng));
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	ret = SCardListReaders(prv->mng, NULL, NULL, &len);
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+	len += 256;
+
+	prv->names = (LPTSTR)malloc(sizeof(TCHAR)*len);
+	if(prv->names == NULL){
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	ret = SCardListReaders(prv->mng, NULL, prv->names, &len);
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	name = prv->names;
+	while( (name[0] != 0) && (prv->count < B_CAS_CARD_POOL_MAX) ){
+		if(add_pool_reader(prv, name) < 0){
+			return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+		}
+		name += (_tcslen(name) + 1);
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_ALL_READERS_CONNECTION_FAILED;
+	}
+
+	return 0;
+}
+
+static int get_init_status_b_cas_card_pool(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if( (prv == NULL) || (stat == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	memcpy(stat, &(prv->stat), sizeof(B_CAS_INIT_STATUS));
+
+	return 0;
+}
+
+static int get_id_b_cas_card_pool(void *bcas, B_CAS_ID *dst)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	/* read at init(), EMMs for any card in the pool pass the filter */
+	memcpy(dst, &(prv->id), sizeof(B_CAS_ID));
+
+	return 0;
+}
+
+static int get_pwr_on_ctrl_b_cas_card_pool(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	int i,r;
+	uint32_t tried,start;
+
+	B_CAS_CARD *card;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	tried = 0;
+	while( (i = acquire_reader(prv, -1, tried)) >= 0 ){
+		start = get_msec_clock();
+		card = prv->reader[i].card;
+		r = B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+		if(reopen_reader(prv, i)){
+			r = card->get_pwr_on_ctrl(card, dst);
+		}
+		release_reader(prv, i, (r >= 0), start);
+		if(r >= 0){
+			return r;
+		}
+		tried |= ((uint32_t)1 << i);
+	}
+
+	return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+}
+
+static int proc_ecm_b_cas_card_pool(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	int i,r;
+	uint32_t tried,start;
+
+	B_CAS_CARD *card;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if( (prv == NULL) ||
+	    (dst == NULL) ||
+	    (src == NULL) ||
+	    (len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	/* any card answers an ECM, a failing reader hands over to the next */
+	tried = 0;
+	while( (i = acquire_reader(prv, -1, tried)) >= 0 ){
+		start = get_msec_clock();
+		card = prv->reader[i].card;
+		r = B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+		if(reopen_reader(prv, i)){
+			r = card->proc_ecm(card, dst, src, len);
+		}
+		release_reader(prv, i, (r >= 0), start);
+		if(r >= 0){
+			return r;
+		}
+		tried |= ((uint32_t)1 << i);
+	}
+
+	return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+}
+
+static int proc_emm_b_cas_card_pool(void *bcas, uint8_t *src, int len)
+{
+	int i,j,r;
+	int64_t card_id;
+	uint32_t start;
+
+	B_CAS_CARD *card;
+	B_CAS_POOL_READER *reader;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = pool_private_data(bcas);
+	if( (prv == NULL) ||
+	    (src == NULL) ||
+	    (len < 6) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	/* an EMM is for one card, it starts with that card's id */
+	card_id = load_be_uint48(src);
+
+	for(i=0;i<prv->count;i++){
+		reader = prv->reader + i;
+		for(j=0;j<reader->id_count;j++){
+			if(prv->id.data[reader->id_first+j] == card_id){
+				break;
+			}
+		}
+		if(j < reader->id_count){
+			break;
+		}
+	}
+
+	if(i == prv->count){
+		/* not for the pool */
+		return 0;
+	}
+
+	if(acquire_reader(prv, i, 0) < 0){
+		return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+
+	start = get_msec_clock();
+	card = prv->reader[i].card;
+	r = B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	if(reopen_reader(prv, i)){
+		r = card->proc_emm(card, src, len);
+	}
+	release_reader(prv, i, (r >= 0), start);
+
+	return r;
+}
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  private method implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -564,6 +856,60 @@ static int change_pwc_max(B_CAS_CARD_PRIVATE_DATA *prv, int max)
 	return 0;
 }
 
+static int open_reader(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR name)
+{
+	int m;
+	long ret;
+	unsigned long len;
+
+	teardown(prv);
+
+	ret = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &(prv->mng));
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	ret = SCardListReaders(prv->mng, NULL, NULL, &len);
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+	len += 256;
+
+	m = (sizeof(TCHAR)*len) + (2*B_CAS_BUFFER_MAX) + (sizeof(int64_t)*16) + (sizeof(B_CAS_PWR_ON_CTRL)*16);
+	prv->pool = (uint8_t *)malloc(m);
+	if(prv->pool == NULL){
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	prv->reader = (LPTSTR)(prv->pool);
+	prv->sbuf = (uint8_t *)(prv->reader + len);
+	prv->rbuf = prv->sbuf + B_CAS_BUFFER_MAX;
+	prv->id.data = (int64_t *)(prv->rbuf + B_CAS_BUFFER_MAX);
+	prv->id_max = 16;
+	prv->pwc.data = (B_CAS_PWR_ON_CTRL *)(prv->id.data + prv->id_max);
+	prv->pwc_max = 16;
+
+	ret = SCardListReaders(prv->mng, NULL, prv->reader, &len);
+	if(ret != SCARD_S_SUCCESS){
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	/* name (NULL - the first one that works) picks the reader */
+	while( prv->reader[0] != 0 ){
+		if( ((name == NULL) || (_tcscmp(prv->reader, name) == 0)) &&
+		    connect_card(prv, prv->reader) ){
+			break;
+		}
+		prv->reader += (_tcslen(prv->reader) + 1);
+	}
+
+	if(prv->card == 0){
+		return B_CAS_CARD_ERROR_ALL_READERS_CONNECTION_FAILED;
+	}
+
+	return 0;
+}
+
 static int connect_card(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR reader_name)
 {
 	int m,n;
@@ -723,3 +1069,306 @@ static int64_t load_be_uint48(uint8_t *p)
 
 	return r;
 }
+
+static B_CAS_CARD_POOL_PRIVATE_DATA *pool_private_data(void *bcas)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD_POOL_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void teardown_pool(B_CAS_CARD_POOL_PRIVATE_DATA *prv)
+{
+	int i;
+
+	for(i=0;i<prv->count;i++){
+		prv->reader[i].card->release(prv->reader[i].card);
+	}
+	memset(prv->reader, 0, sizeof(prv->reader));
+	prv->count = 0;
+
+	if(prv->id.data != NULL){
+		free(prv->id.data);
+		prv->id.data = NULL;
+	}
+	prv->id.count = 0;
+
+	if(prv->names != NULL){
+		free(prv->names);
+		prv->names = NULL;
+	}
+
+	if(prv->mng != 0){
+		SCardReleaseContext(prv->mng);
+		prv->mng = 0;
+	}
+}
+
+static int add_pool_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, LPCTSTR name)
+{
+	int64_t *p;
+
+	B_CAS_CARD *card;
+	B_CAS_ID id;
+	B_CAS_POOL_READER *reader;
+	B_CAS_CARD_PRIVATE_DATA *cp;
+
+	card = create_b_cas_card();
+	if(card == NULL){
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+	cp = private_data(card);
+
+	if( (open_reader(cp, name) < 0) ||
+	    (card->get_id(card, &id) < 0) ){
+		/* empty or unusable, skipped */
+		card->release(card);
+		return 0;
+	}
+
+	if(prv->count == 0){
+		memcpy(&(prv->stat), &(cp->stat), sizeof(B_CAS_INIT_STATUS));
+	}else if( (cp->stat.ca_system_id != prv->stat.ca_system_id) ||
+	          (memcmp(cp->stat.system_key, prv->stat.system_key, 32) != 0) ||
+	          (memcmp(cp->stat.init_cbc, prv->stat.init_cbc, 8) != 0) ){
+		/* the descrambler takes one system key, another CA system is left out */
+		card->release(card);
+		return 0;
+	}
+
+	p = (int64_t *)realloc(prv->id.data, sizeof(int64_t)*(prv->id.count+id.count));
+	if(p == NULL){
+		card->release(card);
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+	prv->id.data = p;
+
+	reader = prv->reader + prv->count;
+	reader->card = card;
+	reader->name = name;
+	reader->card_id = cp->stat.bcas_card_id;
+	reader->id_first = prv->id.count;
+	reader->id_count = id.count;
+
+	memcpy(prv->id.data+prv->id.count, id.data, sizeof(int64_t)*id.count);
+	prv->id.count += id.count;
+
+	prv->count += 1;
+
+	return 0;
+}
+
+static int acquire_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int which, uint32_t tried)
+{
+	int i,best,rest,busy;
+	uint32_t now;
+
+	B_CAS_POOL_READER *reader;
+
+	enter_lock(&(prv->lock));
+
+	while(1){
+		now = get_msec_clock();
+		best = -1;
+		rest = -1;
+		busy = 0;
+
+		for(i=0;i<prv->count;i++){
+			if( ((which >= 0) && (i != which)) || (tried & ((uint32_t)1 << i)) ){
+				continue;
+			}
+			reader = prv->reader + i;
+			if(reader->busy){
+				busy = 1;
+				continue;
+			}
+			if( (reader->fail > 0) && ((int32_t)(now - reader->retry) < 0) ){
+				/* resting after a failure, remember the one back soonest */
+				if( (rest < 0) ||
+				    ((int32_t)(reader->retry - prv->reader[rest].retry) < 0) ){
+					rest = i;
+				}
+				continue;
+			}
+			/* an idle one, fastest first, then the one used least */
+			if( (best < 0) ||
+			    (reader->latency < prv->reader[best].latency) ||
+			    ( (reader->latency == prv->reader[best].latency) &&
+			      (reader->calls < prv->reader[best].calls) ) ){
+				best = i;
+			}
+		}
+
+		if( (best >= 0) || !busy ){
+			break;
+		}
+
+		wait_cond(&(prv->idle), &(prv->lock));
+	}
+
+	if(best < 0){
+		/* every reader left is resting, trying one early beats failing */
+		best = rest;
+	}
+
+	if(best >= 0){
+		prv->reader[best].busy = 1;
+	}
+
+	leave_lock(&(prv->lock));
+
+	return best;
+}
+
+static int reopen_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int idx)
+{
+	B_CAS_POOL_READER *reader;
+	B_CAS_CARD_PRIVATE_DATA *cp;
+
+	reader = prv->reader + idx;
+	if(reader->fail == 0){
+		return 1;
+	}
+
+	/* its rest is over, connect again before trusting it */
+	cp = private_data(reader->card);
+	if(open_reader(cp, reader->name) < 0){
+		return 0;
+	}
+
+	if(cp->stat.bcas_card_id != reader->card_id){
+		/**
+		 another card was put in - every card of the CA system has the
+		 same system key, and its ids are not the ones EMMs are routed by
+		 */
+		return 0;
+	}
+
+	return 1;
+}
+
+static void release_reader(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int idx, int ok, uint32_t start)
+{
+	int32_t elapsed;
+	uint32_t now;
+
+	B_CAS_POOL_READER *reader;
+
+	now = get_msec_clock();
+	elapsed = (int32_t)(now - start);
+
+	enter_lock(&(prv->lock));
+
+	reader = prv->reader + idx;
+	reader->busy = 0;
+	reader->calls += 1;
+
+	if(ok){
+		reader->fail = 0;
+		reader->latency += ((elapsed*16) - reader->latency) / 8;
+	}else{
+		/* 1, 2, 4 .. 64 seconds before it is tried again */
+		reader->fail += 1;
+		reader->retry = now + (1000 << ((reader->fail < 7) ? (reader->fail-1) : 6));
+	}
+
+	broadcast_cond(&(prv->idle));
+
+	leave_lock(&(prv->lock));
+}
+
+static uint32_t get_msec_clock(void)
+{
+#if defined(_WIN32)
+	return (uint32_t)GetTickCount();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint32_t)ts.tv_sec)*1000 + (uint32_t)(ts.tv_nsec/1000000);
+#endif
+}
+
+static void init_lock(POOL_LOCK *lock)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(lock);
+#else
+	pthread_mutex_init(lock, NULL);
+#endif
+}
+
+static void destroy_lock(POOL_LOCK *lock)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(lock);
+#else
+	pthread_mutex_destroy(lock);
+#endif
+}
+
+static void enter_lock(POOL_LOCK *lock)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(lock);
+#else
+	pthread_mutex_lock(lock);
+#endif
+}
+
+static void leave_lock(POOL_LOCK *lock)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(lock);
+#else
+	pthread_mutex_unlock(lock);
+#endif
+}
+
+static void init_cond(POOL_COND *cond)
+{
+#if defined(_WIN32)
+	InitializeConditionVariable(cond);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+static void destroy_cond(POOL_COND *cond)
+{
+#if defined(_WIN32)
+	(void)cond;
+#else
+	pthread_cond_destroy(cond);
+#endif
+}
+
+static void wait_cond(POOL_COND *cond, POOL_LOCK *lock)
+{
+#if defined(_WIN32)
+	SleepConditionVariableCS(cond, lock, INFINITE);
+#else
+	pthread_cond_wait(cond, lock);
+#endif
+}
+
+static void broadcast_cond(POOL_COND *cond)
+{
+#if defined(_WIN32)
+	WakeAllConditionVariable(cond);
+#else
+	pthread_cond_broadcast(cond);
+#endif
+}
@@ -68,6 +68,17 @@ extern "C" {
 
 extern B_CAS_CARD *create_b_cas_card(void);
 
+/**
+ one B_CAS_CARD over every reader holding a card with the same system key
+ as the first one found. an ECM goes to the idle reader that answered
+ fastest so far, a reader failing is rested (1 - 64 sec) and reconnected
+ before it is used again while the next one takes over, with every
+ reader resting the one due back first is tried early. an EMM goes to
+ the reader whose card id it carries. calls may come from several
+ threads at once, each one gets a reader of its own
+ */
+extern B_CAS_CARD *create_b_cas_card_pool(void);
+
 #ifdef __cplusplus
 }
 #endif
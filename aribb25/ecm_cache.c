@@ -0,0 +1,664 @@
+#if defined(_WIN32)
+	#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+#include "ecm_cache.h"
+#include "b_cas_card_error_code.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#if defined(_WIN32)
+typedef CRITICAL_SECTION   CACHE_LOCK;
+#else
+typedef pthread_mutex_t    CACHE_LOCK;
+#endif
+
+#define ECM_CACHE_DATA_MAX (255) /* the card takes a one byte length */
+
+typedef struct {
+	int32_t            next;   /* in the bucket, -1 - last */
+	uint32_t           hash;
+	int64_t            stamp;  /* time() when the card answered */
+	int32_t            len;
+	B_CAS_ECM_RESULT   res;
+	uint8_t            data[ECM_CACHE_DATA_MAX];
+} ECM_CACHE_ENTRY;
+
+typedef struct {
+
+	B_CAS_CARD        *bcas;
+
+	char              *path;
+	int32_t            expire;
+
+	/* entry[(oldest+n) % max], n < count, in the order added */
+	ECM_CACHE_ENTRY   *entry;
+	int32_t            max;
+	int32_t            count;
+	int32_t            oldest;
+
+	int32_t           *bucket; /* mask+1 chains of entry indexes */
+	uint32_t           mask;
+
+	int64_t            card_id;
+	int32_t            loaded;  /* card_id known, path read */
+	int32_t            dirty;
+
+	CACHE_LOCK         lock;    /* everything above but bcas, never over a card call */
+
+} ECM_CACHE_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ constant values
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static const uint8_t ECM_CACHE_FILE_MAGIC[] = {
+	'B', '2', '5', 'E', 'C', 'M', 'C', 0x01,
+};
+
+#define ECM_CACHE_FILE_HEAD_SIZE   (20) /* magic, card id, count */
+#define ECM_CACHE_FILE_ENTRY_SIZE  (30) /* stamp, return code, key, length */
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_cache(void *bcas);
+static int init_ecm_cache(void *bcas);
+static int get_init_status_ecm_cache(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_ecm_cache(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_ecm_cache(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_ecm_cache(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_ecm_cache(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_CACHE_PRIVATE_DATA *private_data(void *bcas);
+static void prepare_cache(ECM_CACHE_PRIVATE_DATA *prv);
+static ECM_CACHE_ENTRY *find_entry(ECM_CACHE_PRIVATE_DATA *prv, uint32_t hash, uint8_t *src, int len);
+static void add_entry(ECM_CACHE_PRIVATE_DATA *prv, uint32_t hash, uint8_t *src, int len, B_CAS_ECM_RESULT *res, int64_t stamp);
+static void unlink_entry(ECM_CACHE_PRIVATE_DATA *prv, int32_t idx);
+static int is_expired(ECM_CACHE_PRIVATE_DATA *prv, int64_t stamp, int64_t now);
+static int is_purchased(B_CAS_ECM_RESULT *res);
+static void load_cache(ECM_CACHE_PRIVATE_DATA *prv);
+static void save_cache(ECM_CACHE_PRIVATE_DATA *prv);
+static uint32_t hash_ecm(uint8_t *src, int len);
+static uint32_t load_be_uint32(uint8_t *p);
+static int64_t load_be_uint64(uint8_t *p);
+static void store_be_uint32(uint8_t *p, uint32_t v);
+static void store_be_uint64(uint8_t *p, int64_t v);
+
+static void init_lock(CACHE_LOCK *lock);
+static void destroy_lock(CACHE_LOCK *lock);
+static void enter_lock(CACHE_LOCK *lock);
+static void leave_lock(CACHE_LOCK *lock);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+B_CAS_CARD *create_ecm_cache(B_CAS_CARD *bcas, const char *path, int32_t expire, int32_t max)
+{
+	int i,n;
+
+	B_CAS_CARD *r;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	if( (bcas == NULL) || (expire < 0) || (max < 0) ){
+		return NULL;
+	}
+
+	if(max == 0){
+		max = ECM_CACHE_DEFAULT_MAX;
+	}
+
+	n = sizeof(ECM_CACHE_PRIVATE_DATA) + sizeof(B_CAS_CARD);
+	if(path != NULL){
+		n += (int)strlen(path) + 1;
+	}
+
+	prv = (ECM_CACHE_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD *)(prv+1);
+	if(path != NULL){
+		prv->path = (char *)(r+1);
+		strcpy(prv->path, path);
+	}
+
+	prv->mask = 1;
+	while(prv->mask < (uint32_t)max){
+		prv->mask <<= 1;
+	}
+	prv->mask -= 1;
+
+	prv->entry = (ECM_CACHE_ENTRY *)malloc(sizeof(ECM_CACHE_ENTRY)*max);
+	prv->bucket = (int32_t *)malloc(sizeof(int32_t)*(prv->mask+1));
+	if( (prv->entry == NULL) || (prv->bucket == NULL) ){
+		free(prv->bucket);
+		free(prv->entry);
+		free(prv);
+		return NULL;
+	}
+
+	for(i=0;i<=(int)prv->mask;i++){
+		prv->bucket[i] = -1;
+	}
+
+	prv->bcas = bcas;
+	prv->expire = expire;
+	prv->max = max;
+
+	init_lock(&(prv->lock));
+
+	r->private_data = prv;
+
+	r->release = release_ecm_cache;
+	r->init = init_ecm_cache;
+	r->get_init_status = get_init_status_ecm_cache;
+	r->get_id = get_id_ecm_cache;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_ecm_cache;
+	r->proc_ecm = proc_ecm_ecm_cache;
+	r->proc_emm = proc_emm_ecm_cache;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_cache(void *bcas)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	if(prv->dirty){
+		save_cache(prv);
+	}
+
+	prv->bcas->release(prv->bcas);
+
+	destroy_lock(&(prv->lock));
+
+	free(prv->bucket);
+	free(prv->entry);
+	free(prv);
+}
+
+static int init_ecm_cache(void *bcas)
+{
+	int r;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	r = prv->bcas->init(prv->bcas);
+	if(r < 0){
+		return r;
+	}
+
+	enter_lock(&(prv->lock));
+	prepare_cache(prv);
+	leave_lock(&(prv->lock));
+
+	return r;
+}
+
+static int get_init_status_ecm_cache(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->bcas->get_init_status(prv->bcas, stat);
+}
+
+static int get_id_ecm_cache(void *bcas, B_CAS_ID *dst)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->bcas->get_id(prv->bcas, dst);
+}
+
+static int get_pwr_on_ctrl_ecm_cache(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->bcas->get_pwr_on_ctrl(prv->bcas, dst);
+}
+
+static int proc_ecm_ecm_cache(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	int r;
+	uint32_t hash;
+	int64_t now;
+
+	ECM_CACHE_ENTRY *entry;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+	    (dst == NULL) ||
+	    (src == NULL) ||
+	    (len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(len > ECM_CACHE_DATA_MAX){
+		return prv->bcas->proc_ecm(prv->bcas, dst, src, len);
+	}
+
+	now = (int64_t)time(NULL);
+	hash = hash_ecm(src, len);
+
+	enter_lock(&(prv->lock));
+	prepare_cache(prv);
+	entry = find_entry(prv, hash, src, len);
+	if( (entry != NULL) && !is_expired(prv, entry->stamp, now) ){
+		memcpy(dst, &(entry->res), sizeof(B_CAS_ECM_RESULT));
+		leave_lock(&(prv->lock));
+		return 0;
+	}
+	leave_lock(&(prv->lock));
+
+	r = prv->bcas->proc_ecm(prv->bcas, dst, src, len);
+	if( (r < 0) || !is_purchased(dst) ){
+		/* a contract may still change, ask the card again next time */
+		return r;
+	}
+
+	/* another thread may have added or pushed it out meanwhile, look again */
+	enter_lock(&(prv->lock));
+	entry = find_entry(prv, hash, src, len);
+	if(entry != NULL){
+		memcpy(&(entry->res), dst, sizeof(B_CAS_ECM_RESULT));
+		entry->stamp = now;
+	}else{
+		add_entry(prv, hash, src, len, dst, now);
+	}
+	prv->dirty = 1;
+	leave_lock(&(prv->lock));
+
+	return r;
+}
+
+static int proc_emm_ecm_cache(void *bcas, uint8_t *src, int len)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->bcas->proc_emm(prv->bcas, src, len);
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_CACHE_PRIVATE_DATA *private_data(void *bcas)
+{
+	ECM_CACHE_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (ECM_CACHE_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void prepare_cache(ECM_CACHE_PRIVATE_DATA *prv)
+{
+	B_CAS_INIT_STATUS is;
+
+	if(prv->loaded){
+		return;
+	}
+
+	/* the file is bound to the card, wait until it can tell its id */
+	if(prv->bcas->get_init_status(prv->bcas, &is) < 0){
+		return;
+	}
+
+	prv->card_id = is.bcas_card_id;
+	prv->loaded = 1;
+
+	if(prv->path != NULL){
+		load_cache(prv);
+	}
+}
+
+static ECM_CACHE_ENTRY *find_entry(ECM_CACHE_PRIVATE_DATA *prv, uint32_t hash, uint8_t *src, int len)
+{
+	int32_t idx;
+	ECM_CACHE_ENTRY *entry;
+
+	idx = prv->bucket[hash & prv->mask];
+	while(idx >= 0){
+		entry = prv->entry + idx;
+		if( (entry->hash == hash) &&
+		    (entry->len == len) &&
+		    (memcmp(entry->data, src, len) == 0) ){
+			return entry;
+		}
+		idx = entry->next;
+	}
+
+	return NULL;
+}
+
+static void add_entry(ECM_CACHE_PRIVATE_DATA *prv, uint32_t hash, uint8_t *src, int len, B_CAS_ECM_RESULT *res, int64_t stamp)
+{
+	int32_t idx;
+	ECM_CACHE_ENTRY *entry;
+
+	if(prv->count < prv->max){
+		idx = (prv->oldest + prv->count) % prv->max;
+		prv->count += 1;
+	}else{
+		idx = prv->oldest;
+		unlink_entry(prv, idx);
+		prv->oldest = (prv->oldest + 1) % prv->max;
+	}
+
+	entry = prv->entry + idx;
+	entry->hash = hash;
+	entry->stamp = stamp;
+	entry->len = len;
+	memcpy(&(entry->res), res, sizeof(B_CAS_ECM_RESULT));
+	memcpy(entry->data, src, len);
+
+	entry->next = prv->bucket[hash & prv->mask];
+	prv->bucket[hash & prv->mask] = idx;
+}
+
+static void unlink_entry(ECM_CACHE_PRIVATE_DATA *prv, int32_t idx)
+{
+	int32_t *p;
+
+	p = prv->bucket + (prv->entry[idx].hash & prv->mask);
+	while(*p >= 0){
+		if(*p == idx){
+			*p = prv->entry[idx].next;
+			return;
+		}
+		p = &(prv->entry[*p].next);
+	}
+}
+
+static int is_expired(ECM_CACHE_PRIVATE_DATA *prv, int64_t stamp, int64_t now)
+{
+	if(prv->expire == 0){
+		return 0;
+	}
+
+	/* a clock set back leaves the stamp in the future, trust it no more */
+	return (now < stamp) || ((now - stamp) >= prv->expire);
+}
+
+static int is_purchased(B_CAS_ECM_RESULT *res)
+{
+	/* same codes as arib_std_b25.c takes for "purchased" */
+	return (res->return_code == 0x0800) ||
+	       (res->return_code == 0x0400) ||
+	       (res->return_code == 0x0200);
+}
+
+static void load_cache(ECM_CACHE_PRIVATE_DATA *prv)
+{
+	int len;
+	int64_t now,stamp;
+	uint32_t i,n;
+
+	FILE *fp;
+	B_CAS_ECM_RESULT res;
+
+	uint8_t head[ECM_CACHE_FILE_HEAD_SIZE];
+	uint8_t rec[ECM_CACHE_FILE_ENTRY_SIZE];
+	uint8_t data[ECM_CACHE_DATA_MAX];
+
+	fp = fopen(prv->path, "rb");
+	if(fp == NULL){
+		/* first run */
+		return;
+	}
+
+	if( (fread(head, 1, sizeof(head), fp) != sizeof(head)) ||
+	    (memcmp(head, ECM_CACHE_FILE_MAGIC, sizeof(ECM_CACHE_FILE_MAGIC)) != 0) ||
+	    (load_be_uint64(head+8) != prv->card_id) ){
+		/* unknown format or another card, overwritten by release() */
+		goto LAST;
+	}
+
+	now = (int64_t)time(NULL);
+	n = load_be_uint32(head+16);
+
+	for(i=0;i<n;i++){
+		if(fread(rec, 1, sizeof(rec), fp) != sizeof(rec)){
+			break;
+		}
+		len = (rec[28] << 8) | rec[29];
+		if( (len < 1) || (len > ECM_CACHE_DATA_MAX) ){
+			break;
+		}
+		if(fread(data, 1, len, fp) != (size_t)len){
+			break;
+		}
+
+		res.return_code = load_be_uint32(rec+8);
+		memcpy(res.scramble_key, rec+12, 16);
+		if(!is_purchased(&res)){
+			break;
+		}
+
+		stamp = load_be_uint64(rec);
+		if(!is_expired(prv, stamp, now)){
+			add_entry(prv, hash_ecm(data, len), data, len, &res, stamp);
+		}
+	}
+
+LAST:
+	fclose(fp);
+}
+
+static void save_cache(ECM_CACHE_PRIVATE_DATA *prv)
+{
+	int32_t i,n;
+	int64_t now;
+
+	FILE *fp;
+	char *tmp;
+	ECM_CACHE_ENTRY *entry;
+
+	uint8_t head[ECM_CACHE_FILE_HEAD_SIZE];
+	uint8_t rec[ECM_CACHE_FILE_ENTRY_SIZE];
+
+	if( (prv->path == NULL) || !prv->loaded ){
+		return;
+	}
+
+	/* written aside and renamed, a crash leaves the old file intact */
+	tmp = (char *)malloc(strlen(prv->path) + 5);
+	if(tmp == NULL){
+		return;
+	}
+	strcpy(tmp, prv->path);
+	strcat(tmp, ".tmp");
+
+	fp = fopen(tmp, "wb");
+	if(fp == NULL){
+		free(tmp);
+		return;
+	}
+
+	now = (int64_t)time(NULL);
+
+	n = 0;
+	for(i=0;i<prv->count;i++){
+		if(!is_expired(prv, prv->entry[(prv->oldest + i) % prv->max].stamp, now)){
+			n += 1;
+		}
+	}
+
+	memcpy(head, ECM_CACHE_FILE_MAGIC, sizeof(ECM_CACHE_FILE_MAGIC));
+	store_be_uint64(head+8, prv->card_id);
+	store_be_uint32(head+16, (uint32_t)n);
+	if(fwrite(head, 1, sizeof(head), fp) != sizeof(head)){
+		goto LAST;
+	}
+
+	for(i=0;i<prv->count;i++){
+		entry = prv->entry + ((prv->oldest + i) % prv->max);
+		if(is_expired(prv, entry->stamp, now)){
+			continue;
+		}
+		store_be_uint64(rec, entry->stamp);
+		store_be_uint32(rec+8, entry->res.return_code);
+		memcpy(rec+12, entry->res.scramble_key, 16);
+		rec[28] = (uint8_t)(entry->len >> 8);
+		rec[29] = (uint8_t)(entry->len & 0xff);
+		if( (fwrite(rec, 1, sizeof(rec), fp) != sizeof(rec)) ||
+		    (fwrite(entry->data, 1, entry->len, fp) != (size_t)entry->len) ){
+			goto LAST;
+		}
+	}
+
+	if(fclose(fp) == 0){
+		fp = NULL;
+#if defined(_WIN32)
+		/* rename() does not replace an existing file here */
+		if(MoveFileExA(tmp, prv->path, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)){
+			prv->dirty = 0;
+		}
+#else
+		if(rename(tmp, prv->path) == 0){
+			prv->dirty = 0;
+		}
+#endif
+	}
+
+LAST:
+	if(fp != NULL){
+		fclose(fp);
+	}
+	if(prv->dirty){
+		remove(tmp);
+	}
+	free(tmp);
+}
+
+static uint32_t hash_ecm(uint8_t *src, int len)
+{
+	int i;
+	uint32_t r;
+
+	/* FNV-1a */
+	r = 0x811c9dc5;
+	for(i=0;i<len;i++){
+		r ^= src[i];
+		r *= 0x01000193;
+	}
+
+	return r;
+}
+
+static uint32_t load_be_uint32(uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int64_t load_be_uint64(uint8_t *p)
+{
+	return (int64_t)(((uint64_t)load_be_uint32(p) << 32) | load_be_uint32(p+4));
+}
+
+static void store_be_uint32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >>  8);
+	p[3] = (uint8_t)(v      );
+}
+
+static void store_be_uint64(uint8_t *p, int64_t v)
+{
+	store_be_uint32(p, (uint32_t)((uint64_t)v >> 32));
+	store_be_uint32(p+4, (uint32_t)v);
+}
+
+static void init_lock(CACHE_LOCK *lock)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(lock);
+#else
+	pthread_mutex_init(lock, NULL);
+#endif
+}
+
+static void destroy_lock(CACHE_LOCK *lock)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(lock);
+#else
+	pthread_mutex_destroy(lock);
+#endif
+}
+
+static void enter_lock(CACHE_LOCK *lock)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(lock);
+#else
+	pthread_mutex_lock(lock);
+#endif
+}
+
+static void leave_lock(CACHE_LOCK *lock)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(lock);
+#else
+	pthread_mutex_unlock(lock);
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef ECM_CACHE_H
+#define ECM_CACHE_H
+
+#include "portable.h"
+#include "b_cas_card.h"
+
+#define ECM_CACHE_DEFAULT_MAX (4096) /* entries, when max is 0 */
+
+/**
+ wraps bcas and answers proc_ecm() from memory for an ECM payload the
+ card has already answered "purchased", everything else goes to bcas.
+ the result plugs into ARIB_STD_B25::set_b_cas_card() and owns bcas,
+ release() releases it too. proc_ecm() takes several threads at once
+ when bcas does (create_b_cas_card_pool()), the card call itself runs
+ outside the cache lock; everything else is one thread at a time.
+
+ path (NULL - memory only) keeps the entries across runs: they are read
+ once the card id is known and written back by release(), a file from
+ another card is ignored. expire (sec, 0 - never) drops an entry that
+ long after the card answered it, max (0 - ECM_CACHE_DEFAULT_MAX)
+ bounds the entries, the oldest one gives way first
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern B_CAS_CARD *create_ecm_cache(B_CAS_CARD *bcas, const char *path, int32_t expire, int32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ECM_CACHE_H */
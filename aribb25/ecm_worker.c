@@ -0,0 +1,480 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
+#include "ecm_worker.h"
+#include "ecm_worker_error_code.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#if defined(_WIN32)
+typedef CRITICAL_SECTION   WORKER_LOCK;
+typedef CONDITION_VARIABLE WORKER_COND;
+typedef HANDLE             WORKER_THREAD;
+#else
+typedef pthread_mutex_t    WORKER_LOCK;
+typedef pthread_cond_t     WORKER_COND;
+typedef pthread_t          WORKER_THREAD;
+#endif
+
+#define ECM_WORKER_QUEUE_SIZE (16)
+
+typedef struct {
+	int32_t            tag;
+	int32_t            len;
+	int32_t            result;
+	B_CAS_ECM_RESULT   ecm;
+	uint8_t            data[ECM_WORKER_DATA_MAX];
+} ECM_WORKER_JOB;
+
+typedef struct {
+
+	B_CAS_CARD        *bcas;
+
+	WORKER_THREAD      thread;
+
+	WORKER_LOCK        lock;    /* the counters below and quit */
+	WORKER_LOCK        card;    /* held over every transmit */
+	WORKER_COND        posted;  /* the thread waits for jobs */
+	WORKER_COND        done;    /* the owner waits for results */
+
+	/* job[n % ECM_WORKER_QUEUE_SIZE]: [head, proc) done, [proc, tail) queued */
+	uint32_t           head;
+	uint32_t           proc;
+	uint32_t           tail;
+
+	int32_t            quit;
+
+	ECM_WORKER_JOB     job[ECM_WORKER_QUEUE_SIZE];
+
+	MEMORY_ALLOCATOR   mem;
+
+} ECM_WORKER_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_worker(void *worker);
+static int post_ecm_worker(void *worker, int32_t tag, uint8_t *src, int32_t len);
+static int get_ecm_worker(void *worker, ECM_WORKER_RESULT *dst);
+static int wait_ecm_worker(void *worker, ECM_WORKER_RESULT *dst);
+static int get_pending_ecm_worker(void *worker);
+static int proc_ecm_ecm_worker(void *worker, B_CAS_ECM_RESULT *dst, uint8_t *src, int32_t len);
+static int proc_emm_ecm_worker(void *worker, uint8_t *src, int32_t len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_WORKER_PRIVATE_DATA *private_data(void *worker);
+static void take_result(ECM_WORKER_PRIVATE_DATA *prv, ECM_WORKER_RESULT *dst);
+
+static int start_thread(ECM_WORKER_PRIVATE_DATA *prv);
+static void join_thread(ECM_WORKER_PRIVATE_DATA *prv);
+#if defined(_WIN32)
+static unsigned __stdcall worker_main(void *arg);
+#else
+static void *worker_main(void *arg);
+#endif
+
+static void init_lock(WORKER_LOCK *lock);
+static void destroy_lock(WORKER_LOCK *lock);
+static void enter_lock(WORKER_LOCK *lock);
+static void leave_lock(WORKER_LOCK *lock);
+static void init_cond(WORKER_COND *cond);
+static void destroy_cond(WORKER_COND *cond);
+static void wait_cond(WORKER_COND *cond, WORKER_LOCK *lock);
+static void signal_cond(WORKER_COND *cond);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+ECM_WORKER *create_ecm_worker(B_CAS_CARD *bcas, const MEMORY_ALLOCATOR *mem)
+{
+	int n;
+
+	ECM_WORKER *r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	MEMORY_ALLOCATOR m;
+
+	if(bcas == NULL){
+		return NULL;
+	}
+
+	if(init_memory_allocator(&m, mem) != 0){
+		return NULL;
+	}
+
+	n  = sizeof(ECM_WORKER_PRIVATE_DATA);
+	n += sizeof(ECM_WORKER);
+
+	prv = (ECM_WORKER_PRIVATE_DATA *)mem_calloc(&m, 1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	prv->mem = m;
+	prv->bcas = bcas;
+
+	init_lock(&(prv->lock));
+	init_lock(&(prv->card));
+	init_cond(&(prv->posted));
+	init_cond(&(prv->done));
+
+	if(!start_thread(prv)){
+		destroy_cond(&(prv->done));
+		destroy_cond(&(prv->posted));
+		destroy_lock(&(prv->card));
+		destroy_lock(&(prv->lock));
+		mem_free(&m, prv);
+		return NULL;
+	}
+
+	r = (ECM_WORKER *)(prv+1);
+	r->private_data = prv;
+
+	r->release = release_ecm_worker;
+	r->post = post_ecm_worker;
+	r->get = get_ecm_worker;
+	r->wait = wait_ecm_worker;
+	r->get_pending = get_pending_ecm_worker;
+	r->proc_ecm = proc_ecm_ecm_worker;
+	r->proc_emm = proc_emm_ecm_worker;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_worker(void *worker)
+{
+	ECM_WORKER_PRIVATE_DATA *prv;
+	MEMORY_ALLOCATOR mem;
+
+	prv = private_data(worker);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	enter_lock(&(prv->lock));
+	prv->quit = 1;
+	signal_cond(&(prv->posted));
+	leave_lock(&(prv->lock));
+
+	join_thread(prv);
+
+	destroy_cond(&(prv->done));
+	destroy_cond(&(prv->posted));
+	destroy_lock(&(prv->card));
+	destroy_lock(&(prv->lock));
+
+	mem = prv->mem;
+	mem_free(&mem, prv);
+}
+
+static int post_ecm_worker(void *worker, int32_t tag, uint8_t *src, int32_t len)
+{
+	ECM_WORKER_JOB *job;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if( (prv == NULL) || (src == NULL) || (len < 1) || (len > ECM_WORKER_DATA_MAX) ){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	enter_lock(&(prv->lock));
+
+	if( (prv->tail - prv->head) >= ECM_WORKER_QUEUE_SIZE ){
+		/* results have to be taken first */
+		leave_lock(&(prv->lock));
+		return ECM_WORKER_WARN_QUEUE_FULL;
+	}
+
+	job = prv->job + (prv->tail % ECM_WORKER_QUEUE_SIZE);
+	job->tag = tag;
+	job->len = len;
+	memcpy(job->data, src, len);
+
+	prv->tail += 1;
+	signal_cond(&(prv->posted));
+
+	leave_lock(&(prv->lock));
+
+	return 0;
+}
+
+static int get_ecm_worker(void *worker, ECM_WORKER_RESULT *dst)
+{
+	int r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if( (prv == NULL) || (dst == NULL) ){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	r = 0;
+
+	enter_lock(&(prv->lock));
+	if(prv->head != prv->proc){
+		take_result(prv, dst);
+		r = 1;
+	}
+	leave_lock(&(prv->lock));
+
+	return r;
+}
+
+static int wait_ecm_worker(void *worker, ECM_WORKER_RESULT *dst)
+{
+	int r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if( (prv == NULL) || (dst == NULL) ){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	r = 0;
+
+	enter_lock(&(prv->lock));
+	if(prv->head != prv->tail){
+		while(prv->head == prv->proc){
+			wait_cond(&(prv->done), &(prv->lock));
+		}
+		take_result(prv, dst);
+		r = 1;
+	}
+	leave_lock(&(prv->lock));
+
+	return r;
+}
+
+static int get_pending_ecm_worker(void *worker)
+{
+	int r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if(prv == NULL){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	enter_lock(&(prv->lock));
+	r = (int)(prv->tail - prv->head);
+	leave_lock(&(prv->lock));
+
+	return r;
+}
+
+static int proc_ecm_ecm_worker(void *worker, B_CAS_ECM_RESULT *dst, uint8_t *src, int32_t len)
+{
+	int r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if(prv == NULL){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	/* in the caller's thread, between the queued ones */
+	enter_lock(&(prv->card));
+	r = prv->bcas->proc_ecm(prv->bcas, dst, src, len);
+	leave_lock(&(prv->card));
+
+	return r;
+}
+
+static int proc_emm_ecm_worker(void *worker, uint8_t *src, int32_t len)
+{
+	int r;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = private_data(worker);
+	if(prv == NULL){
+		return ECM_WORKER_ERROR_INVALID_PARAM;
+	}
+
+	enter_lock(&(prv->card));
+	r = prv->bcas->proc_emm(prv->bcas, src, len);
+	leave_lock(&(prv->card));
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_WORKER_PRIVATE_DATA *private_data(void *worker)
+{
+	ECM_WORKER_PRIVATE_DATA *r;
+	ECM_WORKER *p;
+
+	p = (ECM_WORKER *)worker;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (ECM_WORKER_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void take_result(ECM_WORKER_PRIVATE_DATA *prv, ECM_WORKER_RESULT *dst)
+{
+	ECM_WORKER_JOB *job;
+
+	job = prv->job + (prv->head % ECM_WORKER_QUEUE_SIZE);
+	dst->tag = job->tag;
+	dst->result = job->result;
+	dst->ecm = job->ecm;
+
+	prv->head += 1;
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall worker_main(void *arg)
+#else
+static void *worker_main(void *arg)
+#endif
+{
+	ECM_WORKER_JOB *job;
+	ECM_WORKER_PRIVATE_DATA *prv;
+
+	prv = (ECM_WORKER_PRIVATE_DATA *)arg;
+
+	enter_lock(&(prv->lock));
+	while(!prv->quit){
+		if(prv->proc == prv->tail){
+			wait_cond(&(prv->posted), &(prv->lock));
+			continue;
+		}
+
+		/* the owner leaves the job alone until proc passes it */
+		job = prv->job + (prv->proc % ECM_WORKER_QUEUE_SIZE);
+		leave_lock(&(prv->lock));
+
+		enter_lock(&(prv->card));
+		job->result = prv->bcas->proc_ecm(prv->bcas, &(job->ecm), job->data, job->len);
+		leave_lock(&(prv->card));
+
+		enter_lock(&(prv->lock));
+		prv->proc += 1;
+		signal_cond(&(prv->done));
+	}
+	leave_lock(&(prv->lock));
+
+	return 0;
+}
+
+static int start_thread(ECM_WORKER_PRIVATE_DATA *prv)
+{
+#if defined(_WIN32)
+	uintptr_t h;
+
+	h = _beginthreadex(NULL, 0, worker_main, prv, 0, NULL);
+	if(h == 0){
+		return 0;
+	}
+	prv->thread = (HANDLE)h;
+#else
+	if(pthread_create(&(prv->thread), NULL, worker_main, prv) != 0){
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+static void join_thread(ECM_WORKER_PRIVATE_DATA *prv)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(prv->thread, INFINITE);
+	CloseHandle(prv->thread);
+#else
+	pthread_join(prv->thread, NULL);
+#endif
+}
+
+static void init_lock(WORKER_LOCK *lock)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(lock);
+#else
+	pthread_mutex_init(lock, NULL);
+#endif
+}
+
+static void destroy_lock(WORKER_LOCK *lock)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(lock);
+#else
+	pthread_mutex_destroy(lock);
+#endif
+}
+
+static void enter_lock(WORKER_LOCK *lock)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(lock);
+#else
+	pthread_mutex_lock(lock);
+#endif
+}
+
+static void leave_lock(WORKER_LOCK *lock)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(lock);
+#else
+	pthread_mutex_unlock(lock);
+#endif
+}
+
+static void init_cond(WORKER_COND *cond)
+{
+#if defined(_WIN32)
+	InitializeConditionVariable(cond);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+static void destroy_cond(WORKER_COND *cond)
+{
+#if defined(_WIN32)
+	/* nothing to release */
+#else
+	pthread_cond_destroy(cond);
+#endif
+}
+
+static void wait_cond(WORKER_COND *cond, WORKER_LOCK *lock)
+{
+#if defined(_WIN32)
+	SleepConditionVariableCS(cond, lock, INFINITE);
+#else
+	pthread_cond_wait(cond, lock);
+#endif
+}
+
+static void signal_cond(WORKER_COND *cond)
+{
+#if defined(_WIN32)
+	WakeConditionVariable(cond);
+#else
+	pthread_cond_signal(cond);
+#endif
+}
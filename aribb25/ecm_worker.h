@@ -0,0 +1,48 @@
+#ifndef ECM_WORKER_H
+#define ECM_WORKER_H
+
+#include "portable.h"
+#include "memory_allocator.h"
+#include "b_cas_card.h"
+
+#define ECM_WORKER_DATA_MAX (255) /* the card takes a one byte length */
+
+typedef struct {
+	int32_t          tag;     /* as given to post() */
+	int32_t          result;  /* return value of B_CAS_CARD::proc_ecm() */
+	B_CAS_ECM_RESULT ecm;
+} ECM_WORKER_RESULT;
+
+/**
+ runs B_CAS_CARD::proc_ecm() in a thread of its own, results come back
+ in the order posted. the methods are called from one owner thread and,
+ while the worker lives, the card is only transmitted to through it.
+ release() drops what is still queued and waits for the running call
+ */
+typedef struct {
+
+	void *private_data;
+
+	void (* release)(void *worker);
+
+	int (* post)(void *worker, int32_t tag, uint8_t *src, int32_t len);
+	int (* get)(void *worker, ECM_WORKER_RESULT *dst);  /* 1 - taken, 0 - none done */
+	int (* wait)(void *worker, ECM_WORKER_RESULT *dst); /* 1 - taken, 0 - none posted */
+	int (* get_pending)(void *worker);
+
+	int (* proc_ecm)(void *worker, B_CAS_ECM_RESULT *dst, uint8_t *src, int32_t len);
+	int (* proc_emm)(void *worker, uint8_t *src, int32_t len);
+
+} ECM_WORKER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern ECM_WORKER *create_ecm_worker(B_CAS_CARD *bcas, const MEMORY_ALLOCATOR *mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ECM_WORKER_H */
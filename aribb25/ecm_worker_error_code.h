@@ -0,0 +1,8 @@
+#ifndef ECM_WORKER_ERROR_CODE_H
+#define ECM_WORKER_ERROR_CODE_H
+
+#define ECM_WORKER_ERROR_INVALID_PARAM        -1
+
+#define ECM_WORKER_WARN_QUEUE_FULL             1
+
+#endif /* ECM_WORKER_ERROR_CODE_H */
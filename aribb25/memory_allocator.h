@@ -0,0 +1,90 @@
+#ifndef MEMORY_ALLOCATOR_H
+#define MEMORY_ALLOCATOR_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "portable.h"
+#include "arib_std_b25.h"
+
+/**
+ internal name of ARIB_STD_B25_ALLOCATOR, the same contract holds for
+ every factory method taking one. not installed, the inline helpers
+ below stay out of the library users' namespace
+ */
+typedef ARIB_STD_B25_ALLOCATOR MEMORY_ALLOCATOR;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inline functions
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static __inline void *std_allocate(void *private_data, size_t size)
+{
+	(void)private_data;
+	return malloc(size);
+}
+
+static __inline void *std_reallocate(void *private_data, void *ptr, size_t size)
+{
+	(void)private_data;
+	return realloc(ptr, size);
+}
+
+static __inline void std_deallocate(void *private_data, void *ptr)
+{
+	(void)private_data;
+	free(ptr);
+}
+
+/* src NULL selects the C runtime, returns -1 if a callback is missing */
+static __inline int init_memory_allocator(MEMORY_ALLOCATOR *dst, const MEMORY_ALLOCATOR *src)
+{
+	if(src == NULL){
+		dst->private_data = NULL;
+		dst->allocate = std_allocate;
+		dst->reallocate = std_reallocate;
+		dst->deallocate = std_deallocate;
+		return 0;
+	}
+
+	if( (src->allocate == NULL) || (src->reallocate == NULL) || (src->deallocate == NULL) ){
+		return -1;
+	}
+
+	*dst = *src;
+	return 0;
+}
+
+static __inline void *mem_malloc(const MEMORY_ALLOCATOR *mem, size_t size)
+{
+	return mem->allocate(mem->private_data, size);
+}
+
+static __inline void *mem_calloc(const MEMORY_ALLOCATOR *mem, size_t count, size_t size)
+{
+	void *r;
+
+	if( (size != 0) && (count > ((size_t)-1)/size) ){
+		return NULL;
+	}
+
+	r = mem->allocate(mem->private_data, count*size);
+	if(r != NULL){
+		memset(r, 0, count*size);
+	}
+
+	return r;
+}
+
+static __inline void *mem_realloc(const MEMORY_ALLOCATOR *mem, void *ptr, size_t size)
+{
+	return mem->reallocate(mem->private_data, ptr, size);
+}
+
+static __inline void mem_free(const MEMORY_ALLOCATOR *mem, void *ptr)
+{
+	if(ptr != NULL){
+		mem->deallocate(mem->private_data, ptr);
+	}
+}
+
+#endif /* MEMORY_ALLOCATOR_H */
@@ -1,9 +1,27 @@
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "multi2.h"
 #include "multi2_error_code.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define MULTI2_X86_SIMD
+	#define MULTI2_TARGET_SSE2   __attribute__((target("sse2")))
+	#define MULTI2_TARGET_AVX2   __attribute__((target("avx2")))
+	#define MULTI2_TARGET_AVX512 __attribute__((target("avx512f")))
+	#define MULTI2_FORCE_INLINE  __inline __attribute__((always_inline))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#include <immintrin.h>
+	#define MULTI2_X86_SIMD
+	#define MULTI2_TARGET_SSE2
+	#define MULTI2_TARGET_AVX2
+	#define MULTI2_TARGET_AVX512
+	#define MULTI2_FORCE_INLINE  __forceinline
+#endif
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  inline functions
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -27,9 +45,24 @@ static __inline uint32_t left_rotate_uint32(uint32_t val, uint32_t count)
 	return ((val << count) | (val >> (32-count)));
 }
 
+static __inline void xor_be_residual(uint8_t *dst, uint8_t *src, uint32_t l, uint32_t r, intptr_t size)
+{
+	intptr_t i;
+	uint8_t tmp[8];
+
+	save_be_uint32(tmp+0, l);
+	save_be_uint32(tmp+4, r);
+
+	for(i=0;i<size;i++){
+		dst[i] = (uint8_t)(src[i] ^ tmp[i]);
+	}
+}
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  inner structures
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define MULTI2_SCHEDULE_CACHE_SIZE (8)
+
 typedef struct {
 	uint32_t key[8];
 } CORE_PARAM;
@@ -39,9 +72,45 @@ typedef struct {
 	uint32_t r;
 } CORE_DATA;
 
+typedef void (* CORE_BLOCK_ENCRYPT)(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round);
+typedef void (* CORE_CBC_DECRYPT)(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+typedef void (* CORE_LANE_DECRYPT)(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+
+typedef struct {
+	int32_t           type;
+	int32_t           lanes;  /* blocks processed in parallel */
+	CORE_CBC_DECRYPT  cbc_decrypt;
+	CORE_LANE_DECRYPT lane_decrypt; /* one block of an independent chain per lane */
+	void             *next;   /* narrower kernel for the remaining blocks */
+} CORE_KERNEL;
+
+typedef struct {
+	CORE_DATA  key;   /* scramble key */
+	CORE_PARAM wrk;   /* core_schedule() result */
+	uint32_t   stamp; /* 0: empty, otherwise last use */
+} CORE_SCHEDULE;
+
+typedef struct {
+	int32_t            round;       /* 0: any round count */
+	CORE_BLOCK_ENCRYPT encrypt;
+	CORE_CBC_DECRYPT   cbc_decrypt; /* scalar blocks */
+} CORE_ROUND;
+
+typedef struct {
+	int32_t            ref_count; /* atomic, 0: free for reuse */
+	void              *next;      /* every epoch owned by the instance */
+
+	const CORE_KERNEL *kernel;
+	const CORE_ROUND  *core;
+	uint32_t           round;
+
+	CORE_DATA          cbc_init;
+	CORE_PARAM         wrk[2];    /* 0: odd, 1: even */
+} MULTI2_EPOCH;
+
 typedef struct {
 
-	int32_t    ref_count;
+	int32_t    ref_count; /* atomic */
 
 	CORE_DATA  cbc_init;
 
@@ -52,6 +121,18 @@ typedef struct {
 	uint32_t   round;
 	uint32_t   state;
 
+	const CORE_KERNEL *kernel;
+	const CORE_ROUND  *core;
+
+	CORE_SCHEDULE      cache[MULTI2_SCHEDULE_CACHE_SIZE];
+	uint32_t           cache_stamp;
+	MULTI2_SCHEDULE_STAT stat;
+
+	MULTI2_EPOCH      *epoch;  /* published keys, NULL until all are set */
+	MULTI2_EPOCH      *epochs; /* owned epochs, freed on release */
+
+	MEMORY_ALLOCATOR   mem;
+
 } MULTI2_PRIVATE_DATA;
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -61,6 +142,8 @@ typedef struct {
 #define MULTI2_STATE_SYSTEM_KEY_SET   (0x0002)
 #define MULTI2_STATE_SCRAMBLE_KEY_SET (0x0004)
 
+#define MULTI2_LANES_MAX              (64)
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function prottypes (interface method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -73,30 +156,54 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val);
 static int clear_scramble_key_multi2(void *m2);
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, intptr_t size);
+static int decrypt_batch_multi2(void *m2, int32_t *type, uint8_t **buf, intptr_t *size, int32_t count);
+static int decrypt_to_multi2(void *m2, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size);
+static int decrypt_batch_to_multi2(void *m2, int32_t *type, uint8_t **src, uint8_t **dst, intptr_t *size, int32_t count);
+static int set_kernel_multi2(void *m2, int32_t kernel);
+static int get_kernel_multi2(void *m2);
+static int get_schedule_stat_multi2(void *m2, MULTI2_SCHEDULE_STAT *stat);
+
+static const CORE_KERNEL *select_kernel(int32_t type, int32_t round);
+static const CORE_ROUND *select_core(int32_t round);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 MULTI2 *create_multi2(void)
+{
+	return create_multi2_ex(NULL);
+}
+
+MULTI2 *create_multi2_ex(const MEMORY_ALLOCATOR *mem)
 {
 	int n;
 
 	MULTI2 *r;
 	MULTI2_PRIVATE_DATA *prv;
 
+	MEMORY_ALLOCATOR m;
+
+	if(init_memory_allocator(&m, mem) != 0){
+		return NULL;
+	}
+
 	n  = sizeof(MULTI2_PRIVATE_DATA);
 	n += sizeof(MULTI2);
 
-	prv = (MULTI2_PRIVATE_DATA *)calloc(1, n);
+	prv = (MULTI2_PRIVATE_DATA *)mem_calloc(&m, 1, n);
 	if(prv == NULL){
 		return NULL;
 	}
 
+	prv->mem = m;
+
 	r = (MULTI2 *)(prv+1);
 	r->private_data = prv;
 
 	prv->ref_count = 1;
 	prv->round = 4;
+	prv->kernel = select_kernel(MULTI2_KERNEL_AUTO, prv->round);
+	prv->core = select_core(prv->round);
 
 	r->release = release_multi2;
 	r->add_ref = add_ref_multi2;
@@ -107,6 +214,12 @@ MULTI2 *create_multi2(void)
 	r->clear_scramble_key = clear_scramble_key_multi2;
 	r->encrypt = encrypt_multi2;
 	r->decrypt = decrypt_multi2;
+	r->decrypt_batch = decrypt_batch_multi2;
+	r->decrypt_to = decrypt_to_multi2;
+	r->decrypt_batch_to = decrypt_batch_to_multi2;
+	r->set_kernel = set_kernel_multi2;
+	r->get_kernel = get_kernel_multi2;
+	r->get_schedule_stat = get_schedule_stat_multi2;
 
 	return r;
 }
@@ -115,23 +228,105 @@ MULTI2 *create_multi2(void)
  function prottypes (private method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static MULTI2_PRIVATE_DATA *private_data(void *m2);
+static int check_state(MULTI2_PRIVATE_DATA *prv);
+
+static int publish_epoch(MULTI2_PRIVATE_DATA *prv);
+static MULTI2_EPOCH *acquire_epoch(MULTI2_PRIVATE_DATA *prv, int *err);
+static void release_epoch(MULTI2_EPOCH *ep);
+
+static void decrypt_payload(MULTI2_EPOCH *ep, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size);
+static void decrypt_payload_lanes(MULTI2_EPOCH *ep, int32_t *type, uint8_t **src, uint8_t **dst, intptr_t *size, int32_t count);
 
 static void core_schedule(CORE_PARAM *work, CORE_PARAM *skey, CORE_DATA *dkey);
+static void schedule_cached(MULTI2_PRIVATE_DATA *prv, CORE_PARAM *work, CORE_DATA *dkey);
 
 static void core_encrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round);
 static void core_decrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round);
+static void core_encrypt_r4(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round);
 
 static void core_pi1(CORE_DATA *dst, CORE_DATA *src);
 static void core_pi2(CORE_DATA *dst, CORE_DATA *src, uint32_t a);
 static void core_pi3(CORE_DATA *dst, CORE_DATA *src, uint32_t a, uint32_t b);
 static void core_pi4(CORE_DATA *dst, CORE_DATA *src, uint32_t a);
 
+static int32_t detect_cpu_kernel(void);
+static int32_t parse_kernel_name(const char *name);
+
+static void core_decrypt_cbc_scalar(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_bitslice(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_lane_bitslice(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+#if defined(MULTI2_X86_SIMD)
+static void core_decrypt_cbc_sse2(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_avx2(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_avx512(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_lane_avx2(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+static void core_decrypt_lane_avx512(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+static void core_decrypt_cbc_sse2_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_avx2_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_cbc_avx512_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc);
+static void core_decrypt_lane_avx2_r4(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+static void core_decrypt_lane_avx512_r4(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round);
+#endif
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ kernel table
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static const CORE_ROUND CORE_ROUND_ANY = {
+	0, core_encrypt, core_decrypt_cbc_scalar,
+};
+
+static const CORE_ROUND CORE_ROUND_4 = {
+	4, core_encrypt_r4, core_decrypt_cbc_r4,
+};
+
+/* scalar blocks use the round specialized core of the instance */
+static const CORE_KERNEL KERNEL_SCALAR = {
+	MULTI2_KERNEL_SCALAR, 1, NULL, NULL, NULL,
+};
+
+static const CORE_KERNEL KERNEL_BITSLICE = {
+	MULTI2_KERNEL_BITSLICE, 64, core_decrypt_cbc_bitslice, core_decrypt_lane_bitslice, (void *)&KERNEL_SCALAR,
+};
+
+#if defined(MULTI2_X86_SIMD)
+static const CORE_KERNEL KERNEL_SSE2 = {
+	MULTI2_KERNEL_SSE2, 4, core_decrypt_cbc_sse2, NULL, (void *)&KERNEL_SCALAR,
+};
+
+static const CORE_KERNEL KERNEL_AVX2 = {
+	MULTI2_KERNEL_AVX2, 8, core_decrypt_cbc_avx2, core_decrypt_lane_avx2, (void *)&KERNEL_SSE2,
+};
+
+static const CORE_KERNEL KERNEL_AVX512 = {
+	MULTI2_KERNEL_AVX512, 16, core_decrypt_cbc_avx512, core_decrypt_lane_avx512, (void *)&KERNEL_AVX2,
+};
+
+/* same chains with the rounds unrolled, picked while the round count is 4 */
+static const CORE_KERNEL KERNEL_SSE2_R4 = {
+	MULTI2_KERNEL_SSE2, 4, core_decrypt_cbc_sse2_r4, NULL, (void *)&KERNEL_SCALAR,
+};
+
+static const CORE_KERNEL KERNEL_AVX2_R4 = {
+	MULTI2_KERNEL_AVX2, 8, core_decrypt_cbc_avx2_r4, core_decrypt_lane_avx2_r4, (void *)&KERNEL_SSE2_R4,
+};
+
+static const CORE_KERNEL KERNEL_AVX512_R4 = {
+	MULTI2_KERNEL_AVX512, 16, core_decrypt_cbc_avx512_r4, core_decrypt_lane_avx512_r4, (void *)&KERNEL_AVX2_R4,
+};
+#endif
+
+#define MULTI2_KERNEL_ENV "ARIBB25_MULTI2_KERNEL"
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  interface method implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static void release_multi2(void *m2)
 {
+	MULTI2_EPOCH *ep;
+
 	MULTI2_PRIVATE_DATA *prv;
+	MEMORY_ALLOCATOR mem;
 
 	prv = private_data(m2);
 	if(prv == NULL){
@@ -139,9 +334,14 @@ static void release_multi2(void *m2)
 		return;
 	}
 
-	prv->ref_count -= 1;
-	if(prv->ref_count == 0){
-		free(prv);
+	if(atomic_add_int32(&(prv->ref_count), -1) == 0){
+		while(prv->epochs != NULL){
+			ep = prv->epochs;
+			prv->epochs = (MULTI2_EPOCH *)(ep->next);
+			mem_free(&(prv->mem), ep);
+		}
+		mem = prv->mem;
+		mem_free(&mem, prv);
 	}
 }
 
@@ -154,7 +354,7 @@ static int add_ref_multi2(void *m2)
 		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
-	prv->ref_count += 1;
+	atomic_add_int32(&(prv->ref_count), 1);
 
 	return 0;
 }
@@ -170,8 +370,10 @@ static int set_round_multi2(void *m2, int32_t val)
 	}
 
 	prv->round = val;
+	prv->core = select_core(val);
+	prv->kernel = select_kernel(prv->kernel->type, val);
 
-	return 0;
+	return publish_epoch(prv);
 }
 
 static int set_system_key_multi2(void *m2, uint8_t *val)
@@ -179,6 +381,8 @@ static int set_system_key_multi2(void *m2, uint8_t *val)
 	int i;
 	uint8_t *p;
 
+	CORE_PARAM sys;
+
 	MULTI2_PRIVATE_DATA *prv;
 
 	prv = private_data(m2);
@@ -188,12 +392,18 @@ static int set_system_key_multi2(void *m2, uint8_t *val)
 
 	p = val;
 	for(i=0;i<8;i++){
-		p = load_be_uint32(prv->sys.key+i, p);
+		p = load_be_uint32(sys.key+i, p);
+	}
+
+	if(memcmp(&sys, &(prv->sys), sizeof(sys)) != 0){
+		/* cached work keys depend on the system key */
+		memset(prv->cache, 0, sizeof(prv->cache));
+		memcpy(&(prv->sys), &sys, sizeof(sys));
 	}
 
 	prv->state |= MULTI2_STATE_SYSTEM_KEY_SET;
 
-	return 0;
+	return publish_epoch(prv);
 }
 
 static int set_init_cbc_multi2(void *m2, uint8_t *val)
@@ -214,11 +424,12 @@ static int set_init_cbc_multi2(void *m2, uint8_t *val)
 
 	prv->state |= MULTI2_STATE_CBC_INIT_SET;
 
-	return 0;
+	return publish_epoch(prv);
 }
 
 static int set_scramble_key_multi2(void *m2, uint8_t *val)
 {
+	int i;
 	uint8_t *p;
 
 	MULTI2_PRIVATE_DATA *prv;
@@ -230,17 +441,16 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val)
 
 	p = val;
 
-	p = load_be_uint32(&(prv->scr[0].l), p);
-	p = load_be_uint32(&(prv->scr[0].r), p);
-	p = load_be_uint32(&(prv->scr[1].l), p);
-	p = load_be_uint32(&(prv->scr[1].r), p);
-
-	core_schedule(prv->wrk+0, &(prv->sys), prv->scr+0);
-	core_schedule(prv->wrk+1, &(prv->sys), prv->scr+1);
+	/* usually only one of odd/even changes per ECM, the other one hits */
+	for(i=0;i<2;i++){
+		p = load_be_uint32(&(prv->scr[i].l), p);
+		p = load_be_uint32(&(prv->scr[i].r), p);
+		schedule_cached(prv, prv->wrk+i, prv->scr+i);
+	}
 
 	prv->state |= MULTI2_STATE_SCRAMBLE_KEY_SET;
 
-	return 0;
+	return publish_epoch(prv);
 }
 
 static int clear_scramble_key_multi2(void *m2)
@@ -257,16 +467,20 @@ static int clear_scramble_key_multi2(void *m2)
 
 	prv->state &= (~MULTI2_STATE_SCRAMBLE_KEY_SET);
 
-	return 0;
+	return publish_epoch(prv);
 }
 
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 {
+	int n;
+
 	CORE_DATA src,dst;
 	CORE_PARAM *prm;
 
 	uint8_t *p;
 
+	MULTI2_EPOCH *ep;
+
 	MULTI2_PRIVATE_DATA *prv;
 
 	prv = private_data(m2);
@@ -274,26 +488,19 @@ static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
-	if(prv->state != (MULTI2_STATE_CBC_INIT_SET|MULTI2_STATE_SYSTEM_KEY_SET|MULTI2_STATE_SCRAMBLE_KEY_SET)){
-		if( (prv->state & MULTI2_STATE_CBC_INIT_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_CBC_INIT;
-		}
-		if( (prv->state & MULTI2_STATE_SYSTEM_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SYSTEM_KEY;
-		}
-		if( (prv->state & MULTI2_STATE_SCRAMBLE_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
-		}
+	ep = acquire_epoch(prv, &n);
+	if(ep == NULL){
+		return n;
 	}
 
 	if(type == 0x02){
-		prm = prv->wrk+1;
+		prm = ep->wrk+1;
 	}else{
-		prm = prv->wrk+0;
+		prm = ep->wrk+0;
 	}
 
-	dst.l = prv->cbc_init.l;
-	dst.r = prv->cbc_init.r;
+	dst.l = ep->cbc_init.l;
+	dst.r = ep->cbc_init.r;
 
 	p = buf;
 	while(size >= 8){
@@ -301,92 +508,142 @@ static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 		load_be_uint32(&(src.r), p+4);
 		src.l = src.l ^ dst.l;
 		src.r = src.r ^ dst.r;
-		core_encrypt(&dst, &src, prm, prv->round);
+		ep->core->encrypt(&dst, &src, prm, ep->round);
 		p = save_be_uint32(p, dst.l);
 		p = save_be_uint32(p, dst.r);
 		size -= 8;
 	}
 
 	if(size > 0){
-		int i;
-		uint8_t tmp[8];
-
 		src.l = dst.l;
 		src.r = dst.r;
-		core_encrypt(&dst, &src, prm, prv->round);
-		save_be_uint32(tmp+0, dst.l);
-		save_be_uint32(tmp+4, dst.r);
-
-		for(i=0;i<size;i++){
-			p[i] = (uint8_t)(p[i] ^ tmp[i]);
-		}
+		ep->core->encrypt(&dst, &src, prm, ep->round);
+		xor_be_residual(p, p, dst.l, dst.r, size);
 	}
 
+	release_epoch(ep);
+
 	return 0;
 }
 
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, intptr_t size)
 {
-	CORE_DATA src,dst,cbc;
-	CORE_PARAM *prm;
+	return decrypt_to_multi2(m2, type, buf, buf, size);
+}
 
-	uint8_t *p;
+static int decrypt_batch_multi2(void *m2, int32_t *type, uint8_t **buf, intptr_t *size, int32_t count)
+{
+	return decrypt_batch_to_multi2(m2, type, buf, buf, size, count);
+}
+
+static int decrypt_to_multi2(void *m2, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size)
+{
+	int n;
+
+	MULTI2_EPOCH *ep;
 
 	MULTI2_PRIVATE_DATA *prv;
 
 	prv = private_data(m2);
-	if( (prv == NULL) || (buf == NULL) || (size < 1) ){
+	if( (prv == NULL) || (src == NULL) || (dst == NULL) || (size < 1) ){
 		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
-	if(prv->state != (MULTI2_STATE_CBC_INIT_SET|MULTI2_STATE_SYSTEM_KEY_SET|MULTI2_STATE_SCRAMBLE_KEY_SET)){
-		if( (prv->state & MULTI2_STATE_CBC_INIT_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_CBC_INIT;
-		}
-		if( (prv->state & MULTI2_STATE_SYSTEM_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SYSTEM_KEY;
-		}
-		if( (prv->state & MULTI2_STATE_SCRAMBLE_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
+	ep = acquire_epoch(prv, &n);
+	if(ep == NULL){
+		return n;
+	}
+
+	decrypt_payload(ep, type, src, dst, size);
+
+	release_epoch(ep);
+
+	return 0;
+}
+
+static int decrypt_batch_to_multi2(void *m2, int32_t *type, uint8_t **src, uint8_t **dst, intptr_t *size, int32_t count)
+{
+	int n;
+	int32_t i;
+
+	MULTI2_EPOCH *ep;
+
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (type == NULL) || (src == NULL) || (dst == NULL) || (size == NULL) || (count < 0) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	for(i=0;i<count;i++){
+		if( (src[i] == NULL) || (dst[i] == NULL) || (size[i] < 1) ){
+			return MULTI2_ERROR_INVALID_PARAMETER;
 		}
 	}
 
-	if(type == 0x02){
-		prm = prv->wrk+1;
+	/* one epoch for the whole batch, a concurrent key change applies to the next one */
+	ep = acquire_epoch(prv, &n);
+	if(ep == NULL){
+		return n;
+	}
+
+	if( (ep->kernel->lane_decrypt == NULL) || (count < 2) ){
+		for(i=0;i<count;i++){
+			decrypt_payload(ep, type[i], src[i], dst[i], size[i]);
+		}
 	}else{
-		prm = prv->wrk+0;
+		decrypt_payload_lanes(ep, type, src, dst, size, count);
 	}
 
-	cbc.l = prv->cbc_init.l;
-	cbc.r = prv->cbc_init.r;
+	release_epoch(ep);
 
-	p = buf;
-	while(size >= 8){
-		load_be_uint32(&(src.l), p+0);
-		load_be_uint32(&(src.r), p+4);
-		core_decrypt(&dst, &src, prm, prv->round);
-		dst.l = dst.l ^ cbc.l;
-		dst.r = dst.r ^ cbc.r;
-		cbc.l = src.l;
-		cbc.r = src.r;
-		p = save_be_uint32(p, dst.l);
-		p = save_be_uint32(p, dst.r);
-		size -= 8;
+	return 0;
+}
+
+static int set_kernel_multi2(void *m2, int32_t kernel)
+{
+	const CORE_KERNEL *k;
+
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if(prv == NULL){
+		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
-	if(size > 0){
-		int i;
-		uint8_t tmp[8];
+	k = select_kernel(kernel, prv->round);
+	if(k == NULL){
+		return MULTI2_ERROR_UNSUPPORTED_KERNEL;
+	}
 
-		core_encrypt(&dst, &cbc, prm, prv->round);
-		save_be_uint32(tmp+0, dst.l);
-		save_be_uint32(tmp+4, dst.r);
+	prv->kernel = k;
 
-		for(i=0;i<size;i++){
-			p[i] = (uint8_t)(p[i] ^ tmp[i]);
-		}
+	return publish_epoch(prv);
+}
+
+static int get_kernel_multi2(void *m2)
+{
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if(prv == NULL){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->kernel->type;
+}
+
+static int get_schedule_stat_multi2(void *m2, MULTI2_SCHEDULE_STAT *stat)
+{
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (stat == NULL) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
+	memcpy(stat, &(prv->stat), sizeof(MULTI2_SCHEDULE_STAT));
+
 	return 0;
 }
 
@@ -411,102 +668,544 @@ static MULTI2_PRIVATE_DATA *private_data(void *m2)
 	return r;
 }
 
-static void core_schedule(CORE_PARAM *work, CORE_PARAM *skey, CORE_DATA *dkey)
+static void schedule_cached(MULTI2_PRIVATE_DATA *prv, CORE_PARAM *work, CORE_DATA *dkey)
 {
-	CORE_DATA b1,b2,b3,b4,b5,b6,b7,b8,b9;
-
-	core_pi1(&b1, dkey);
-
-	core_pi2(&b2, &b1, skey->key[0]);
-	work->key[0] = b2.l;
+	int i;
 
-	core_pi3(&b3, &b2, skey->key[1], skey->key[2]);
-	work->key[1] = b3.r;
+	CORE_SCHEDULE *e;
 
-	core_pi4(&b4, &b3, skey->key[3]);
-	work->key[2] = b4.l;
+	prv->cache_stamp += 1;
+	if(prv->cache_stamp == 0){
+		/* wrapped - keep entries but restart the age */
+		for(i=0;i<MULTI2_SCHEDULE_CACHE_SIZE;i++){
+			if(prv->cache[i].stamp != 0){
+				prv->cache[i].stamp = 1;
+			}
+		}
+		prv->cache_stamp = 2;
+	}
 
-	core_pi1(&b5, &b4);
-	work->key[3] = b5.r;
+	e = prv->cache;
+	for(i=0;i<MULTI2_SCHEDULE_CACHE_SIZE;i++){
+		if( (prv->cache[i].stamp != 0) &&
+		    (prv->cache[i].key.l == dkey->l) &&
+		    (prv->cache[i].key.r == dkey->r) ){
+			prv->cache[i].stamp = prv->cache_stamp;
+			memcpy(work, &(prv->cache[i].wrk), sizeof(CORE_PARAM));
+			prv->stat.hit += 1;
+			return;
+		}
+		if(prv->cache[i].stamp < e->stamp){
+			e = prv->cache+i;
+		}
+	}
 
-	core_pi2(&b6, &b5, skey->key[4]);
-	work->key[4] = b6.l;
+	/* miss - schedule and replace the least recently used entry */
+	core_schedule(work, &(prv->sys), dkey);
+	prv->stat.miss += 1;
 
-	core_pi3(&b7, &b6, skey->key[5], skey->key[6]);
-	work->key[5] = b7.r;
+	e->key = *dkey;
+	memcpy(&(e->wrk), work, sizeof(CORE_PARAM));
+	e->stamp = prv->cache_stamp;
+}
 
-	core_pi4(&b8, &b7, skey->key[7]);
-	work->key[6] = b8.l;
+static int check_state(MULTI2_PRIVATE_DATA *prv)
+{
+	if(prv->state != (MULTI2_STATE_CBC_INIT_SET|MULTI2_STATE_SYSTEM_KEY_SET|MULTI2_STATE_SCRAMBLE_KEY_SET)){
+		if( (prv->state & MULTI2_STATE_CBC_INIT_SET) == 0 ){
+			return MULTI2_ERROR_UNSET_CBC_INIT;
+		}
+		if( (prv->state & MULTI2_STATE_SYSTEM_KEY_SET) == 0 ){
+			return MULTI2_ERROR_UNSET_SYSTEM_KEY;
+		}
+		if( (prv->state & MULTI2_STATE_SCRAMBLE_KEY_SET) == 0 ){
+			return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
+		}
+	}
 
-	core_pi1(&b9, &b8);
-	work->key[7] = b9.r;
+	return 0;
 }
 
-static void core_encrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round)
+static int publish_epoch(MULTI2_PRIVATE_DATA *prv)
 {
-	int32_t i;
+	int r;
+
+	MULTI2_EPOCH *ep;
+	MULTI2_EPOCH *old;
+
+	r = 0;
+	ep = NULL;
+
+	if(check_state(prv) == 0){
+		/**
+		 an epoch is reused once its reference count drops to zero,
+		 claim it by CAS as a reader may hold a transient reference
+		 */
+		ep = prv->epochs;
+		while(ep != NULL){
+			if(atomic_cas_int32(&(ep->ref_count), 0, 1)){
+				break;
+			}
+			ep = (MULTI2_EPOCH *)(ep->next);
+		}
+		if(ep == NULL){
+			ep = (MULTI2_EPOCH *)mem_calloc(&(prv->mem), 1, sizeof(MULTI2_EPOCH));
+			if(ep != NULL){
+				ep->ref_count = 1;
+				ep->next = prv->epochs;
+				prv->epochs = ep;
+			}else{
+				/* unpublish rather than keep decrypting with stale keys */
+				r = MULTI2_ERROR_NO_ENOUGH_MEMORY;
+			}
+		}
+	}
 
-	CORE_DATA tmp;
+	if(ep != NULL){
+		ep->kernel = prv->kernel;
+		ep->core = prv->core;
+		ep->round = prv->round;
+		ep->cbc_init = prv->cbc_init;
+		memcpy(ep->wrk, prv->wrk, sizeof(ep->wrk));
+	}
 
-	dst->l = src->l;
-	dst->r = src->r;
-	for(i=0;i<round;i++){
-		core_pi1(&tmp,  dst);
-		core_pi2( dst, &tmp, w->key[0]);
-		core_pi3(&tmp,  dst, w->key[1], w->key[2]);
-		core_pi4( dst, &tmp, w->key[3]);
-		core_pi1(&tmp,  dst);
-		core_pi2( dst, &tmp, w->key[4]);
-		core_pi3(&tmp,  dst, w->key[5], w->key[6]);
-		core_pi4( dst, &tmp, w->key[7]);
+	/* the instance holds one reference of the published epoch */
+	old = (MULTI2_EPOCH *)atomic_swap_ptr(&(prv->epoch), ep);
+	if(old != NULL){
+		release_epoch(old);
 	}
+
+	return r;
 }
 
-static void core_decrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round)
+static MULTI2_EPOCH *acquire_epoch(MULTI2_PRIVATE_DATA *prv, int *err)
 {
-	int32_t i;
-
-	CORE_DATA tmp;
-
-	dst->l = src->l;
-	dst->r = src->r;
-	for(i=0;i<round;i++){
-		core_pi4(&tmp,  dst, w->key[7]);
-		core_pi3( dst, &tmp, w->key[5], w->key[6]);
-		core_pi2(&tmp,  dst, w->key[4]);
-		core_pi1( dst, &tmp);
-		core_pi4(&tmp,  dst, w->key[3]);
-		core_pi3( dst, &tmp, w->key[1], w->key[2]);
-		core_pi2(&tmp,  dst, w->key[0]);
-		core_pi1( dst, &tmp);
+	MULTI2_EPOCH *ep;
+
+	/**
+	 epochs are never freed before the instance, so taking a reference
+	 of a stale pointer is harmless - it is dropped when the epoch turns
+	 out to be no longer published
+	 */
+	while(1){
+		ep = (MULTI2_EPOCH *)atomic_load_ptr(&(prv->epoch));
+		if(ep == NULL){
+			*err = check_state(prv);
+			if(*err == 0){
+				/* raced with clear_scramble_key() */
+				*err = MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
+			}
+			return NULL;
+		}
+		atomic_add_int32(&(ep->ref_count), 1);
+		if(atomic_load_ptr(&(prv->epoch)) == (void *)ep){
+			return ep;
+		}
+		release_epoch(ep);
 	}
 }
 
-static void core_pi1(CORE_DATA *dst, CORE_DATA *src)
+static void release_epoch(MULTI2_EPOCH *ep)
 {
-	dst->l = src->l;
-	dst->r = src->r ^ src->l;
+	atomic_add_int32(&(ep->ref_count), -1);
 }
 
-static void core_pi2(CORE_DATA *dst, CORE_DATA *src, uint32_t a)
+static void decrypt_payload(MULTI2_EPOCH *ep, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size)
 {
-	uint32_t t0,t1,t2;
+	intptr_t m,n;
 
-	t0 = src->r + a;
-	t1 = left_rotate_uint32(t0, 1) + t0 - 1;
-	t2 = left_rotate_uint32(t1, 4) ^ t1;
+	CORE_DATA tmp,cbc;
+	CORE_PARAM *prm;
 
-	dst->l = src->l ^ t2;
-	dst->r = src->r;
-}
+	CORE_CBC_DECRYPT func;
 
-static void core_pi3(CORE_DATA *dst, CORE_DATA *src, uint32_t a, uint32_t b)
-{
-	uint32_t t0,t1,t2,t3,t4,t5;
+	const CORE_KERNEL *kernel;
 
-	t0 = src->l + a;
-	t1 = left_rotate_uint32(t0, 2) + t0 + 1;
-	t2 = left_rotate_uint32(t1, 8) ^ t1;
+	if(type == 0x02){
+		prm = ep->wrk+1;
+	}else{
+		prm = ep->wrk+0;
+	}
+
+	cbc.l = ep->cbc_init.l;
+	cbc.r = ep->cbc_init.r;
+
+	/* widest kernel first, narrower ones take the remaining blocks */
+	kernel = ep->kernel;
+	n = size / 8;
+	while( (n > 0) && (kernel != NULL) ){
+		m = n - (n % kernel->lanes);
+		if(m > 0){
+			func = kernel->cbc_decrypt;
+			if(func == NULL){
+				func = ep->core->cbc_decrypt;
+			}
+			func(dst, src, m, prm, ep->round, &cbc);
+			src += (m * 8);
+			dst += (m * 8);
+			n -= m;
+		}
+		kernel = (const CORE_KERNEL *)(kernel->next);
+	}
+	size &= 7;
+
+	if(size > 0){
+		ep->core->encrypt(&tmp, &cbc, prm, ep->round);
+		xor_be_residual(dst, src, tmp.l, tmp.r, size);
+	}
+}
+
+static void decrypt_payload_lanes(MULTI2_EPOCH *ep, int32_t *type, uint8_t **src, uint8_t **dst, intptr_t *size, int32_t count)
+{
+	int32_t i,j,w,next,active;
+
+	uint32_t l[MULTI2_LANES_MAX];
+	uint32_t r[MULTI2_LANES_MAX];
+	uint32_t key[8*MULTI2_LANES_MAX];
+
+	CORE_DATA  cip[MULTI2_LANES_MAX];
+	CORE_DATA  cbc[MULTI2_LANES_MAX];
+	CORE_DATA  tmp;
+	CORE_PARAM *prm[MULTI2_LANES_MAX];
+
+	uint8_t  *s[MULTI2_LANES_MAX];
+	uint8_t  *d[MULTI2_LANES_MAX];
+	intptr_t  blocks[MULTI2_LANES_MAX];
+	intptr_t  tail[MULTI2_LANES_MAX];
+
+	const CORE_KERNEL *kernel;
+
+	/**
+	 each lane runs the CBC chain of one payload, a lane is refilled
+	 with the next payload as soon as its chain runs out of blocks
+	 */
+	kernel = ep->kernel;
+	w = kernel->lanes;
+
+	for(j=0;j<w;j++){
+		blocks[j] = 0;
+	}
+
+	next = 0;
+	while(1){
+
+		active = 0;
+		for(j=0;j<w;j++){
+			while( (blocks[j] == 0) && (next < count) ){
+				if(type[next] == 0x02){
+					prm[j] = ep->wrk+1;
+				}else{
+					prm[j] = ep->wrk+0;
+				}
+				s[j] = src[next];
+				d[j] = dst[next];
+				blocks[j] = size[next] / 8;
+				tail[j] = size[next] & 7;
+				cbc[j].l = ep->cbc_init.l;
+				cbc[j].r = ep->cbc_init.r;
+				next += 1;
+				if(blocks[j] == 0){
+					/* shorter than one block */
+					ep->core->encrypt(&tmp, cbc+j, prm[j], ep->round);
+					xor_be_residual(d[j], s[j], tmp.l, tmp.r, tail[j]);
+					continue;
+				}
+				for(i=0;i<8;i++){
+					key[i*w+j] = prm[j]->key[i];
+				}
+			}
+			if(blocks[j] > 0){
+				load_be_uint32(&(cip[j].l), s[j]+0);
+				load_be_uint32(&(cip[j].r), s[j]+4);
+				active += 1;
+			}else{
+				cip[j].l = 0;
+				cip[j].r = 0;
+			}
+			l[j] = cip[j].l;
+			r[j] = cip[j].r;
+		}
+
+		if(active == 0){
+			break;
+		}
+
+		kernel->lane_decrypt(l, r, key, ep->round);
+
+		for(j=0;j<w;j++){
+			if(blocks[j] == 0){
+				continue;
+			}
+			d[j] = save_be_uint32(d[j], l[j] ^ cbc[j].l);
+			d[j] = save_be_uint32(d[j], r[j] ^ cbc[j].r);
+			s[j] += 8;
+			cbc[j] = cip[j];
+			blocks[j] -= 1;
+			if( (blocks[j] == 0) && (tail[j] > 0) ){
+				ep->core->encrypt(&tmp, cbc+j, prm[j], ep->round);
+				xor_be_residual(d[j], s[j], tmp.l, tmp.r, tail[j]);
+			}
+		}
+	}
+}
+
+static const CORE_KERNEL *select_kernel(int32_t type, int32_t round)
+{
+	static int32_t cpu = -1;
+	static int32_t env = -1;
+
+	const char *name;
+
+	/* probe once - concurrent first calls store the same values */
+	if(cpu < 0){
+		cpu = detect_cpu_kernel();
+	}
+	if(env < 0){
+		name = getenv(MULTI2_KERNEL_ENV);
+		env = parse_kernel_name(name);
+		if( (env == MULTI2_KERNEL_AUTO) || ((env > cpu) && (env != MULTI2_KERNEL_BITSLICE)) ){
+			env = cpu;
+		}
+	}
+
+	if(type == MULTI2_KERNEL_AUTO){
+		type = env;
+	}
+	if(type == MULTI2_KERNEL_BITSLICE){
+		/* portable, never chosen by auto detection */
+		return &KERNEL_BITSLICE;
+	}
+	if( (type < MULTI2_KERNEL_SCALAR) || (type > cpu) ){
+		return NULL;
+	}
+
+	switch(type){
+#if defined(MULTI2_X86_SIMD)
+	case MULTI2_KERNEL_SSE2:
+		return (round == 4) ? &KERNEL_SSE2_R4 : &KERNEL_SSE2;
+	case MULTI2_KERNEL_AVX2:
+		return (round == 4) ? &KERNEL_AVX2_R4 : &KERNEL_AVX2;
+	case MULTI2_KERNEL_AVX512:
+		return (round == 4) ? &KERNEL_AVX512_R4 : &KERNEL_AVX512;
+#endif
+	default:
+		return &KERNEL_SCALAR;
+	}
+}
+
+static const CORE_ROUND *select_core(int32_t round)
+{
+	if(round == 4){
+		return &CORE_ROUND_4;
+	}
+
+	return &CORE_ROUND_ANY;
+}
+
+static int32_t detect_cpu_kernel(void)
+{
+#if defined(MULTI2_X86_SIMD) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		return MULTI2_KERNEL_AVX512;
+	}
+	if(__builtin_cpu_supports("avx2")){
+		return MULTI2_KERNEL_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")){
+		return MULTI2_KERNEL_SSE2;
+	}
+	return MULTI2_KERNEL_SCALAR;
+#elif defined(MULTI2_X86_SIMD) && defined(_MSC_VER)
+	int info[4];
+	int max;
+	uint64_t xcr0;
+
+	__cpuid(info, 0);
+	max = info[0];
+
+	__cpuid(info, 1);
+	if( (info[3] & 0x04000000) == 0 ){
+		return MULTI2_KERNEL_SCALAR;
+	}
+	/* AVX needs OSXSAVE and YMM state enabled by OS */
+	if( (max < 7) || ((info[2] & 0x18000000) != 0x18000000) ){
+		return MULTI2_KERNEL_SSE2;
+	}
+	xcr0 = _xgetbv(0);
+	if( (xcr0 & 0x06) != 0x06 ){
+		return MULTI2_KERNEL_SSE2;
+	}
+
+	__cpuidex(info, 7, 0);
+	if( (info[1] & 0x00010000) && ((xcr0 & 0xe6) == 0xe6) ){
+		return MULTI2_KERNEL_AVX512;
+	}
+	if(info[1] & 0x00000020){
+		return MULTI2_KERNEL_AVX2;
+	}
+	return MULTI2_KERNEL_SSE2;
+#else
+	return MULTI2_KERNEL_SCALAR;
+#endif
+}
+
+static int32_t parse_kernel_name(const char *name)
+{
+	static const char *NAMES[] = {
+		"auto", "scalar", "sse2", "avx2", "avx512", "bitslice",
+	};
+
+	int i,n;
+	char w[16];
+
+	if(name == NULL){
+		return MULTI2_KERNEL_AUTO;
+	}
+
+	for(i=0;(name[i] != 0) && (i < (int)(sizeof(w)-1));i++){
+		w[i] = (char)tolower((unsigned char)name[i]);
+	}
+	w[i] = 0;
+
+	n = sizeof(NAMES)/sizeof(NAMES[0]);
+	for(i=0;i<n;i++){
+		if(strcmp(w, NAMES[i]) == 0){
+			return i;
+		}
+	}
+
+	if( (w[0] >= '0') && (w[0] <= '9') ){
+		i = atoi(w);
+		if(i < n){
+			return i;
+		}
+	}
+
+	return MULTI2_KERNEL_AUTO;
+}
+
+static void core_schedule(CORE_PARAM *work, CORE_PARAM *skey, CORE_DATA *dkey)
+{
+	CORE_DATA b1,b2,b3,b4,b5,b6,b7,b8,b9;
+
+	core_pi1(&b1, dkey);
+
+	core_pi2(&b2, &b1, skey->key[0]);
+	work->key[0] = b2.l;
+
+	core_pi3(&b3, &b2, skey->key[1], skey->key[2]);
+	work->key[1] = b3.r;
+
+	core_pi4(&b4, &b3, skey->key[3]);
+	work->key[2] = b4.l;
+
+	core_pi1(&b5, &b4);
+	work->key[3] = b5.r;
+
+	core_pi2(&b6, &b5, skey->key[4]);
+	work->key[4] = b6.l;
+
+	core_pi3(&b7, &b6, skey->key[5], skey->key[6]);
+	work->key[5] = b7.r;
+
+	core_pi4(&b8, &b7, skey->key[7]);
+	work->key[6] = b8.l;
+
+	core_pi1(&b9, &b8);
+	work->key[7] = b9.r;
+}
+
+static void core_encrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round)
+{
+	int32_t i;
+
+	CORE_DATA tmp;
+
+	dst->l = src->l;
+	dst->r = src->r;
+	for(i=0;i<round;i++){
+		core_pi1(&tmp,  dst);
+		core_pi2( dst, &tmp, w->key[0]);
+		core_pi3(&tmp,  dst, w->key[1], w->key[2]);
+		core_pi4( dst, &tmp, w->key[3]);
+		core_pi1(&tmp,  dst);
+		core_pi2( dst, &tmp, w->key[4]);
+		core_pi3(&tmp,  dst, w->key[5], w->key[6]);
+		core_pi4( dst, &tmp, w->key[7]);
+	}
+}
+
+static void core_decrypt(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round)
+{
+	int32_t i;
+
+	CORE_DATA tmp;
+
+	dst->l = src->l;
+	dst->r = src->r;
+	for(i=0;i<round;i++){
+		core_pi4(&tmp,  dst, w->key[7]);
+		core_pi3( dst, &tmp, w->key[5], w->key[6]);
+		core_pi2(&tmp,  dst, w->key[4]);
+		core_pi1( dst, &tmp);
+		core_pi4(&tmp,  dst, w->key[3]);
+		core_pi3( dst, &tmp, w->key[1], w->key[2]);
+		core_pi2(&tmp,  dst, w->key[0]);
+		core_pi1( dst, &tmp);
+	}
+}
+
+static __inline void core_encrypt_r4_step(CORE_DATA *d, uint32_t k0, uint32_t k1, uint32_t k2, uint32_t k3, uint32_t k4, uint32_t k5, uint32_t k6, uint32_t k7)
+{
+	CORE_DATA t;
+
+	core_pi1(&t, d); core_pi2(d, &t, k0); core_pi3(&t, d, k1, k2); core_pi4(d, &t, k3);
+	core_pi1(&t, d); core_pi2(d, &t, k4); core_pi3(&t, d, k5, k6); core_pi4(d, &t, k7);
+}
+
+static void core_encrypt_r4(CORE_DATA *dst, CORE_DATA *src, CORE_PARAM *w, int32_t round)
+{
+	uint32_t k0,k1,k2,k3,k4,k5,k6,k7;
+
+	(void)round;
+
+	k0 = w->key[0]; k1 = w->key[1]; k2 = w->key[2]; k3 = w->key[3];
+	k4 = w->key[4]; k5 = w->key[5]; k6 = w->key[6]; k7 = w->key[7];
+
+	dst->l = src->l;
+	dst->r = src->r;
+	core_encrypt_r4_step(dst, k0, k1, k2, k3, k4, k5, k6, k7);
+	core_encrypt_r4_step(dst, k0, k1, k2, k3, k4, k5, k6, k7);
+	core_encrypt_r4_step(dst, k0, k1, k2, k3, k4, k5, k6, k7);
+	core_encrypt_r4_step(dst, k0, k1, k2, k3, k4, k5, k6, k7);
+}
+
+static void core_pi1(CORE_DATA *dst, CORE_DATA *src)
+{
+	dst->l = src->l;
+	dst->r = src->r ^ src->l;
+}
+
+static void core_pi2(CORE_DATA *dst, CORE_DATA *src, uint32_t a)
+{
+	uint32_t t0,t1,t2;
+
+	t0 = src->r + a;
+	t1 = left_rotate_uint32(t0, 1) + t0 - 1;
+	t2 = left_rotate_uint32(t1, 4) ^ t1;
+
+	dst->l = src->l ^ t2;
+	dst->r = src->r;
+}
+
+static void core_pi3(CORE_DATA *dst, CORE_DATA *src, uint32_t a, uint32_t b)
+{
+	uint32_t t0,t1,t2,t3,t4,t5;
+
+	t0 = src->l + a;
+	t1 = left_rotate_uint32(t0, 2) + t0 + 1;
+	t2 = left_rotate_uint32(t1, 8) ^ t1;
 	t3 = t2 + b;
 	t4 = left_rotate_uint32(t3, 1) - t3;
 	t5 = left_rotate_uint32(t4, 16) ^ (t4 | src->l);
@@ -525,3 +1224,818 @@ static void core_pi4(CORE_DATA *dst, CORE_DATA *src, uint32_t a)
 	dst->l = src->l ^ t1;
 	dst->r = src->r;
 }
+
+static void core_decrypt_cbc_scalar(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	CORE_DATA s,d;
+
+	while(blocks > 0){
+		load_be_uint32(&(s.l), src+0);
+		load_be_uint32(&(s.r), src+4);
+		core_decrypt(&d, &s, w, round);
+		d.l = d.l ^ cbc->l;
+		d.r = d.r ^ cbc->r;
+		cbc->l = s.l;
+		cbc->r = s.r;
+		dst = save_be_uint32(dst, d.l);
+		dst = save_be_uint32(dst, d.r);
+		src += 8;
+		blocks -= 1;
+	}
+}
+
+/**
+ 4 rounds fully unrolled, the work keys stay in registers for the packet
+ and two independent blocks are interleaved to hide the pi latency
+ */
+static __inline void core_decrypt_r4_step(CORE_DATA *d, uint32_t k0, uint32_t k1, uint32_t k2, uint32_t k3, uint32_t k4, uint32_t k5, uint32_t k6, uint32_t k7)
+{
+	CORE_DATA t;
+
+	core_pi4(&t, d, k7); core_pi3(d, &t, k5, k6); core_pi2(&t, d, k4); core_pi1(d, &t);
+	core_pi4(&t, d, k3); core_pi3(d, &t, k1, k2); core_pi2(&t, d, k0); core_pi1(d, &t);
+}
+
+static void core_decrypt_cbc_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	uint32_t k0,k1,k2,k3,k4,k5,k6,k7;
+
+	CORE_DATA s0,s1,d0,d1;
+
+	(void)round;
+
+	k0 = w->key[0]; k1 = w->key[1]; k2 = w->key[2]; k3 = w->key[3];
+	k4 = w->key[4]; k5 = w->key[5]; k6 = w->key[6]; k7 = w->key[7];
+
+	while(blocks >= 2){
+		load_be_uint32(&(s0.l), src+ 0);
+		load_be_uint32(&(s0.r), src+ 4);
+		load_be_uint32(&(s1.l), src+ 8);
+		load_be_uint32(&(s1.r), src+12);
+
+		d0 = s0;
+		d1 = s1;
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d1, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d1, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d1, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d1, k0, k1, k2, k3, k4, k5, k6, k7);
+
+		dst = save_be_uint32(dst, d0.l ^ cbc->l);
+		dst = save_be_uint32(dst, d0.r ^ cbc->r);
+		dst = save_be_uint32(dst, d1.l ^ s0.l);
+		dst = save_be_uint32(dst, d1.r ^ s0.r);
+		cbc->l = s1.l;
+		cbc->r = s1.r;
+		src += 16;
+		blocks -= 2;
+	}
+
+	if(blocks > 0){
+		load_be_uint32(&(s0.l), src+0);
+		load_be_uint32(&(s0.r), src+4);
+
+		d0 = s0;
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+		core_decrypt_r4_step(&d0, k0, k1, k2, k3, k4, k5, k6, k7);
+
+		dst = save_be_uint32(dst, d0.l ^ cbc->l);
+		dst = save_be_uint32(dst, d0.r ^ cbc->r);
+		cbc->l = s0.l;
+		cbc->r = s0.r;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ bitsliced kernel - 64 blocks in parallel, one block per bit of uint64_t
+
+ a 32bit word of the 64 blocks is kept as 32 slices, slice i holding bit i
+ of every block. additions become ripple carry adders over the slices and
+ rotations become index shifts, so the whole round is branch free.
+ ---------------------------------------------------------------------------*/
+static __inline void bitslice_swap(uint64_t *m, int32_t j, uint64_t mask)
+{
+	int32_t i,k;
+	uint64_t t;
+
+	for(k=0;k<64;k+=2*j){
+		for(i=k;i<(k+j);i++){
+			t = ((m[i] >> j) ^ m[i+j]) & mask;
+			m[i] ^= (t << j);
+			m[i+j] ^= t;
+		}
+	}
+}
+
+static void bitslice_transpose(uint64_t *m)
+{
+	bitslice_swap(m, 32, 0x00000000ffffffffULL);
+	bitslice_swap(m, 16, 0x0000ffff0000ffffULL);
+	bitslice_swap(m,  8, 0x00ff00ff00ff00ffULL);
+	bitslice_swap(m,  4, 0x0f0f0f0f0f0f0f0fULL);
+	bitslice_swap(m,  2, 0x3333333333333333ULL);
+	bitslice_swap(m,  1, 0x5555555555555555ULL);
+}
+
+/* d = rotl(a, n) + (b ^ inv) + carry, d may share storage with b only */
+static __inline void bitslice_add(uint64_t *d, uint64_t *a, int32_t n, uint64_t *b, uint64_t inv, uint64_t carry)
+{
+	int32_t i;
+	uint64_t x,y,t;
+
+	for(i=0;i<32;i++){
+		x = a[(i-n)&31];
+		y = b[i] ^ inv;
+		t = x ^ y;
+		d[i] = t ^ carry;
+		carry = (x & y) | (carry & t);
+	}
+}
+
+/* d = a - 1 */
+static __inline void bitslice_dec(uint64_t *d, uint64_t *a)
+{
+	int32_t i;
+	uint64_t x,carry;
+
+	carry = 0;
+	for(i=0;i<32;i++){
+		x = a[i];
+		d[i] = ~(x ^ carry);
+		carry = x | carry;
+	}
+}
+
+static __inline void bitslice_pi1(uint64_t *l, uint64_t *r)
+{
+	int32_t i;
+
+	for(i=0;i<32;i++){
+		r[i] ^= l[i];
+	}
+}
+
+static __inline void bitslice_pi2(uint64_t *l, uint64_t *r, uint64_t *a)
+{
+	int32_t i;
+	uint64_t t0[32],t1[32];
+
+	bitslice_add(t0, r, 0, a, 0, 0);
+	bitslice_add(t1, t0, 1, t0, 0, 0);
+	bitslice_dec(t1, t1);
+
+	for(i=0;i<32;i++){
+		l[i] ^= t1[(i-4)&31] ^ t1[i];
+	}
+}
+
+static __inline void bitslice_pi3(uint64_t *l, uint64_t *r, uint64_t *a, uint64_t *b)
+{
+	int32_t i;
+	uint64_t t0[32],t1[32];
+
+	bitslice_add(t0, l, 0, a, 0, 0);
+	bitslice_add(t1, t0, 2, t0, 0, ~0ULL);
+	for(i=0;i<32;i++){
+		t0[i] = t1[(i-8)&31] ^ t1[i];
+	}
+	bitslice_add(t1, t0, 0, b, 0, 0);
+	bitslice_add(t0, t1, 1, t1, ~0ULL, ~0ULL);
+
+	for(i=0;i<32;i++){
+		r[i] ^= t0[(i-16)&31] ^ (t0[i] | l[i]);
+	}
+}
+
+static __inline void bitslice_pi4(uint64_t *l, uint64_t *r, uint64_t *a)
+{
+	int32_t i;
+	uint64_t t0[32],t1[32];
+
+	bitslice_add(t0, r, 0, a, 0, 0);
+	bitslice_add(t1, t0, 2, t0, 0, ~0ULL);
+
+	for(i=0;i<32;i++){
+		l[i] ^= t1[i];
+	}
+}
+
+static void core_decrypt_lane_bitslice(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	int32_t i,j;
+
+	uint32_t diff;
+
+	uint64_t m[64];
+	uint64_t k[8][32];
+	uint64_t *bl,*br;
+
+	/* a common key needs no transpose, every slice is all-zero or all-one */
+	diff = 0;
+	for(i=0;i<8;i++){
+		for(j=1;j<64;j++){
+			diff |= key[i*64+j] ^ key[i*64];
+		}
+	}
+
+	if(diff == 0){
+		for(i=0;i<8;i++){
+			for(j=0;j<32;j++){
+				k[i][j] = 0 - (uint64_t)((key[i*64] >> j) & 1);
+			}
+		}
+	}else{
+		/* two words per transpose, low half to slices 0-31, high to 32-63 */
+		for(i=0;i<8;i+=2){
+			for(j=0;j<64;j++){
+				m[j] = key[i*64+j] | ((uint64_t)key[(i+1)*64+j] << 32);
+			}
+			bitslice_transpose(m);
+			memcpy(k[i+0], m+ 0, sizeof(k[0]));
+			memcpy(k[i+1], m+32, sizeof(k[0]));
+		}
+	}
+
+	for(j=0;j<64;j++){
+		m[j] = l[j] | ((uint64_t)r[j] << 32);
+	}
+	bitslice_transpose(m);
+
+	bl = m+ 0;
+	br = m+32;
+	for(i=0;i<round;i++){
+		bitslice_pi4(bl, br, k[7]);
+		bitslice_pi3(bl, br, k[5], k[6]);
+		bitslice_pi2(bl, br, k[4]);
+		bitslice_pi1(bl, br);
+		bitslice_pi4(bl, br, k[3]);
+		bitslice_pi3(bl, br, k[1], k[2]);
+		bitslice_pi2(bl, br, k[0]);
+		bitslice_pi1(bl, br);
+	}
+
+	bitslice_transpose(m);
+	for(j=0;j<64;j++){
+		l[j] = (uint32_t)m[j];
+		r[j] = (uint32_t)(m[j] >> 32);
+	}
+}
+
+static void core_decrypt_cbc_bitslice(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	int32_t i,j;
+
+	uint32_t l[64],r[64];
+	uint32_t key[8*64];
+
+	CORE_DATA s;
+
+	for(i=0;i<8;i++){
+		for(j=0;j<64;j++){
+			key[i*64+j] = w->key[i];
+		}
+	}
+
+	while(blocks >= 64){
+
+		for(j=0;j<64;j++){
+			load_be_uint32(l+j, src+8*j+0);
+			load_be_uint32(r+j, src+8*j+4);
+		}
+
+		core_decrypt_lane_bitslice(l, r, key, round);
+
+		for(j=0;j<64;j++){
+			load_be_uint32(&(s.l), src+0);
+			load_be_uint32(&(s.r), src+4);
+			dst = save_be_uint32(dst, l[j] ^ cbc->l);
+			dst = save_be_uint32(dst, r[j] ^ cbc->r);
+			cbc->l = s.l;
+			cbc->r = s.r;
+			src += 8;
+		}
+
+		blocks -= 64;
+	}
+}
+
+#if defined(MULTI2_X86_SIMD)
+/*-----------------------------------------------------------------------------
+ SSE2 kernel - 4 blocks in parallel, one block per 32bit lane
+ ---------------------------------------------------------------------------*/
+static __inline __m128i MULTI2_TARGET_SSE2 sse2_rotl(__m128i val, int count)
+{
+	return _mm_or_si128(_mm_slli_epi32(val, count), _mm_srli_epi32(val, 32-count));
+}
+
+static __inline __m128i MULTI2_TARGET_SSE2 sse2_rotl16(__m128i val)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(val, 0xb1), 0xb1);
+}
+
+static __inline __m128i MULTI2_TARGET_SSE2 sse2_bswap(__m128i val)
+{
+	val = sse2_rotl16(val);
+	return _mm_or_si128(_mm_slli_epi16(val, 8), _mm_srli_epi16(val, 8));
+}
+
+static __inline void MULTI2_TARGET_SSE2 sse2_pi1(__m128i *l, __m128i *r)
+{
+	*r = _mm_xor_si128(*r, *l);
+}
+
+static __inline void MULTI2_TARGET_SSE2 sse2_pi2(__m128i *l, __m128i *r, __m128i a)
+{
+	__m128i t0,t1,t2;
+
+	t0 = _mm_add_epi32(*r, a);
+	t1 = _mm_sub_epi32(_mm_add_epi32(sse2_rotl(t0, 1), t0), _mm_set1_epi32(1));
+	t2 = _mm_xor_si128(sse2_rotl(t1, 4), t1);
+
+	*l = _mm_xor_si128(*l, t2);
+}
+
+static __inline void MULTI2_TARGET_SSE2 sse2_pi3(__m128i *l, __m128i *r, __m128i a, __m128i b)
+{
+	__m128i t0,t1,t2,t3,t4,t5;
+
+	t0 = _mm_add_epi32(*l, a);
+	t1 = _mm_add_epi32(_mm_add_epi32(sse2_rotl(t0, 2), t0), _mm_set1_epi32(1));
+	t2 = _mm_xor_si128(sse2_rotl(t1, 8), t1);
+	t3 = _mm_add_epi32(t2, b);
+	t4 = _mm_sub_epi32(sse2_rotl(t3, 1), t3);
+	t5 = _mm_xor_si128(sse2_rotl16(t4), _mm_or_si128(t4, *l));
+
+	*r = _mm_xor_si128(*r, t5);
+}
+
+static __inline void MULTI2_TARGET_SSE2 sse2_pi4(__m128i *l, __m128i *r, __m128i a)
+{
+	__m128i t0,t1;
+
+	t0 = _mm_add_epi32(*r, a);
+	t1 = _mm_add_epi32(_mm_add_epi32(sse2_rotl(t0, 2), t0), _mm_set1_epi32(1));
+
+	*l = _mm_xor_si128(*l, t1);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_SSE2 sse2_round(__m128i *l, __m128i *r, __m128i *k)
+{
+	sse2_pi4(l, r, k[7]);
+	sse2_pi3(l, r, k[5], k[6]);
+	sse2_pi2(l, r, k[4]);
+	sse2_pi1(l, r);
+	sse2_pi4(l, r, k[3]);
+	sse2_pi3(l, r, k[1], k[2]);
+	sse2_pi2(l, r, k[0]);
+	sse2_pi1(l, r);
+}
+
+/* round is a constant 4 when inlined into the _r4 entry, unrolled there */
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_SSE2 sse2_decrypt_cbc(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	int32_t i;
+
+	__m128i k[8];
+	__m128i a,b,l,r,cl,cr,pl,pr;
+
+	for(i=0;i<8;i++){
+		k[i] = _mm_set1_epi32((int)w->key[i]);
+	}
+
+	/* lane 0 of the carry holds the previous cipher block */
+	pl = _mm_cvtsi32_si128((int)cbc->l);
+	pr = _mm_cvtsi32_si128((int)cbc->r);
+
+	while(blocks >= 4){
+
+		/* load 4 blocks and split into l/r words in host order */
+		a = sse2_bswap(_mm_loadu_si128((__m128i *)(src+ 0)));
+		b = sse2_bswap(_mm_loadu_si128((__m128i *)(src+16)));
+		cl = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2,0,2,0)));
+		cr = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3,1,3,1)));
+
+		l = cl;
+		r = cr;
+		if(round == 4){
+			sse2_round(&l, &r, k);
+			sse2_round(&l, &r, k);
+			sse2_round(&l, &r, k);
+			sse2_round(&l, &r, k);
+		}else{
+			for(i=0;i<round;i++){
+				sse2_round(&l, &r, k);
+			}
+		}
+
+		/* CBC - xor with the preceding cipher block of each lane */
+		l = _mm_xor_si128(l, _mm_or_si128(_mm_slli_si128(cl, 4), pl));
+		r = _mm_xor_si128(r, _mm_or_si128(_mm_slli_si128(cr, 4), pr));
+		pl = _mm_srli_si128(cl, 12);
+		pr = _mm_srli_si128(cr, 12);
+
+		/* merge l/r words back to big endian blocks */
+		a = sse2_bswap(_mm_unpacklo_epi32(l, r));
+		b = sse2_bswap(_mm_unpackhi_epi32(l, r));
+		_mm_storeu_si128((__m128i *)(dst+ 0), a);
+		_mm_storeu_si128((__m128i *)(dst+16), b);
+
+		src += 32;
+		dst += 32;
+		blocks -= 4;
+	}
+
+	cbc->l = (uint32_t)_mm_cvtsi128_si32(pl);
+	cbc->r = (uint32_t)_mm_cvtsi128_si32(pr);
+}
+
+static void MULTI2_TARGET_SSE2 core_decrypt_cbc_sse2(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	sse2_decrypt_cbc(dst, src, blocks, w, round, cbc);
+}
+
+static void MULTI2_TARGET_SSE2 core_decrypt_cbc_sse2_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	(void)round;
+	sse2_decrypt_cbc(dst, src, blocks, w, 4, cbc);
+}
+
+/*-----------------------------------------------------------------------------
+ AVX2 kernel - 8 blocks in parallel, one block per 32bit lane
+ ---------------------------------------------------------------------------*/
+static __inline __m256i MULTI2_TARGET_AVX2 avx2_rotl(__m256i val, int count)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(val, count), _mm256_srli_epi32(val, 32-count));
+}
+
+static __inline void MULTI2_TARGET_AVX2 avx2_pi1(__m256i *l, __m256i *r)
+{
+	*r = _mm256_xor_si256(*r, *l);
+}
+
+static __inline void MULTI2_TARGET_AVX2 avx2_pi2(__m256i *l, __m256i *r, __m256i a)
+{
+	__m256i t0,t1,t2;
+
+	t0 = _mm256_add_epi32(*r, a);
+	t1 = _mm256_sub_epi32(_mm256_add_epi32(avx2_rotl(t0, 1), t0), _mm256_set1_epi32(1));
+	t2 = _mm256_xor_si256(avx2_rotl(t1, 4), t1);
+
+	*l = _mm256_xor_si256(*l, t2);
+}
+
+static __inline void MULTI2_TARGET_AVX2 avx2_pi3(__m256i *l, __m256i *r, __m256i a, __m256i b, __m256i rot8, __m256i rot16)
+{
+	__m256i t0,t1,t2,t3,t4,t5;
+
+	t0 = _mm256_add_epi32(*l, a);
+	t1 = _mm256_add_epi32(_mm256_add_epi32(avx2_rotl(t0, 2), t0), _mm256_set1_epi32(1));
+	t2 = _mm256_xor_si256(_mm256_shuffle_epi8(t1, rot8), t1);
+	t3 = _mm256_add_epi32(t2, b);
+	t4 = _mm256_sub_epi32(avx2_rotl(t3, 1), t3);
+	t5 = _mm256_xor_si256(_mm256_shuffle_epi8(t4, rot16), _mm256_or_si256(t4, *l));
+
+	*r = _mm256_xor_si256(*r, t5);
+}
+
+static __inline void MULTI2_TARGET_AVX2 avx2_pi4(__m256i *l, __m256i *r, __m256i a)
+{
+	__m256i t0,t1;
+
+	t0 = _mm256_add_epi32(*r, a);
+	t1 = _mm256_add_epi32(_mm256_add_epi32(avx2_rotl(t0, 2), t0), _mm256_set1_epi32(1));
+
+	*l = _mm256_xor_si256(*l, t1);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX2 avx2_round(__m256i *l, __m256i *r, __m256i *k, __m256i rot8, __m256i rot16)
+{
+	avx2_pi4(l, r, k[7]);
+	avx2_pi3(l, r, k[5], k[6], rot8, rot16);
+	avx2_pi2(l, r, k[4]);
+	avx2_pi1(l, r);
+	avx2_pi4(l, r, k[3]);
+	avx2_pi3(l, r, k[1], k[2], rot8, rot16);
+	avx2_pi2(l, r, k[0]);
+	avx2_pi1(l, r);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX2 avx2_decrypt_cbc(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	int32_t i;
+
+	__m256i k[8];
+	__m256i bswap,rot8,rot16;
+	__m256i deint,inter,prev,last;
+	__m256i a,b,l,r,cl,cr,pl,pr;
+
+	bswap = _mm256_setr_epi8( 3, 2, 1, 0, 7, 6, 5, 4,11,10, 9, 8,15,14,13,12,
+	                          3, 2, 1, 0, 7, 6, 5, 4,11,10, 9, 8,15,14,13,12);
+	rot8  = _mm256_setr_epi8( 3, 0, 1, 2, 7, 4, 5, 6,11, 8, 9,10,15,12,13,14,
+	                          3, 0, 1, 2, 7, 4, 5, 6,11, 8, 9,10,15,12,13,14);
+	rot16 = _mm256_setr_epi8( 2, 3, 0, 1, 6, 7, 4, 5,10,11, 8, 9,14,15,12,13,
+	                          2, 3, 0, 1, 6, 7, 4, 5,10,11, 8, 9,14,15,12,13);
+
+	deint = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	inter = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	prev  = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+	last  = _mm256_set1_epi32(7);
+
+	for(i=0;i<8;i++){
+		k[i] = _mm256_set1_epi32((int)w->key[i]);
+	}
+
+	/* lane 0 of the carry holds the previous cipher block */
+	pl = _mm256_set1_epi32((int)cbc->l);
+	pr = _mm256_set1_epi32((int)cbc->r);
+
+	while(blocks >= 8){
+
+		/* load 8 blocks and split into l/r words in host order */
+		a = _mm256_loadu_si256((__m256i *)(src+ 0));
+		b = _mm256_loadu_si256((__m256i *)(src+32));
+		a = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(a, bswap), deint);
+		b = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(b, bswap), deint);
+		cl = _mm256_permute2x128_si256(a, b, 0x20);
+		cr = _mm256_permute2x128_si256(a, b, 0x31);
+
+		l = cl;
+		r = cr;
+		if(round == 4){
+			avx2_round(&l, &r, k, rot8, rot16);
+			avx2_round(&l, &r, k, rot8, rot16);
+			avx2_round(&l, &r, k, rot8, rot16);
+			avx2_round(&l, &r, k, rot8, rot16);
+		}else{
+			for(i=0;i<round;i++){
+				avx2_round(&l, &r, k, rot8, rot16);
+			}
+		}
+
+		/* CBC - xor with the preceding cipher block of each lane */
+		pl = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(cl, prev), pl, 0x01);
+		pr = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(cr, prev), pr, 0x01);
+		l = _mm256_xor_si256(l, pl);
+		r = _mm256_xor_si256(r, pr);
+		pl = _mm256_permutevar8x32_epi32(cl, last);
+		pr = _mm256_permutevar8x32_epi32(cr, last);
+
+		/* merge l/r words back to big endian blocks */
+		a = _mm256_permute2x128_si256(l, r, 0x20);
+		b = _mm256_permute2x128_si256(l, r, 0x31);
+		a = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(a, inter), bswap);
+		b = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(b, inter), bswap);
+		_mm256_storeu_si256((__m256i *)(dst+ 0), a);
+		_mm256_storeu_si256((__m256i *)(dst+32), b);
+
+		src += 64;
+		dst += 64;
+		blocks -= 8;
+	}
+
+	cbc->l = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(pl));
+	cbc->r = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(pr));
+}
+
+static void MULTI2_TARGET_AVX2 core_decrypt_cbc_avx2(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	avx2_decrypt_cbc(dst, src, blocks, w, round, cbc);
+}
+
+static void MULTI2_TARGET_AVX2 core_decrypt_cbc_avx2_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	(void)round;
+	avx2_decrypt_cbc(dst, src, blocks, w, 4, cbc);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX2 avx2_decrypt_lane(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	int32_t i;
+
+	__m256i k[8];
+	__m256i rot8,rot16;
+	__m256i vl,vr;
+
+	rot8  = _mm256_setr_epi8( 3, 0, 1, 2, 7, 4, 5, 6,11, 8, 9,10,15,12,13,14,
+	                          3, 0, 1, 2, 7, 4, 5, 6,11, 8, 9,10,15,12,13,14);
+	rot16 = _mm256_setr_epi8( 2, 3, 0, 1, 6, 7, 4, 5,10,11, 8, 9,14,15,12,13,
+	                          2, 3, 0, 1, 6, 7, 4, 5,10,11, 8, 9,14,15,12,13);
+
+	for(i=0;i<8;i++){
+		k[i] = _mm256_loadu_si256((__m256i *)(key+8*i));
+	}
+
+	vl = _mm256_loadu_si256((__m256i *)l);
+	vr = _mm256_loadu_si256((__m256i *)r);
+	if(round == 4){
+		avx2_round(&vl, &vr, k, rot8, rot16);
+		avx2_round(&vl, &vr, k, rot8, rot16);
+		avx2_round(&vl, &vr, k, rot8, rot16);
+		avx2_round(&vl, &vr, k, rot8, rot16);
+	}else{
+		for(i=0;i<round;i++){
+			avx2_round(&vl, &vr, k, rot8, rot16);
+		}
+	}
+	_mm256_storeu_si256((__m256i *)l, vl);
+	_mm256_storeu_si256((__m256i *)r, vr);
+}
+
+static void MULTI2_TARGET_AVX2 core_decrypt_lane_avx2(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	avx2_decrypt_lane(l, r, key, round);
+}
+
+static void MULTI2_TARGET_AVX2 core_decrypt_lane_avx2_r4(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	(void)round;
+	avx2_decrypt_lane(l, r, key, 4);
+}
+#endif
+
+#if defined(MULTI2_X86_SIMD)
+/*-----------------------------------------------------------------------------
+ AVX-512 kernel - 16 blocks in parallel, one block per 32bit lane
+ ---------------------------------------------------------------------------*/
+static __inline __m512i MULTI2_TARGET_AVX512 avx512_bswap(__m512i val)
+{
+	__m512i lo,hi;
+
+	lo = _mm512_and_si512(val, _mm512_set1_epi32(0x00ff00ff));
+	hi = _mm512_and_si512(val, _mm512_set1_epi32((int)0xff00ff00));
+
+	return _mm512_or_si512(_mm512_ror_epi32(lo, 8), _mm512_rol_epi32(hi, 8));
+}
+
+static __inline void MULTI2_TARGET_AVX512 avx512_pi1(__m512i *l, __m512i *r)
+{
+	*r = _mm512_xor_si512(*r, *l);
+}
+
+static __inline void MULTI2_TARGET_AVX512 avx512_pi2(__m512i *l, __m512i *r, __m512i a)
+{
+	__m512i t0,t1,t2;
+
+	t0 = _mm512_add_epi32(*r, a);
+	t1 = _mm512_sub_epi32(_mm512_add_epi32(_mm512_rol_epi32(t0, 1), t0), _mm512_set1_epi32(1));
+	t2 = _mm512_xor_si512(_mm512_rol_epi32(t1, 4), t1);
+
+	*l = _mm512_xor_si512(*l, t2);
+}
+
+static __inline void MULTI2_TARGET_AVX512 avx512_pi3(__m512i *l, __m512i *r, __m512i a, __m512i b)
+{
+	__m512i t0,t1,t2,t3,t4,t5;
+
+	t0 = _mm512_add_epi32(*l, a);
+	t1 = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(t0, 2), t0), _mm512_set1_epi32(1));
+	t2 = _mm512_xor_si512(_mm512_rol_epi32(t1, 8), t1);
+	t3 = _mm512_add_epi32(t2, b);
+	t4 = _mm512_sub_epi32(_mm512_rol_epi32(t3, 1), t3);
+	t5 = _mm512_xor_si512(_mm512_rol_epi32(t4, 16), _mm512_or_si512(t4, *l));
+
+	*r = _mm512_xor_si512(*r, t5);
+}
+
+static __inline void MULTI2_TARGET_AVX512 avx512_pi4(__m512i *l, __m512i *r, __m512i a)
+{
+	__m512i t0,t1;
+
+	t0 = _mm512_add_epi32(*r, a);
+	t1 = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(t0, 2), t0), _mm512_set1_epi32(1));
+
+	*l = _mm512_xor_si512(*l, t1);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX512 avx512_round(__m512i *l, __m512i *r, __m512i *k)
+{
+	avx512_pi4(l, r, k[7]);
+	avx512_pi3(l, r, k[5], k[6]);
+	avx512_pi2(l, r, k[4]);
+	avx512_pi1(l, r);
+	avx512_pi4(l, r, k[3]);
+	avx512_pi3(l, r, k[1], k[2]);
+	avx512_pi2(l, r, k[0]);
+	avx512_pi1(l, r);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX512 avx512_decrypt_cbc(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	int32_t i;
+
+	__m512i k[8];
+	__m512i even,odd,lo,hi,last;
+	__m512i a,b,l,r,cl,cr,pl,pr;
+
+	even = _mm512_setr_epi32( 0, 2, 4, 6, 8,10,12,14,16,18,20,22,24,26,28,30);
+	odd  = _mm512_setr_epi32( 1, 3, 5, 7, 9,11,13,15,17,19,21,23,25,27,29,31);
+	lo   = _mm512_setr_epi32( 0,16, 1,17, 2,18, 3,19, 4,20, 5,21, 6,22, 7,23);
+	hi   = _mm512_setr_epi32( 8,24, 9,25,10,26,11,27,12,28,13,29,14,30,15,31);
+	last = _mm512_set1_epi32(15);
+
+	for(i=0;i<8;i++){
+		k[i] = _mm512_set1_epi32((int)w->key[i]);
+	}
+
+	/* lane 15 of the carry holds the previous cipher block */
+	pl = _mm512_set1_epi32((int)cbc->l);
+	pr = _mm512_set1_epi32((int)cbc->r);
+
+	while(blocks >= 16){
+
+		/* load 16 blocks and split into l/r words in host order */
+		a = avx512_bswap(_mm512_loadu_si512((void *)(src+ 0)));
+		b = avx512_bswap(_mm512_loadu_si512((void *)(src+64)));
+		cl = _mm512_permutex2var_epi32(a, even, b);
+		cr = _mm512_permutex2var_epi32(a, odd, b);
+
+		l = cl;
+		r = cr;
+		if(round == 4){
+			avx512_round(&l, &r, k);
+			avx512_round(&l, &r, k);
+			avx512_round(&l, &r, k);
+			avx512_round(&l, &r, k);
+		}else{
+			for(i=0;i<round;i++){
+				avx512_round(&l, &r, k);
+			}
+		}
+
+		/* CBC - xor with the preceding cipher block of each lane */
+		l = _mm512_xor_si512(l, _mm512_alignr_epi32(cl, pl, 15));
+		r = _mm512_xor_si512(r, _mm512_alignr_epi32(cr, pr, 15));
+		pl = cl;
+		pr = cr;
+
+		/* merge l/r words back to big endian blocks */
+		a = avx512_bswap(_mm512_permutex2var_epi32(l, lo, r));
+		b = avx512_bswap(_mm512_permutex2var_epi32(l, hi, r));
+		_mm512_storeu_si512((void *)(dst+ 0), a);
+		_mm512_storeu_si512((void *)(dst+64), b);
+
+		src += 128;
+		dst += 128;
+		blocks -= 16;
+	}
+
+	pl = _mm512_permutexvar_epi32(last, pl);
+	pr = _mm512_permutexvar_epi32(last, pr);
+	cbc->l = (uint32_t)_mm_cvtsi128_si32(_mm512_castsi512_si128(pl));
+	cbc->r = (uint32_t)_mm_cvtsi128_si32(_mm512_castsi512_si128(pr));
+}
+
+static void MULTI2_TARGET_AVX512 core_decrypt_cbc_avx512(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	avx512_decrypt_cbc(dst, src, blocks, w, round, cbc);
+}
+
+static void MULTI2_TARGET_AVX512 core_decrypt_cbc_avx512_r4(uint8_t *dst, uint8_t *src, intptr_t blocks, CORE_PARAM *w, int32_t round, CORE_DATA *cbc)
+{
+	(void)round;
+	avx512_decrypt_cbc(dst, src, blocks, w, 4, cbc);
+}
+
+static MULTI2_FORCE_INLINE void MULTI2_TARGET_AVX512 avx512_decrypt_lane(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	int32_t i;
+
+	__m512i k[8];
+	__m512i vl,vr;
+
+	for(i=0;i<8;i++){
+		k[i] = _mm512_loadu_si512((void *)(key+16*i));
+	}
+
+	vl = _mm512_loadu_si512((void *)l);
+	vr = _mm512_loadu_si512((void *)r);
+	if(round == 4){
+		avx512_round(&vl, &vr, k);
+		avx512_round(&vl, &vr, k);
+		avx512_round(&vl, &vr, k);
+		avx512_round(&vl, &vr, k);
+	}else{
+		for(i=0;i<round;i++){
+			avx512_round(&vl, &vr, k);
+		}
+	}
+	_mm512_storeu_si512((void *)l, vl);
+	_mm512_storeu_si512((void *)r, vr);
+}
+
+static void MULTI2_TARGET_AVX512 core_decrypt_lane_avx512(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	avx512_decrypt_lane(l, r, key, round);
+}
+
+static void MULTI2_TARGET_AVX512 core_decrypt_lane_avx512_r4(uint32_t *l, uint32_t *r, uint32_t *key, int32_t round)
+{
+	(void)round;
+	avx512_decrypt_lane(l, r, key, 4);
+}
+#endif
@@ -2,7 +2,25 @@
 #define MULTI2_H
 
 #include "portable.h"
+#include "memory_allocator.h"
 
+#define MULTI2_KERNEL_AUTO     0
+#define MULTI2_KERNEL_SCALAR   1
+#define MULTI2_KERNEL_SSE2     2
+#define MULTI2_KERNEL_AVX2     3
+#define MULTI2_KERNEL_AVX512   4
+#define MULTI2_KERNEL_BITSLICE 5
+
+typedef struct {
+	int64_t hit;   /* work keys reused without core_schedule() */
+	int64_t miss;  /* work keys scheduled */
+} MULTI2_SCHEDULE_STAT;
+
+/**
+ setters publish an immutable key epoch, encrypt/decrypt work on the epoch
+ they picked up and may run in other threads while the keys are updated.
+ setters themselves must not be called concurrently.
+ */
 typedef struct {
 
 	void *private_data;
@@ -20,6 +38,16 @@ typedef struct {
 	int (* encrypt)(void *m2, int32_t type, uint8_t *buf, int32_t size);
 	int (* decrypt)(void *m2, int32_t type, uint8_t *buf, intptr_t size);
 
+	int (* set_kernel)(void *m2, int32_t kernel);
+	int (* get_kernel)(void *m2);
+
+	int (* decrypt_batch)(void *m2, int32_t *type, uint8_t **buf, intptr_t *size, int32_t count);
+
+	int (* get_schedule_stat)(void *m2, MULTI2_SCHEDULE_STAT *stat);
+
+	int (* decrypt_to)(void *m2, int32_t type, uint8_t *src, uint8_t *dst, intptr_t size);
+	int (* decrypt_batch_to)(void *m2, int32_t *type, uint8_t **src, uint8_t **dst, intptr_t *size, int32_t count);
+
 } MULTI2;
 
 #ifdef __cplusplus
@@ -27,6 +55,7 @@ extern "C" {
 #endif
 
 extern MULTI2 *create_multi2(void);
+extern MULTI2 *create_multi2_ex(const MEMORY_ALLOCATOR *mem);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,929 @@
+/**
+ MULTI2 microbenchmark and kernel verification
+
+ multi2.c is included directly so the static core functions can be
+ measured without the interface overhead. results are written to stdout
+ as CSV, one line per case and kernel:
+
+   case,kernel,round,bytes,ops,seconds,mb_per_sec,cycles_per_byte
+
+ bytes is the size processed by one operation. cycles_per_byte uses the
+ time stamp counter (reference cycles) and is "nan" where unavailable.
+ the sweep_<bytes> cases decrypt one payload of 64 bytes to 64 KB per
+ operation, comparing kernels along them gives the crossover sizes.
+
+ with -v every available kernel is checked against known answers of the
+ original implementation and against core_encrypt()/core_decrypt() on
+ random keys, IVs, rounds and payload lengths (up to VERIFY_PAYLOAD_MAX,
+ so 64 block bitslice rows and long SIMD runs are covered), then its 184
+ byte batch throughput is compared with the reference:
+
+   kernel,cases,mismatches,mb_per_sec,speedup
+
+ the exit status is non zero when any output differs.
+ */
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#include "multi2.c"
+
+#if defined(_WIN32)
+	#include <windows.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <x86intrin.h>
+	#define BENCH_HAVE_TSC
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#define BENCH_HAVE_TSC
+#endif
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define BENCH_BATCH_COUNT (64)
+#define BENCH_BULK_SIZE   (65536)
+
+/* long enough for 64 block bitslice runs and long SIMD runs */
+#define VERIFY_PAYLOAD_MAX (4104)
+
+typedef struct {
+	double  seconds;  /* minimum measuring time per case */
+	int32_t round;
+	int32_t kernel;   /* MULTI2_KERNEL_AUTO: every available kernel */
+	int32_t verify;   /* random cases per kernel, 0: benchmark */
+} OPTION;
+
+typedef struct {
+	int32_t  round;
+	int32_t  type;
+	int32_t  size;
+	uint32_t seed;     /* keys, IV and data are drawn from verify_rand() */
+	uint32_t decrypt;  /* FNV-1a of the output */
+	uint32_t encrypt;
+} KNOWN_ANSWER;
+
+typedef struct {
+	uint8_t  sys[32];
+	uint8_t  cbc[8];
+	uint8_t  scr[16];  /* odd, even */
+	int32_t  round;
+} VERIFY_KEY;
+
+typedef struct {
+
+	const char *name;
+	int32_t     kernel;   /* -1: kernel independent */
+	intptr_t    size;     /* bytes per operation */
+
+	MULTI2     *m2;
+	MULTI2_PRIVATE_DATA *prv;
+
+	uint8_t    *buf;
+	uint8_t    *src[BENCH_BATCH_COUNT];
+	uint8_t    *dst[BENCH_BATCH_COUNT];
+	int32_t     type[BENCH_BATCH_COUNT];
+	intptr_t    len[BENCH_BATCH_COUNT];
+
+	void (* func)(void *bc, int64_t n);
+
+} BENCH_CASE;
+
+/* results are stored here so the measured calls can not be dropped */
+static volatile uint32_t bench_sink;
+
+static const char *KERNEL_NAMES[] = {
+	"auto", "scalar", "sse2", "avx2", "avx512", "bitslice",
+};
+
+/* recorded with the multi2.c that predates the kernel selection */
+static const KNOWN_ANSWER KAT[] = {
+	{  4, 0x02,  184, 0x25000000U, 0x628b8e98U, 0x15e98b40U },
+	{  4, 0x03,  184, 0x25000001U, 0x13287c1dU, 0xa03ab8faU },
+	{  4, 0x02,  183, 0x25000002U, 0xee854829U, 0x2f7188acU },
+	{  4, 0x03,    7, 0x25000003U, 0x698aad93U, 0x698aad93U },
+	{  4, 0x02,    1, 0x25000004U, 0x640b5facU, 0x640b5facU },
+	{  4, 0x03,    8, 0x25000005U, 0xa98387e7U, 0x61a19f6aU },
+	{  1, 0x02,  184, 0x25000006U, 0xc07c5a8eU, 0xe67de388U },
+	{  2, 0x03,  100, 0x25000007U, 0xaff938b6U, 0xa889fc9aU },
+	{  3, 0x02,   64, 0x25000008U, 0x2dd29869U, 0xac458413U },
+	{  5, 0x03,   17, 0x25000009U, 0xfa3bedfeU, 0x420c7347U },
+	{  6, 0x02,  184, 0x2500000aU, 0x814077bfU, 0xfff3728bU },
+	{  8, 0x03,  183, 0x2500000bU, 0x88eb1074U, 0x5475708fU },
+	{ 32, 0x02,  184, 0x2500000cU, 0xd91acd58U, 0x616bfc75U },
+	{  4, 0x02,  512, 0x2500000dU, 0x37cc4b4cU, 0xb39edd08U },
+	{  4, 0x03,  520, 0x2500000eU, 0x9d00a1d0U, 0x49c337e1U },
+	{  4, 0x02, 1024, 0x2500000fU, 0xc128ea63U, 0x4dabed7dU },
+	{  5, 0x03, 2051, 0x25000010U, 0x6b56690cU, 0xc0704fb3U },
+	{  4, 0x03, 4101, 0x25000011U, 0x59903077U, 0xfef01862U },
+};
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prottypes
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void show_usage(void);
+static int parse_arg(OPTION *dst, int argc, char **argv);
+
+static MULTI2 *create_bench_multi2(int32_t round, int32_t kernel);
+static double run_case(BENCH_CASE *bc, OPTION *opt, int32_t quiet);
+
+static int verify_kernels(OPTION *opt);
+static int64_t verify_kernel(MULTI2 *m2, OPTION *opt, int64_t *cases);
+static int64_t verify_payload(MULTI2 *m2, VERIFY_KEY *key, int32_t type, uint8_t *data, intptr_t size);
+static int64_t verify_batch(MULTI2 *m2, VERIFY_KEY *key, uint32_t *seed);
+
+static uint32_t verify_rand(uint32_t *seed);
+static uint32_t fnv1a(uint8_t *data, intptr_t size);
+static void make_verify_key(VERIFY_KEY *key, int32_t round, uint32_t *seed);
+static void set_verify_key(MULTI2 *m2, VERIFY_KEY *key);
+static void ref_setup(VERIFY_KEY *key, int32_t type, CORE_PARAM *wrk, CORE_DATA *cbc);
+static void ref_decrypt(CORE_PARAM *wrk, CORE_DATA *cbc_init, int32_t round, uint8_t *buf, intptr_t size);
+static void ref_encrypt(CORE_PARAM *wrk, CORE_DATA *cbc_init, int32_t round, uint8_t *buf, intptr_t size);
+
+static void bench_core_schedule(void *bc, int64_t n);
+static void bench_encrypt_block(void *bc, int64_t n);
+static void bench_decrypt_block(void *bc, int64_t n);
+static void bench_decrypt(void *bc, int64_t n);
+static void bench_decrypt_batch(void *bc, int64_t n);
+static void bench_reference(void *bc, int64_t n);
+
+static double read_seconds(void);
+static uint64_t read_cycles(void);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ main
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+int main(int argc, char **argv)
+{
+	static const intptr_t PAYLOAD[] = {
+		184, /* full TS packet payload */
+		183, /* 22 blocks and a 7 byte tail */
+		7,   /* tail only */
+	};
+	static const char *PAYLOAD_NAMES[] = {
+		"payload_184", "payload_183", "payload_7",
+	};
+
+	int i,k;
+	intptr_t size;
+	char name[32];
+	OPTION opt;
+	BENCH_CASE bc;
+
+	static uint8_t buf[BENCH_BULK_SIZE];
+	static uint8_t pkt[BENCH_BATCH_COUNT][188];
+
+	if(parse_arg(&opt, argc, argv) < argc){
+		show_usage();
+		return EXIT_FAILURE;
+	}
+
+	if(opt.verify > 0){
+		return verify_kernels(&opt);
+	}
+
+	for(i=0;i<(int)sizeof(buf);i++){
+		buf[i] = (uint8_t)(i * 37 + 11);
+	}
+	for(i=0;i<BENCH_BATCH_COUNT;i++){
+		memcpy(pkt[i], buf+i, 188);
+	}
+
+	printf("case,kernel,round,bytes,ops,seconds,mb_per_sec,cycles_per_byte\n");
+
+	/* kernel independent cases run on the scalar core */
+	memset(&bc, 0, sizeof(bc));
+	bc.kernel = -1;
+	bc.m2 = create_bench_multi2(opt.round, MULTI2_KERNEL_SCALAR);
+	if(bc.m2 == NULL){
+		fprintf(stderr, "error - failed on create_multi2()\n");
+		return EXIT_FAILURE;
+	}
+	bc.prv = private_data(bc.m2);
+
+	bc.name = "core_schedule";
+	bc.size = 8;
+	bc.func = bench_core_schedule;
+	run_case(&bc, &opt, 0);
+
+	bc.name = "encrypt_block";
+	bc.size = 8;
+	bc.func = bench_encrypt_block;
+	run_case(&bc, &opt, 0);
+
+	bc.name = "decrypt_block";
+	bc.size = 8;
+	bc.func = bench_decrypt_block;
+	run_case(&bc, &opt, 0);
+
+	bc.m2->release(bc.m2);
+
+	for(k=MULTI2_KERNEL_SCALAR;k<=MULTI2_KERNEL_BITSLICE;k++){
+
+		if( (opt.kernel != MULTI2_KERNEL_AUTO) && (opt.kernel != k) ){
+			continue;
+		}
+
+		memset(&bc, 0, sizeof(bc));
+		bc.kernel = k;
+		bc.m2 = create_bench_multi2(opt.round, k);
+		if(bc.m2 == NULL){
+			/* not supported on this cpu */
+			continue;
+		}
+		bc.prv = private_data(bc.m2);
+		bc.buf = buf;
+
+		for(i=0;i<(int)(sizeof(PAYLOAD)/sizeof(PAYLOAD[0]));i++){
+			bc.name = PAYLOAD_NAMES[i];
+			bc.size = PAYLOAD[i];
+			bc.func = bench_decrypt;
+			run_case(&bc, &opt, 0);
+		}
+
+		bc.name = "bulk_65536";
+		bc.size = BENCH_BULK_SIZE;
+		bc.func = bench_decrypt;
+		run_case(&bc, &opt, 0);
+
+		/* 8 blocks to 64 KB, shows where a wide kernel starts to pay off */
+		for(size=64;size<=BENCH_BULK_SIZE;size+=size){
+			sprintf(name, "sweep_%ld", (long)size);
+			bc.name = name;
+			bc.size = size;
+			bc.func = bench_decrypt;
+			run_case(&bc, &opt, 0);
+		}
+
+		/* lane kernels against per packet dispatch, both odd/even keys */
+		for(i=0;i<BENCH_BATCH_COUNT;i++){
+			bc.src[i] = pkt[i]+4;
+			bc.dst[i] = pkt[i]+4;
+			bc.type[i] = 2 + (i & 1);
+			bc.len[i] = 184;
+		}
+		bc.name = "batch_184x64";
+		bc.size = 184 * BENCH_BATCH_COUNT;
+		bc.func = bench_decrypt_batch;
+		run_case(&bc, &opt, 0);
+
+		bc.m2->release(bc.m2);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void show_usage(void)
+{
+	fprintf(stderr, "multi2_bench - MULTI2 microbenchmark\n");
+	fprintf(stderr, "usage: multi2_bench [options]\n");
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -k kernel (auto, scalar, sse2, avx2, avx512, bitslice)\n");
+	fprintf(stderr, "     auto: every kernel supported by this cpu (default)\n");
+	fprintf(stderr, "  -r round (integer, default=4)\n");
+	fprintf(stderr, "  -t seconds per case (default=0.2)\n");
+	fprintf(stderr, "  -v cases\n");
+	fprintf(stderr, "     0: benchmark (default)\n");
+	fprintf(stderr, "     n: verify every kernel with n random cases\n");
+	fprintf(stderr, "\n");
+}
+
+static int parse_arg(OPTION *dst, int argc, char **argv)
+{
+	int i;
+	char c;
+	char *v;
+
+	dst->seconds = 0.2;
+	dst->round = 4;
+	dst->kernel = MULTI2_KERNEL_AUTO;
+	dst->verify = 0;
+
+	for(i=1;i<argc;i++){
+		if( (argv[i][0] != '-') || (argv[i][1] == 0) ){
+			break;
+		}
+		c = argv[i][1];
+		if(argv[i][2]){
+			v = argv[i]+2;
+		}else if(i+1 < argc){
+			v = argv[i+1];
+			i += 1;
+		}else{
+			fprintf(stderr, "error - missing value of '-%c'\n", c);
+			return 0;
+		}
+		switch(c){
+		case 'k':
+			dst->kernel = parse_kernel_name(v);
+			break;
+		case 'r':
+			dst->round = atoi(v);
+			break;
+		case 't':
+			dst->seconds = atof(v);
+			break;
+		case 'v':
+			dst->verify = atoi(v);
+			break;
+		default:
+			fprintf(stderr, "error - unknown option '-%c'\n", c);
+			return 0;
+		}
+	}
+
+	return i;
+}
+
+static MULTI2 *create_bench_multi2(int32_t round, int32_t kernel)
+{
+	int i;
+	uint8_t sys[32];
+	uint8_t cbc[8];
+	uint8_t scr[16];
+
+	MULTI2 *r;
+
+	r = create_multi2();
+	if(r == NULL){
+		return NULL;
+	}
+
+	if(r->set_kernel(r, kernel) < 0){
+		r->release(r);
+		return NULL;
+	}
+
+	for(i=0;i<32;i++){
+		sys[i] = (uint8_t)(i * 13 + 1);
+	}
+	for(i=0;i<8;i++){
+		cbc[i] = (uint8_t)(i * 29 + 3);
+	}
+	for(i=0;i<16;i++){
+		scr[i] = (uint8_t)(i * 71 + 5);
+	}
+
+	r->set_round(r, round);
+	r->set_system_key(r, sys);
+	r->set_init_cbc(r, cbc);
+	r->set_scramble_key(r, scr);
+
+	return r;
+}
+
+static double run_case(BENCH_CASE *bc, OPTION *opt, int32_t quiet)
+{
+	int64_t n;
+	double t0,t;
+	uint64_t c0,c;
+	double bytes;
+
+	/* warm up, then double the count until the case runs long enough */
+	bc->func(bc, 16);
+
+	n = 16;
+	while(1){
+		t0 = read_seconds();
+		c0 = read_cycles();
+		bc->func(bc, n);
+		c = read_cycles() - c0;
+		t = read_seconds() - t0;
+		if( (t >= opt->seconds) || (n >= ((int64_t)1 << 40)) ){
+			break;
+		}
+		n += n;
+	}
+
+	bytes = (double)n * (double)bc->size;
+	if(t <= 0){
+		t = 1e-9;
+	}
+
+	if(quiet){
+		return bytes/t/1e6;
+	}
+
+	printf("%s,%s,%d,%ld,%lld,%.6f,%.2f,",
+	       bc->name, (bc->kernel < 0) ? "-" : KERNEL_NAMES[bc->kernel],
+	       (int)opt->round, (long)bc->size, (long long)n, t, bytes/t/1e6);
+#if defined(BENCH_HAVE_TSC)
+	printf("%.3f\n", (double)c/bytes);
+#else
+	(void)c;
+	printf("nan\n");
+#endif
+	fflush(stdout);
+
+	return bytes/t/1e6;
+}
+
+static int verify_kernels(OPTION *opt)
+{
+	int32_t i,k;
+	int64_t cases,bad,total;
+	double ref,mbps;
+
+	BENCH_CASE bc;
+
+	static uint8_t pkt[BENCH_BATCH_COUNT][184];
+
+	printf("kernel,cases,mismatches,mb_per_sec,speedup\n");
+
+	memset(&bc, 0, sizeof(bc));
+	for(i=0;i<BENCH_BATCH_COUNT;i++){
+		memset(pkt[i], i, 184);
+		bc.src[i] = pkt[i];
+		bc.dst[i] = pkt[i];
+		bc.type[i] = 2 + (i & 1);
+		bc.len[i] = 184;
+	}
+	bc.size = 184 * BENCH_BATCH_COUNT;
+
+	/* the reference speed is the plain core_decrypt() loop */
+	bc.m2 = create_bench_multi2(opt->round, MULTI2_KERNEL_SCALAR);
+	if(bc.m2 == NULL){
+		fprintf(stderr, "error - failed on create_multi2()\n");
+		return EXIT_FAILURE;
+	}
+	bc.prv = private_data(bc.m2);
+	bc.func = bench_reference;
+	ref = run_case(&bc, opt, 1);
+	bc.m2->release(bc.m2);
+
+	printf("reference,0,0,%.2f,1.00\n", ref);
+
+	total = 0;
+	for(k=MULTI2_KERNEL_SCALAR;k<=MULTI2_KERNEL_BITSLICE;k++){
+
+		if( (opt->kernel != MULTI2_KERNEL_AUTO) && (opt->kernel != k) ){
+			continue;
+		}
+
+		bc.m2 = create_bench_multi2(opt->round, k);
+		if(bc.m2 == NULL){
+			/* not supported on this cpu */
+			continue;
+		}
+		bc.prv = private_data(bc.m2);
+
+		cases = 0;
+		bad = verify_kernel(bc.m2, opt, &cases);
+		total += bad;
+
+		/* verify_kernel() left its own keys, restore the bench ones */
+		bc.m2->release(bc.m2);
+		bc.m2 = create_bench_multi2(opt->round, k);
+		if(bc.m2 == NULL){
+			fprintf(stderr, "error - failed on create_multi2()\n");
+			return EXIT_FAILURE;
+		}
+		bc.func = bench_decrypt_batch;
+		mbps = run_case(&bc, opt, 1);
+		bc.m2->release(bc.m2);
+
+		printf("%s,%lld,%lld,%.2f,%.2f\n", KERNEL_NAMES[k],
+		       (long long)cases, (long long)bad, mbps, mbps/ref);
+		fflush(stdout);
+	}
+
+	return (total == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int64_t verify_kernel(MULTI2 *m2, OPTION *opt, int64_t *cases)
+{
+	int32_t i,n,round,type;
+	int64_t r;
+	uint32_t seed;
+	intptr_t size;
+
+	static uint8_t buf[VERIFY_PAYLOAD_MAX];
+	VERIFY_KEY key;
+
+	r = 0;
+
+	/* known answers */
+	n = sizeof(KAT)/sizeof(KAT[0]);
+	for(i=0;i<n;i++){
+		seed = KAT[i].seed;
+		make_verify_key(&key, KAT[i].round, &seed);
+		for(size=0;size<KAT[i].size;size++){
+			buf[size] = (uint8_t)verify_rand(&seed);
+		}
+		set_verify_key(m2, &key);
+
+		m2->decrypt(m2, KAT[i].type, buf, KAT[i].size);
+		if(fnv1a(buf, KAT[i].size) != KAT[i].decrypt){
+			fprintf(stderr, "mismatch - known answer %d decrypt\n", i);
+			r += 1;
+		}
+
+		seed = KAT[i].seed;
+		make_verify_key(&key, KAT[i].round, &seed);
+		for(size=0;size<KAT[i].size;size++){
+			buf[size] = (uint8_t)verify_rand(&seed);
+		}
+		m2->encrypt(m2, KAT[i].type, buf, KAT[i].size);
+		if(fnv1a(buf, KAT[i].size) != KAT[i].encrypt){
+			fprintf(stderr, "mismatch - known answer %d encrypt\n", i);
+			r += 1;
+		}
+
+		*cases += 1;
+	}
+
+	/* random cases against core_encrypt()/core_decrypt() */
+	seed = 0x4d324b00U + (uint32_t)m2->get_kernel(m2);
+	for(i=0;i<opt->verify;i++){
+		round = 1 + (int32_t)(verify_rand(&seed) % 8);
+		if(i & 1){
+			/* the round count in use, it has its own core */
+			round = 4;
+		}
+		make_verify_key(&key, round, &seed);
+		set_verify_key(m2, &key);
+
+		type = 2 + (int32_t)(verify_rand(&seed) & 1);
+		size = 1 + (intptr_t)(verify_rand(&seed) % 184);
+		if( (i % 3) == 2 ){
+			/* whole bitslice rows and long SIMD runs plus a remainder */
+			size = 512 + (intptr_t)(verify_rand(&seed) % (VERIFY_PAYLOAD_MAX - 511));
+		}
+		for(n=0;n<size;n++){
+			buf[n] = (uint8_t)verify_rand(&seed);
+		}
+		r += verify_payload(m2, &key, type, buf, size);
+
+		if( (i % 8) == 0 ){
+			r += verify_batch(m2, &key, &seed);
+		}
+
+		*cases += 1;
+	}
+
+	return r;
+}
+
+static int64_t verify_payload(MULTI2 *m2, VERIFY_KEY *key, int32_t type, uint8_t *data, intptr_t size)
+{
+	int64_t r;
+
+	static uint8_t ref[VERIFY_PAYLOAD_MAX];
+	static uint8_t out[VERIFY_PAYLOAD_MAX];
+	static uint8_t tmp[VERIFY_PAYLOAD_MAX];
+
+	CORE_PARAM wrk;
+	CORE_DATA cbc;
+
+	r = 0;
+
+	ref_setup(key, type, &wrk, &cbc);
+
+	memcpy(ref, data, size);
+	ref_decrypt(&wrk, &cbc, key->round, ref, size);
+
+	memset(out, 0, sizeof(out));
+	m2->decrypt_to(m2, type, data, out, size);
+	if(memcmp(ref, out, size) != 0){
+		r += 1;
+	}
+
+	memcpy(tmp, data, size);
+	m2->decrypt(m2, type, tmp, size);
+	if(memcmp(ref, tmp, size) != 0){
+		r += 1;
+	}
+
+	memcpy(ref, data, size);
+	ref_encrypt(&wrk, &cbc, key->round, ref, size);
+
+	memcpy(tmp, data, size);
+	m2->encrypt(m2, type, tmp, size);
+	if(memcmp(ref, tmp, size) != 0){
+		r += 1;
+	}
+
+	if(r != 0){
+		fprintf(stderr, "mismatch - kernel=%s round=%d type=%d size=%ld\n",
+		        KERNEL_NAMES[m2->get_kernel(m2)], (int)key->round, (int)type, (long)size);
+	}
+
+	return r;
+}
+
+static int64_t verify_batch(MULTI2 *m2, VERIFY_KEY *key, uint32_t *seed)
+{
+	int32_t i,n,count;
+	int64_t r;
+
+	int32_t type[BENCH_BATCH_COUNT];
+	intptr_t size[BENCH_BATCH_COUNT];
+	uint8_t *src[BENCH_BATCH_COUNT];
+	uint8_t *dst[BENCH_BATCH_COUNT];
+
+	CORE_PARAM wrk;
+	CORE_DATA cbc;
+
+	static uint8_t data[BENCH_BATCH_COUNT][184];
+	static uint8_t ref[BENCH_BATCH_COUNT][184];
+	static uint8_t out[BENCH_BATCH_COUNT][184];
+
+	/* mixed lengths and keys, so lanes refill at different blocks */
+	count = 1 + (int32_t)(verify_rand(seed) % BENCH_BATCH_COUNT);
+	for(i=0;i<count;i++){
+		type[i] = 2 + (int32_t)(verify_rand(seed) & 1);
+		size[i] = 1 + (intptr_t)(verify_rand(seed) % 184);
+		if(verify_rand(seed) & 1){
+			size[i] = 184;
+		}
+		for(n=0;n<size[i];n++){
+			data[i][n] = (uint8_t)verify_rand(seed);
+		}
+		memcpy(ref[i], data[i], size[i]);
+		ref_setup(key, type[i], &wrk, &cbc);
+		ref_decrypt(&wrk, &cbc, key->round, ref[i], size[i]);
+		src[i] = data[i];
+		dst[i] = out[i];
+	}
+
+	r = 0;
+
+	m2->decrypt_batch_to(m2, type, src, dst, size, count);
+	for(i=0;i<count;i++){
+		if(memcmp(ref[i], out[i], size[i]) != 0){
+			r += 1;
+		}
+	}
+
+	m2->decrypt_batch(m2, type, src, size, count);
+	for(i=0;i<count;i++){
+		if(memcmp(ref[i], data[i], size[i]) != 0){
+			r += 1;
+		}
+	}
+
+	if(r != 0){
+		fprintf(stderr, "mismatch - kernel=%s round=%d batch of %d\n",
+		        KERNEL_NAMES[m2->get_kernel(m2)], (int)key->round, (int)count);
+	}
+
+	return r;
+}
+
+static uint32_t verify_rand(uint32_t *seed)
+{
+	*seed = *seed * 1103515245U + 12345U;
+	return *seed >> 16;
+}
+
+static uint32_t fnv1a(uint8_t *data, intptr_t size)
+{
+	intptr_t i;
+	uint32_t r;
+
+	r = 2166136261U;
+	for(i=0;i<size;i++){
+		r ^= data[i];
+		r *= 16777619U;
+	}
+
+	return r;
+}
+
+static void make_verify_key(VERIFY_KEY *key, int32_t round, uint32_t *seed)
+{
+	int i;
+
+	for(i=0;i<32;i++){
+		key->sys[i] = (uint8_t)verify_rand(seed);
+	}
+	for(i=0;i<8;i++){
+		key->cbc[i] = (uint8_t)verify_rand(seed);
+	}
+	for(i=0;i<16;i++){
+		key->scr[i] = (uint8_t)verify_rand(seed);
+	}
+	key->round = round;
+}
+
+static void set_verify_key(MULTI2 *m2, VERIFY_KEY *key)
+{
+	m2->set_round(m2, key->round);
+	m2->set_system_key(m2, key->sys);
+	m2->set_init_cbc(m2, key->cbc);
+	m2->set_scramble_key(m2, key->scr);
+}
+
+static void ref_setup(VERIFY_KEY *key, int32_t type, CORE_PARAM *wrk, CORE_DATA *cbc)
+{
+	int i;
+	uint8_t *p;
+
+	CORE_PARAM sys;
+	CORE_DATA dkey;
+
+	p = key->sys;
+	for(i=0;i<8;i++){
+		p = load_be_uint32(sys.key+i, p);
+	}
+
+	p = key->cbc;
+	p = load_be_uint32(&(cbc->l), p);
+	p = load_be_uint32(&(cbc->r), p);
+
+	if(type == 0x02){
+		p = key->scr+8;
+	}else{
+		p = key->scr+0;
+	}
+	p = load_be_uint32(&(dkey.l), p);
+	p = load_be_uint32(&(dkey.r), p);
+
+	core_schedule(wrk, &sys, &dkey);
+}
+
+static void ref_decrypt(CORE_PARAM *wrk, CORE_DATA *cbc_init, int32_t round, uint8_t *buf, intptr_t size)
+{
+	CORE_DATA src,dst,cbc;
+
+	uint8_t *p;
+
+	cbc = *cbc_init;
+
+	p = buf;
+	while(size >= 8){
+		load_be_uint32(&(src.l), p+0);
+		load_be_uint32(&(src.r), p+4);
+		core_decrypt(&dst, &src, wrk, round);
+		dst.l ^= cbc.l;
+		dst.r ^= cbc.r;
+		p = save_be_uint32(p, dst.l);
+		p = save_be_uint32(p, dst.r);
+		cbc = src;
+		size -= 8;
+	}
+
+	if(size > 0){
+		core_encrypt(&dst, &cbc, wrk, round);
+		xor_be_residual(p, p, dst.l, dst.r, size);
+	}
+}
+
+static void ref_encrypt(CORE_PARAM *wrk, CORE_DATA *cbc_init, int32_t round, uint8_t *buf, intptr_t size)
+{
+	CORE_DATA src,dst;
+
+	uint8_t *p;
+
+	dst = *cbc_init;
+
+	p = buf;
+	while(size >= 8){
+		load_be_uint32(&(src.l), p+0);
+		load_be_uint32(&(src.r), p+4);
+		src.l ^= dst.l;
+		src.r ^= dst.r;
+		core_encrypt(&dst, &src, wrk, round);
+		p = save_be_uint32(p, dst.l);
+		p = save_be_uint32(p, dst.r);
+		size -= 8;
+	}
+
+	if(size > 0){
+		src = dst;
+		core_encrypt(&dst, &src, wrk, round);
+		xor_be_residual(p, p, dst.l, dst.r, size);
+	}
+}
+
+static void bench_core_schedule(void *bc, int64_t n)
+{
+	int64_t i;
+	CORE_DATA dkey;
+	CORE_PARAM wrk;
+
+	BENCH_CASE *p;
+
+	p = (BENCH_CASE *)bc;
+
+	dkey = p->prv->scr[0];
+	for(i=0;i<n;i++){
+		/* chain the keys so the calls can not be hoisted */
+		core_schedule(&wrk, &(p->prv->sys), &dkey);
+		dkey.l ^= wrk.key[0];
+		dkey.r ^= wrk.key[7];
+	}
+	bench_sink = dkey.l;
+}
+
+static void bench_encrypt_block(void *bc, int64_t n)
+{
+	int64_t i;
+	CORE_DATA d;
+
+	BENCH_CASE *p;
+	MULTI2_PRIVATE_DATA *prv;
+
+	p = (BENCH_CASE *)bc;
+	prv = p->prv;
+
+	d = prv->cbc_init;
+	for(i=0;i<n;i++){
+		prv->core->encrypt(&d, &d, prv->wrk+0, prv->round);
+	}
+	bench_sink = d.l;
+}
+
+static void bench_decrypt_block(void *bc, int64_t n)
+{
+	int64_t i;
+	CORE_DATA cbc;
+	uint8_t blk[8];
+
+	BENCH_CASE *p;
+	MULTI2_PRIVATE_DATA *prv;
+
+	p = (BENCH_CASE *)bc;
+	prv = p->prv;
+
+	memset(blk, 0x5a, sizeof(blk));
+	cbc = prv->cbc_init;
+	for(i=0;i<n;i++){
+		prv->core->cbc_decrypt(blk, blk, 1, prv->wrk+0, prv->round, &cbc);
+	}
+	bench_sink = blk[0];
+}
+
+static void bench_decrypt(void *bc, int64_t n)
+{
+	int64_t i;
+
+	BENCH_CASE *p;
+
+	p = (BENCH_CASE *)bc;
+
+	for(i=0;i<n;i++){
+		p->m2->decrypt(p->m2, 2 + (int32_t)(i & 1), p->buf, p->size);
+	}
+}
+
+static void bench_decrypt_batch(void *bc, int64_t n)
+{
+	int64_t i;
+
+	BENCH_CASE *p;
+
+	p = (BENCH_CASE *)bc;
+
+	for(i=0;i<n;i++){
+		p->m2->decrypt_batch_to(p->m2, p->type, p->src, p->dst, p->len, BENCH_BATCH_COUNT);
+	}
+}
+
+static void bench_reference(void *bc, int64_t n)
+{
+	int64_t i;
+	int32_t j;
+
+	BENCH_CASE *p;
+	MULTI2_PRIVATE_DATA *prv;
+
+	p = (BENCH_CASE *)bc;
+	prv = p->prv;
+
+	for(i=0;i<n;i++){
+		for(j=0;j<BENCH_BATCH_COUNT;j++){
+			ref_decrypt(prv->wrk + ((p->type[j] == 0x02) ? 1 : 0), &(prv->cbc_init), prv->round, p->src[j], p->len[j]);
+		}
+	}
+}
+
+static double read_seconds(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER f,c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (double)c.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static uint64_t read_cycles(void)
+{
+#if defined(BENCH_HAVE_TSC)
+	return (uint64_t)__rdtsc();
+#else
+	return 0;
+#endif
+}
@@ -5,5 +5,7 @@
 #define MULTI2_ERROR_UNSET_SYSTEM_KEY        -2
 #define MULTI2_ERROR_UNSET_CBC_INIT          -3
 #define MULTI2_ERROR_UNSET_SCRAMBLE_KEY      -4
+#define MULTI2_ERROR_UNSUPPORTED_KERNEL      -5
+#define MULTI2_ERROR_NO_ENOUGH_MEMORY        -6
 
 #endif /* MULTI2_ERROR_CODE_H */
@@ -22,4 +22,22 @@
 
 #endif
 
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+
+#define atomic_add_int32(p, v)    (_InterlockedExchangeAdd((volatile long *)(p), (long)(v)) + (v))
+#define atomic_cas_int32(p, o, n) (_InterlockedCompareExchange((volatile long *)(p), (long)(n), (long)(o)) == (long)(o))
+#define atomic_load_ptr(p)        _InterlockedCompareExchangePointer((void * volatile *)(p), NULL, NULL)
+#define atomic_swap_ptr(p, v)     _InterlockedExchangePointer((void * volatile *)(p), (void *)(v))
+
+#else
+
+#define atomic_add_int32(p, v)    __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_cas_int32(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define atomic_load_ptr(p)        __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define atomic_swap_ptr(p, v)     __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+
+#endif
+
 #endif /* PORTABLE_H */
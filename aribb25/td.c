@@ -33,6 +33,8 @@
 #include "arib_std_b25.h"
 #include "arib_std_b25_error_code.h"
 #include "b_cas_card.h"
+#include "b_cas_broker.h"
+#include "ecm_cache.h"
 
 typedef struct {
 	int32_t round;
@@ -40,12 +42,16 @@ typedef struct {
 	int32_t emm;
 	int32_t verbose;
 	int32_t power_ctrl;
+	const TCHAR *broker;
+	const TCHAR *cache;
+	int32_t expire;
 } OPTION;
 
 static void show_usage();
 static int parse_arg(OPTION *dst, int argc, TCHAR **argv);
 static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt);
 static void show_bcas_power_on_control_info(B_CAS_CARD *bcas);
+static void copy_path(char *dst, int size, const TCHAR *src);
 
 int _tmain(int argc, TCHAR **argv)
 {
@@ -84,6 +90,9 @@ static void show_usage()
 	_ftprintf(stderr, _T("b25 - ARIB STD-B25 test program version %s\n"), _T(VERSION_STRING));
 	_ftprintf(stderr, _T("usage: b25 [options] src.m2t dst.m2t [more pair ..]\n"));
 	_ftprintf(stderr, _T("options:\n"));
+	_ftprintf(stderr, _T("  -b b25broker socket, share its card (default=none, open the reader)\n"));
+	_ftprintf(stderr, _T("  -C ECM cache file, kept across runs (default=none)\n"));
+	_ftprintf(stderr, _T("  -E ECM cache expire in seconds (default=0, never)\n"));
 	_ftprintf(stderr, _T("  -r round (integer, default=4)\n"));
 	_ftprintf(stderr, _T("  -s strip\n"));
 	_ftprintf(stderr, _T("     0: keep null(padding) stream (default)\n"));
@@ -109,12 +118,39 @@ static int parse_arg(OPTION *dst, int argc, TCHAR **argv)
 	dst->emm = 0;
 	dst->power_ctrl = 1;
 	dst->verbose = 1;
+	dst->broker = NULL;
+	dst->cache = NULL;
+	dst->expire = 0;
 
 	for(i=1;i<argc;i++){
 		if(argv[i][0] != '-'){
 			break;
 		}
 		switch(argv[i][1]){
+		case 'b':
+			if(argv[i][2]){
+				dst->broker = argv[i]+2;
+			}else{
+				dst->broker = argv[i+1];
+				i += 1;
+			}
+			break;
+		case 'C':
+			if(argv[i][2]){
+				dst->cache = argv[i]+2;
+			}else{
+				dst->cache = argv[i+1];
+				i += 1;
+			}
+			break;
+		case 'E':
+			if(argv[i][2]){
+				dst->expire = _ttoi(argv[i]+2);
+			}else{
+				dst->expire = _ttoi(argv[i+1]);
+				i += 1;
+			}
+			break;
 		case 'm':
 			if(argv[i][2]){
 				dst->emm = _ttoi(argv[i]+2);
@@ -181,12 +217,15 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 
 	ARIB_STD_B25 *b25;
 	B_CAS_CARD   *bcas;
+	B_CAS_CARD   *card;
 
 	ARIB_STD_B25_PROGRAM_INFO pgrm;
 
 	uint8_t data[64*1024];
 	uint8_t *_data;
 
+	char path[1024];
+
 	ARIB_STD_B25_BUFFER sbuf;
 	ARIB_STD_B25_BUFFER dbuf;
 
@@ -230,10 +269,31 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 		goto LAST;
 	}
 
-	bcas = create_b_cas_card();
-	if(bcas == NULL){
-		_ftprintf(stderr, _T("error - failed on create_b_cas_card()\n"));
-		goto LAST;
+	if(opt->broker != NULL){
+		/* several b25 processes at once, b25broker owns the reader */
+		copy_path(path, sizeof(path), opt->broker);
+		bcas = create_b_cas_broker_card(path);
+		if(bcas == NULL){
+			_ftprintf(stderr, _T("error - failed on create_b_cas_broker_card()\n"));
+			goto LAST;
+		}
+	}else{
+		bcas = create_b_cas_card();
+		if(bcas == NULL){
+			_ftprintf(stderr, _T("error - failed on create_b_cas_card()\n"));
+			goto LAST;
+		}
+	}
+
+	if(opt->cache != NULL){
+		/* re-decoding a recording answers its ECMs from the file */
+		copy_path(path, sizeof(path), opt->cache);
+		card = create_ecm_cache(bcas, path, opt->expire, 0);
+		if(card == NULL){
+			_ftprintf(stderr, _T("error - failed on create_ecm_cache()\n"));
+			goto LAST;
+		}
+		bcas = card;
 	}
 
 	code = bcas->init(bcas);
@@ -464,3 +524,15 @@ static void show_bcas_power_on_control_info(B_CAS_CARD *bcas)
 		_ftprintf(stdout, _T("least %d hours\n"), pwc.data[i].hold_time);
 	}
 }
+
+static void copy_path(char *dst, int size, const TCHAR *src)
+{
+#if defined(_WIN32) && defined(_UNICODE)
+	if(WideCharToMultiByte(CP_ACP, 0, src, -1, dst, size, NULL, NULL) == 0){
+		dst[0] = 0;
+	}
+#else
+	strncpy(dst, src, size-1);
+	dst[size-1] = 0;
+#endif
+}
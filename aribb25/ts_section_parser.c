@@ -32,6 +32,8 @@ typedef struct {
 
 	TS_SECTION_PARSER_STAT  stat;
 
+	MEMORY_ALLOCATOR        mem;
+
 } TS_SECTION_PARSER_PRIVATE_DATA;
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -49,27 +51,40 @@ static int get_ts_section_parser(void *parser, TS_SECTION *sect);
 static int ret_ts_section_parser(void *parser, TS_SECTION *sect);
 static int get_count_ts_section_parser(void *parser);
 static int get_stat_ts_section_parser(void *parser, TS_SECTION_PARSER_STAT *stat);
+static int reserve_ts_section_parser(void *parser, int32_t count);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation (factory method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 TS_SECTION_PARSER *create_ts_section_parser(void)
+{
+	return create_ts_section_parser_ex(NULL);
+}
+
+TS_SECTION_PARSER *create_ts_section_parser_ex(const MEMORY_ALLOCATOR *mem)
 {
 	TS_SECTION_PARSER *r;
 	TS_SECTION_PARSER_PRIVATE_DATA *prv;
 
+	MEMORY_ALLOCATOR m;
+
 	int n;
 
+	if(init_memory_allocator(&m, mem) != 0){
+		return NULL;
+	}
+
 	n  = sizeof(TS_SECTION_PARSER_PRIVATE_DATA);
 	n += sizeof(TS_SECTION_PARSER);
 
-	prv = (TS_SECTION_PARSER_PRIVATE_DATA *)calloc(1, n);
+	prv = (TS_SECTION_PARSER_PRIVATE_DATA *)mem_calloc(&m, 1, n);
 	if(prv == NULL){
 		/* failed on malloc() - no enough memory */
 		return NULL;
 	}
 
 	prv->pid = -1;
+	prv->mem = m;
 
 	r = (TS_SECTION_PARSER *)(prv+1);
 	r->private_data = prv;
@@ -85,6 +100,8 @@ TS_SECTION_PARSER *create_ts_section_parser(void)
 
 	r->get_stat = get_stat_ts_section_parser;
 
+	r->reserve = reserve_ts_section_parser;
+
 	return r;
 }
 
@@ -93,6 +110,7 @@ TS_SECTION_PARSER *create_ts_section_parser(void)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static TS_SECTION_PARSER_PRIVATE_DATA *private_data(void *parser);
 static void teardown(TS_SECTION_PARSER_PRIVATE_DATA *prv);
+static void recycle(TS_SECTION_PARSER_PRIVATE_DATA *prv);
 
 static int put_exclude_section_start(TS_SECTION_PARSER_PRIVATE_DATA *prv, uint8_t *data, intptr_t size);
 static int put_include_section_start(TS_SECTION_PARSER_PRIVATE_DATA *prv, uint8_t *data, intptr_t size);
@@ -112,11 +130,11 @@ static TS_SECTION_ELEM *query_work_elem(TS_SECTION_PARSER_PRIVATE_DATA *prv);
 
 static void extract_ts_section_header(TS_SECTION *sect);
 
-static TS_SECTION_ELEM *create_ts_section_elem(void);
+static TS_SECTION_ELEM *create_ts_section_elem(TS_SECTION_PARSER_PRIVATE_DATA *prv);
 static TS_SECTION_ELEM *get_ts_section_list_head(TS_SECTION_LIST *list);
 static void put_ts_section_list_tail(TS_SECTION_LIST *list, TS_SECTION_ELEM *elem);
 static void unlink_ts_section_list(TS_SECTION_LIST *list, TS_SECTION_ELEM *elem);
-static void clear_ts_section_list(TS_SECTION_LIST *list);
+static void clear_ts_section_list(TS_SECTION_PARSER_PRIVATE_DATA *prv, TS_SECTION_LIST *list);
 
 static uint32_t crc32(uint8_t *head, uint8_t *tail);
 
@@ -126,6 +144,7 @@ static uint32_t crc32(uint8_t *head, uint8_t *tail);
 static void release_ts_section_parser(void *parser)
 {
 	TS_SECTION_PARSER_PRIVATE_DATA *prv;
+	MEMORY_ALLOCATOR mem;
 
 	prv = private_data(parser);
 	if(prv == NULL){
@@ -134,8 +153,9 @@ static void release_ts_section_parser(void *parser)
 
 	teardown(prv);
 
+	mem = prv->mem;
 	memset(parser, 0, sizeof(TS_SECTION_PARSER));
-	free(prv);
+	mem_free(&mem, prv);
 }
 
 static int reset_ts_section_parser(void *parser)
@@ -147,7 +167,7 @@ static int reset_ts_section_parser(void *parser)
 		return TS_SECTION_PARSER_ERROR_INVALID_PARAM;
 	}
 
-	teardown(prv);
+	recycle(prv);
 
 	return 0;
 }
@@ -249,6 +269,27 @@ static int get_stat_ts_section_parser(void *parser, TS_SECTION_PARSER_STAT *stat
 	return 0;
 }
 
+static int reserve_ts_section_parser(void *parser, int32_t count)
+{
+	TS_SECTION_PARSER_PRIVATE_DATA *prv;
+	TS_SECTION_ELEM *w;
+
+	prv = private_data(parser);
+	if(prv == NULL){
+		return TS_SECTION_PARSER_ERROR_INVALID_PARAM;
+	}
+
+	while(prv->pool.count < count){
+		w = create_ts_section_elem(prv);
+		if(w == NULL){
+			return TS_SECTION_PARSER_ERROR_NO_ENOUGH_MEMORY;
+		}
+		put_ts_section_list_tail(&(prv->pool), w);
+	}
+
+	return 0;
+}
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function implementation (private method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -275,14 +316,40 @@ static void teardown(TS_SECTION_PARSER_PRIVATE_DATA *prv)
 	prv->pid = -1;
 
 	if(prv->work != NULL){
-		free(prv->work);
+		mem_free(&(prv->mem), prv->work);
 		prv->work = NULL;
 	}
 
 	prv->last = NULL;
 
-	clear_ts_section_list(&(prv->pool));
-	clear_ts_section_list(&(prv->buff));
+	clear_ts_section_list(prv, &(prv->pool));
+	clear_ts_section_list(prv, &(prv->buff));
+
+	memset(&(prv->stat), 0, sizeof(TS_SECTION_PARSER_STAT));
+}
+
+static void recycle(TS_SECTION_PARSER_PRIVATE_DATA *prv)
+{
+	TS_SECTION_ELEM *w;
+
+	prv->pid = -1;
+
+	if(prv->work != NULL){
+		put_ts_section_list_tail(&(prv->pool), prv->work);
+		prv->work = NULL;
+	}
+	while( (w = get_ts_section_list_head(&(prv->buff))) != NULL ){
+		put_ts_section_list_tail(&(prv->pool), w);
+	}
+
+	w = prv->pool.head;
+	while(w != NULL){
+		reset_section(&(w->sect));
+		w->ref = 0;
+		w = (TS_SECTION_ELEM *)(w->next);
+	}
+
+	prv->last = NULL;
 
 	memset(&(prv->stat), 0, sizeof(TS_SECTION_PARSER_STAT));
 }
@@ -542,7 +609,7 @@ static TS_SECTION_ELEM *query_work_elem(TS_SECTION_PARSER_PRIVATE_DATA *prv)
 		return r;
 	}
 
-	return create_ts_section_elem();
+	return create_ts_section_elem(prv);
 }
 
 static void extract_ts_section_header(TS_SECTION *sect)
@@ -589,13 +656,13 @@ static void extract_ts_section_header(TS_SECTION *sect)
 	return;
 }
 
-static TS_SECTION_ELEM *create_ts_section_elem(void)
+static TS_SECTION_ELEM *create_ts_section_elem(TS_SECTION_PARSER_PRIVATE_DATA *prv)
 {
 	TS_SECTION_ELEM *r;
 	int n;
 
 	n = sizeof(TS_SECTION_ELEM) + MAX_RAW_SECTION_SIZE;
-	r = (TS_SECTION_ELEM *)calloc(1, n);
+	r = (TS_SECTION_ELEM *)mem_calloc(&(prv->mem), 1, n);
 	if(r == NULL){
 		/* failed on malloc() */
 		return NULL;
@@ -682,7 +749,7 @@ static void unlink_ts_section_list(TS_SECTION_LIST *list, TS_SECTION_ELEM *elem)
 	list->count -= 1;
 }
 
-static void clear_ts_section_list(TS_SECTION_LIST *list)
+static void clear_ts_section_list(TS_SECTION_PARSER_PRIVATE_DATA *prv, TS_SECTION_LIST *list)
 {
 	TS_SECTION_ELEM *e;
 	TS_SECTION_ELEM *n;
@@ -694,7 +761,7 @@ static void clear_ts_section_list(TS_SECTION_LIST *list)
 	e = list->head;
 	while(e != NULL){
 		n = (TS_SECTION_ELEM *)(e->next);
-		free(e);
+		mem_free(&(prv->mem), e);
 		e = n;
 	}
 
@@ -2,6 +2,7 @@
 #define TS_SECTION_PARSER_H
 
 #include "ts_common_types.h"
+#include "memory_allocator.h"
 
 typedef struct {
 	int64_t total;      /* total received section count      */
@@ -25,6 +26,9 @@ typedef struct {
 
 	int (* get_stat)(void *parser, TS_SECTION_PARSER_STAT *stat);
 
+	/* keeps at least count section buffers, reset() keeps them too */
+	int (* reserve)(void *parser, int32_t count);
+
 } TS_SECTION_PARSER;
 
 #ifdef __cplusplus
@@ -32,6 +36,7 @@ extern "C" {
 #endif
 
 extern TS_SECTION_PARSER *create_ts_section_parser(void);
+extern TS_SECTION_PARSER *create_ts_section_parser_ex(const MEMORY_ALLOCATOR *mem);
 
 #ifdef __cplusplus
 }